@@ -388,8 +388,8 @@ func (c *Set) SetProc() error {
 	if err := c.good(); err != nil {
 		return err
 	}
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	c.mu.RLock()
 	defer c.mu.RUnlock()
 	return sc.setProc(c)
@@ -432,8 +432,8 @@ func (sc *syscaller) dropBound(val ...Value) error {
 // ill-defined state. The caller can determine where things went wrong
 // using GetBound().
 func DropBound(val ...Value) error {
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	return sc.dropBound(val...)
 }
 
@@ -480,8 +480,8 @@ func (sc *syscaller) setAmbient(enable bool, val ...Value) error {
 // Note, the cap package manages an abstraction IAB that captures all
 // three inheritable vectors in a single type. Consider using that.
 func SetAmbient(enable bool, val ...Value) error {
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	return sc.setAmbient(enable, val...)
 }
 
@@ -507,7 +507,7 @@ func (sc *syscaller) resetAmbient() error {
 // already raised in both the Permitted and Inheritable Set is allowed
 // to be raised by the kernel.
 func ResetAmbient() error {
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	return sc.resetAmbient()
 }
@@ -4,9 +4,16 @@
 package cap
 
 import (
+	"errors"
 	"fmt"
+	"io"
 	"os"
+	"runtime"
+	"sort"
+	"sync"
+	"syscall"
 	"testing"
+	"time"
 )
 
 func TestFiles(t *testing.T) {
@@ -75,3 +82,163 @@ func TestFiles(t *testing.T) {
 		t.Errorf("unable to remove file cap from %q: %v", reg, err)
 	}
 }
+
+func TestLoadFileCap(t *testing.T) {
+	vs := []struct {
+		d    []byte
+		err  error
+		text string
+		root int
+	}{
+		{d: []byte{0, 0, 0, 1, 1, 0, 0, 0, 0x20, 0, 0, 0}, text: "cap_kill=i cap_chown+p"},
+		{d: []byte{1, 0, 0, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, text: "cap_net_bind_service=ep"},
+		{d: []byte{0, 0, 0, 3, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xe8, 3, 0, 0}, text: "cap_setuid=p", root: 1000},
+		{d: []byte{0, 0, 0, 2, 1, 0, 0, 0, 0, 0, 0, 0}, err: io.ErrUnexpectedEOF},
+		{d: []byte{0, 0, 0, 4, 1, 0, 0, 0, 0, 0, 0, 0}, err: ErrBadMagic},
+		{d: []byte{0, 0, 0, 1, 1, 0, 0, 0}, err: ErrBadSize},
+	}
+	c, err := FromText("all=eip")
+	if err != nil {
+		t.Fatalf("unable to make a set: %v", err)
+	}
+	c.SetNSOwner(7)
+	for i, v := range vs {
+		err := c.loadFileCap(v.d, len(v.d), nil)
+		if err != v.err {
+			t.Errorf("[%d] got err=%v, want %v", i, err, v.err)
+			continue
+		}
+		if err != nil {
+			continue
+		}
+		if got := c.String(); got != v.text {
+			t.Errorf("[%d] got %q, want %q", i, got, v.text)
+		}
+		if c.nsRoot != v.root {
+			t.Errorf("[%d] got rootid=%d, want %d", i, c.nsRoot, v.root)
+		}
+	}
+}
+
+// capTree makes a directory tree of files, some with file capabilities
+// when the caller has the privilege to set them. It returns the root
+// of the tree, and the sorted paths of the files with capabilities.
+func capTree(t testing.TB, dirs, files int) (string, []string) {
+	t.Helper()
+	td := t.TempDir()
+	want, err := FromText("cap_setuid=p")
+	if err != nil {
+		t.Fatalf("unable to make a set: %v", err)
+	}
+	var capped []string
+	for i := 0; i < dirs; i++ {
+		d := fmt.Sprint(td, "/d", i, "/sub")
+		if err := os.MkdirAll(d, 0755); err != nil {
+			t.Fatalf("unable to make %q: %v", d, err)
+		}
+		if err := os.Symlink(d, fmt.Sprint(d, "/loop")); err != nil {
+			t.Fatalf("unable to make symlink in %q: %v", d, err)
+		}
+		for j := 0; j < files; j++ {
+			f := fmt.Sprint(d, "/f", j)
+			if err := os.WriteFile(f, nil, 0755); err != nil {
+				t.Fatalf("unable to create %q: %v", f, err)
+			}
+			if j%10 == 0 && want.SetFile(f) == nil {
+				capped = append(capped, f)
+			}
+		}
+	}
+	sort.Strings(capped)
+	return td, capped
+}
+
+func TestWalkFiles(t *testing.T) {
+	root, want := capTree(t, 5, 20)
+	var mu sync.Mutex
+	var got []string
+	err := WalkFiles(root, 3, func(path string, c *Set, err error) error {
+		if err != nil {
+			return err
+		}
+		if on, _ := c.GetFlag(Permitted, SETUID); !on {
+			return fmt.Errorf("bad capabilities %q for %q", c, path)
+		}
+		mu.Lock()
+		got = append(got, path)
+		mu.Unlock()
+		return nil
+	})
+	if err != nil {
+		t.Fatalf("walk failed: %v", err)
+	}
+	sort.Strings(got)
+	if fmt.Sprint(got) != fmt.Sprint(want) {
+		t.Errorf("walk found %q, want %q", got, want)
+	}
+
+	if len(want) != 0 {
+		stop := errors.New("stop")
+		if err := WalkFiles(root, 2, func(string, *Set, error) error { return stop }); err != stop {
+			t.Errorf("walk was not stopped: %v", err)
+		}
+		c := NewSet()
+		if err := c.LoadFile(want[0]); err != nil || c.String() != "cap_setuid=p" {
+			t.Errorf("LoadFile(%q) got %q: %v", want[0], c, err)
+		}
+	}
+	c := NewSet()
+	if err := c.LoadFile(root); err != syscall.ENODATA {
+		t.Errorf("LoadFile(%q) found capabilities: %v", root, err)
+	}
+}
+
+// BenchmarkGetFile and BenchmarkLoadFile compare the per file cost of
+// allocating a Set for each file with that of reusing one.
+func BenchmarkGetFile(b *testing.B) {
+	_, capped := capTree(b, 1, 1)
+	if len(capped) == 0 {
+		b.Skip("no privilege for setting file capabilities")
+	}
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		if _, err := GetFile(capped[0]); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkLoadFile(b *testing.B) {
+	_, capped := capTree(b, 1, 1)
+	if len(capped) == 0 {
+		b.Skip("no privilege for setting file capabilities")
+	}
+	c := NewSet()
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		if err := c.LoadFile(capped[0]); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+// BenchmarkWalkFiles reports the cost of a walk per file examined.
+func BenchmarkWalkFiles(b *testing.B) {
+	const dirs, files = 10, 100
+	root, _ := capTree(b, dirs, files)
+	var before, after runtime.MemStats
+	runtime.ReadMemStats(&before)
+	b.ResetTimer()
+	start := time.Now()
+	for i := 0; i < b.N; i++ {
+		if err := WalkFiles(root, 4, func(string, *Set, error) error { return nil }); err != nil {
+			b.Fatal(err)
+		}
+	}
+	elapsed := time.Since(start)
+	b.StopTimer()
+	runtime.ReadMemStats(&after)
+	n := float64(b.N * dirs * files)
+	b.ReportMetric(float64(elapsed.Nanoseconds())/n, "ns/file")
+	b.ReportMetric(float64(after.Mallocs-before.Mallocs)/n, "allocs/file")
+}
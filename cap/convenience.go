@@ -59,8 +59,8 @@ func (sc *syscaller) setSecbits(s Secbits) error {
 // will raise cap.SETPCAP in order to achieve this operation, and will
 // completely lower the Effective Flag of the process upon returning.
 func (s Secbits) Set() error {
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	return sc.setSecbits(s)
 }
 
@@ -191,8 +191,8 @@ func (sc *syscaller) setMode(m Mode) error {
 // permission or because (some of) the Secbits are already locked for
 // the current process.
 func (m Mode) Set() error {
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	return sc.setMode(m)
 }
 
@@ -259,8 +259,8 @@ func (sc *syscaller) setUID(uid int) error {
 // perform any change of UID if cap.SETUID is available, and this
 // operation will not alter the Permitted Flag of the process' Set.
 func SetUID(uid int) error {
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	return sc.setUID(uid)
 }
 
@@ -315,8 +315,8 @@ func (sc *syscaller) setGroups(gid int, suppl []int) error {
 // completely lower the Effective Flag of the process Set before
 // returning.
 func SetGroups(gid int, suppl ...int) error {
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	return sc.setGroups(gid, suppl)
 }
 
@@ -333,8 +333,8 @@ func Prctlw(prVal uintptr, args ...uintptr) (int, error) {
 	if n := len(args); n > 5 {
 		return -1, fmt.Errorf("prctl supports up to 5 arguments (not %d)", n)
 	}
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	as := make([]uintptr, 5)
 	copy(as, args)
 	return sc.prctlwcall6(prVal, as[0], as[1], as[2], as[3], as[4])
@@ -7,6 +7,8 @@ import (
 	"fmt"
 	"io"
 	"os"
+	"strings"
+	"sync"
 	"syscall"
 	"unsafe"
 )
@@ -76,95 +78,135 @@ var ErrBadPath = errors.New("file is not a regular executable")
 // ErrOutOfRange indicates an erroneous value for MinExtFlagSize.
 var ErrOutOfRange = errors.New("flag length invalid for export")
 
-// digestFileCap unpacks a file capability and returns it in a *Set
-// form.
-func digestFileCap(d []byte, sz int, err error) (*Set, error) {
-	if err != nil {
-		return nil, err
+// Sizes of each revision of the VFS form of a file capability.
+const (
+	vfsCapSize1 = int(unsafe.Sizeof(vfsCaps1{}))
+	vfsCapSize2 = int(unsafe.Sizeof(vfsCaps2{}))
+	vfsCapSize3 = int(unsafe.Sizeof(vfsCaps3{}))
+)
+
+// fileScratch holds the memory used to read a file capability. These
+// are recycled via scratchPool, so loading a file capability into an
+// existing Set does not allocate.
+type fileScratch struct {
+	path []byte
+	data [vfsCapSize3]byte
+	args xattrArgs
+}
+
+var scratchPool = sync.Pool{
+	New: func() interface{} { return new(fileScratch) },
+}
+
+// cPath returns a pointer to a NUL terminated copy of path.
+func (s *fileScratch) cPath(path string) (*byte, error) {
+	if strings.IndexByte(path, 0) >= 0 {
+		return nil, syscall.EINVAL
 	}
-	var raw1 vfsCaps1
-	var raw2 vfsCaps2
-	var raw3 vfsCaps3
-	if sz < binary.Size(raw1) || sz > binary.Size(raw3) {
-		return nil, ErrBadSize
+	s.path = append(append(s.path[:0], path...), 0)
+	return &s.path[0], nil
+}
+
+// loadFileCap unpacks the first sz bytes of d, a file capability,
+// into c.
+func (c *Set) loadFileCap(d []byte, sz int, err error) error {
+	if err != nil {
+		return err
 	}
-	b := bytes.NewReader(d[:sz])
-	var magicEtc uint32
-	if err = binary.Read(b, binary.LittleEndian, &magicEtc); err != nil {
-		return nil, err
+	if sz < vfsCapSize1 || sz > vfsCapSize3 {
+		return ErrBadSize
 	}
-
-	c := NewSet()
-	b.Seek(0, io.SeekStart)
+	d = d[:sz]
+	magicEtc := binary.LittleEndian.Uint32(d)
+	n, need := 2, vfsCapSize2
 	switch magicEtc & vfsCapRevisionMask {
 	case vfsCapRevision1:
-		if err = binary.Read(b, binary.LittleEndian, &raw1); err != nil {
-			return nil, err
-		}
-		data := raw1.Data[0]
-		c.flat[0][Permitted] = data.Permitted
-		c.flat[0][Inheritable] = data.Inheritable
-		if raw1.MagicEtc&vfsCapFlagsMask == vfsCapFlagsEffective {
-			c.flat[0][Effective] = data.Inheritable | data.Permitted
-		}
+		n, need = 1, vfsCapSize1
 	case vfsCapRevision2:
-		if err = binary.Read(b, binary.LittleEndian, &raw2); err != nil {
-			return nil, err
-		}
-		for i, data := range raw2.Data {
-			c.flat[i][Permitted] = data.Permitted
-			c.flat[i][Inheritable] = data.Inheritable
-			if raw2.MagicEtc&vfsCapFlagsMask == vfsCapFlagsEffective {
-				c.flat[i][Effective] = data.Inheritable | data.Permitted
-			}
-		}
 	case vfsCapRevision3:
-		if err = binary.Read(b, binary.LittleEndian, &raw3); err != nil {
-			return nil, err
+		need = vfsCapSize3
+	default:
+		return ErrBadMagic
+	}
+	if sz < need {
+		return io.ErrUnexpectedEOF
+	}
+	if err := c.good(); err != nil {
+		return err
+	}
+
+	eff := magicEtc&vfsCapFlagsMask == vfsCapFlagsEffective
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	for i := range c.flat {
+		var per, inh uint32
+		if i < n {
+			per = binary.LittleEndian.Uint32(d[4+8*i:])
+			inh = binary.LittleEndian.Uint32(d[8+8*i:])
 		}
-		for i, data := range raw3.Data {
-			c.flat[i][Permitted] = data.Permitted
-			c.flat[i][Inheritable] = data.Inheritable
-			if raw3.MagicEtc&vfsCapFlagsMask == vfsCapFlagsEffective {
-				c.flat[i][Effective] = data.Inheritable | data.Permitted
-			}
+		c.flat[i][Permitted] = per
+		c.flat[i][Inheritable] = inh
+		c.flat[i][Effective] = 0
+		if eff {
+			c.flat[i][Effective] = per | inh
 		}
-		c.nsRoot = int(raw3.RootID)
-	default:
-		return nil, ErrBadMagic
 	}
-	return c, nil
+	c.nsRoot = 0
+	if need == vfsCapSize3 {
+		c.nsRoot = int(binary.LittleEndian.Uint32(d[20:]))
+	}
+	return nil
 }
 
-//go:uintptrescapes
-
-// GetFd returns the file capabilities of an open (*os.File).Fd().
-func GetFd(file *os.File) (*Set, error) {
-	var raw3 vfsCaps3
-	d := make([]byte, binary.Size(raw3))
-	sz, _, oErr := multisc.r6(syscall.SYS_FGETXATTR, fd(file), uintptr(unsafe.Pointer(xattrNameCaps)), uintptr(unsafe.Pointer(&d[0])), uintptr(len(d)), 0, 0)
+// LoadFd replaces the content of c with the file capabilities of an
+// open (*os.File).Fd(). Unlike GetFd(), it does not allocate a new
+// Set, which makes it better suited to examining many files. On
+// failure, c is unchanged.
+func (c *Set) LoadFd(file *os.File) error {
+	s := scratchPool.Get().(*fileScratch)
+	defer scratchPool.Put(s)
+	sz, _, oErr := multisc.r6(syscall.SYS_FGETXATTR, fd(file), uintptr(unsafe.Pointer(xattrNameCaps)), uintptr(unsafe.Pointer(&s.data[0])), uintptr(len(s.data)), 0, 0)
 	var err error
 	if oErr != 0 {
 		err = oErr
 	}
-	return digestFileCap(d, int(sz), err)
+	return c.loadFileCap(s.data[:], int(sz), err)
 }
 
-//go:uintptrescapes
-
-// GetFile returns the file capabilities of a named file.
-func GetFile(path string) (*Set, error) {
-	p, err := syscall.BytePtrFromString(path)
+// LoadFile replaces the content of c with the file capabilities of a
+// named file. Unlike GetFile(), it does not allocate a new Set, which
+// makes it better suited to examining many files. On failure, c is
+// unchanged.
+func (c *Set) LoadFile(path string) error {
+	s := scratchPool.Get().(*fileScratch)
+	defer scratchPool.Put(s)
+	p, err := s.cPath(path)
 	if err != nil {
-		return nil, err
+		return err
 	}
-	var raw3 vfsCaps3
-	d := make([]byte, binary.Size(raw3))
-	sz, _, oErr := multisc.r6(syscall.SYS_GETXATTR, uintptr(unsafe.Pointer(p)), uintptr(unsafe.Pointer(xattrNameCaps)), uintptr(unsafe.Pointer(&d[0])), uintptr(len(d)), 0, 0)
+	sz, _, oErr := multisc.r6(syscall.SYS_GETXATTR, uintptr(unsafe.Pointer(p)), uintptr(unsafe.Pointer(xattrNameCaps)), uintptr(unsafe.Pointer(&s.data[0])), uintptr(len(s.data)), 0, 0)
 	if oErr != 0 {
 		err = oErr
 	}
-	return digestFileCap(d, int(sz), err)
+	return c.loadFileCap(s.data[:], int(sz), err)
+}
+
+// GetFd returns the file capabilities of an open (*os.File).Fd().
+func GetFd(file *os.File) (*Set, error) {
+	c := NewSet()
+	if err := c.LoadFd(file); err != nil {
+		return nil, err
+	}
+	return c, nil
+}
+
+// GetFile returns the file capabilities of a named file.
+func GetFile(path string) (*Set, error) {
+	c := NewSet()
+	if err := c.LoadFile(path); err != nil {
+		return nil, err
+	}
+	return c, nil
 }
 
 // GetNSOwner returns the namespace owner UID of the capability Set.
@@ -286,8 +286,8 @@ func (iab *IAB) SetProc() error {
 	if err := iab.good(); err != nil {
 		return err
 	}
-	state, sc := scwStateSC()
-	defer scwSetState(launchBlocked, state, -1)
+	sc := scwStateSC()
+	defer scwDone(sc)
 	iab.mu.RLock()
 	defer iab.mu.RUnlock()
 	return sc.iabSetProc(iab)
@@ -5,7 +5,9 @@ import (
 	"os"
 	"runtime"
 	"sync"
+	"sync/atomic"
 	"syscall"
+	"time"
 	"unsafe"
 )
 
@@ -97,8 +99,10 @@ func FuncLauncher(fn func(interface{}) error) *Launcher {
 // functions that change privilege state, these calls will only affect
 // the launch goroutine itself. While the launch is in progress, other
 // (non-launch) goroutines will block if they attempt to change
-// privilege state. These routines will unblock once there are no
-// in-flight launches.
+// privilege state. These routines will unblock once the launches in
+// flight at the time of their call have completed. Launches started
+// while such a change is pending wait for it to complete. See
+// cap.GetLaunchStats for a measure of this contention.
 //
 // Note, the first argument provided to the callback function is the
 // *syscall.ProcAttr value to be used when a process launch is taking
@@ -189,6 +193,15 @@ type lResult struct {
 	// as the launch completes.
 	tid int
 
+	// pidfd is a pidfd for the tid thread, which becomes readable
+	// when that thread exits, or -1 if the kernel cannot provide
+	// one.
+	pidfd int
+
+	// nested is true if the launch was made from the callback of
+	// another launch.
+	nested bool
+
 	// pid is the pid of the launched program (path, args). In
 	// the case of a FuncLaunch() this value is zero on success.
 	// pid holds -1 in the case of error.
@@ -230,8 +243,57 @@ var lName = []byte("cap-launcher\000")
 // <uapi/linux/prctl.h>
 const prSetName = 15
 
+// <uapi/linux/pidfd.h>
+const pidfdThread = syscall.O_EXCL
+
+// <asm-generic/poll.h>
+const pollIn = 0x1
+
+// pollFd is the struct pollfd of ppoll(2).
+type pollFd struct {
+	fd      int32
+	events  int16
+	revents int16
+}
+
+// noPidfdThread is set once the kernel is found to lack support for
+// thread pidfds (PIDFD_THREAD is Linux 6.9+).
+var noPidfdThread int32
+
+// pidfdOpenThread returns a pidfd for the tid thread of this process,
+// or -1.
+func pidfdOpenThread(tid int) int {
+	if sysPidfdOpen == 0 || atomic.LoadInt32(&noPidfdThread) != 0 {
+		return -1
+	}
+	fd, _, errno := syscall.RawSyscall(sysPidfdOpen, uintptr(tid), pidfdThread, 0)
+	if errno == syscall.EINVAL || errno == syscall.ENOSYS {
+		atomic.StoreInt32(&noPidfdThread, 1)
+	}
+	if errno != 0 {
+		return -1
+	}
+	return int(fd)
+}
+
+// procAttr prepares the default *syscall.ProcAttr for launching
+// attr.path. By default the following file descriptors are preserved
+// for the child. The user should modify them in the callback for
+// stdin/out/err redirection.
+func (attr *Launcher) procAttr() *syscall.ProcAttr {
+	pa := &syscall.ProcAttr{
+		Files: []uintptr{0, 1, 2},
+	}
+	if len(attr.env) != 0 {
+		pa.Env = attr.env
+	} else {
+		pa.Env = os.Environ()
+	}
+	return pa
+}
+
 //go:uintptrescapes
-func launch(result chan<- lResult, attr *Launcher, data interface{}, quit chan<- struct{}) {
+func launch(result chan<- lResult, attr *Launcher, data interface{}, quit chan<- struct{}, nested bool) {
 	if quit != nil {
 		defer close(quit)
 	}
@@ -255,7 +317,7 @@ func launch(result chan<- lResult, attr *Launcher, data interface{}, quit chan<-
 		// (Optimize for time to debug by reducing ugly spam
 		// like this.)
 		quit := make(chan struct{})
-		go launch(result, attr, data, quit)
+		go launch(result, attr, data, quit, nested)
 
 		// Wait for that go routine to complete.
 		<-quit
@@ -269,10 +331,14 @@ func launch(result chan<- lResult, attr *Launcher, data interface{}, quit chan<-
 	// security context.
 	defer close(result)
 
+	// Open this while the thread is certainly alive, so the
+	// caller can sleep until it has exited.
+	pidfd := pidfdOpenThread(tid)
+
 	// By never releasing the LockOSThread here, we guarantee that
 	// the runtime will terminate the current OS thread once this
 	// function returns.
-	scwSetState(launchIdle, launchActive, tid)
+	scwLaunchBegin(tid, nested)
 
 	// Name the launcher thread - transient, but helps to debug if
 	// the callbackFn or something else hangs up.
@@ -284,17 +350,7 @@ func launch(result chan<- lResult, attr *Launcher, data interface{}, quit chan<-
 
 	// Only prepare a non-nil pa value if a path is provided.
 	if attr.path != "" {
-		// By default the following file descriptors are preserved for
-		// the child. The user should modify them in the callback for
-		// stdin/out/err redirection.
-		pa = &syscall.ProcAttr{
-			Files: []uintptr{0, 1, 2},
-		}
-		if len(attr.env) != 0 {
-			pa.Env = attr.env
-		} else {
-			pa.Env = os.Environ()
-		}
+		pa = attr.procAttr()
 	}
 
 	var pid int
@@ -349,24 +405,79 @@ abort:
 		pid = -1
 	}
 	result <- lResult{
-		tgid: tgid,
-		tid:  tid,
-		pid:  pid,
-		err:  err,
+		tgid:   tgid,
+		tid:    tid,
+		pidfd:  pidfd,
+		nested: nested,
+		pid:    pid,
+		err:    err,
 	}
 }
 
-// pollForThreadExit waits for a thread to terminate. Only after the
+// waitForThreadExit waits for a thread to terminate. Only after the
 // thread has safely exited is it safe to resume POSIX semantics
-// security state mirroring for the rest of the process threads.
-func (v lResult) pollForThreadExit() {
+// security state mirroring for the rest of the process threads. The
+// wait sleeps in ppoll(2) on the thread's pidfd, which the runtime
+// treats as a blocking syscall. Without a pidfd, the thread is polled
+// for with an increasing delay.
+func (v lResult) waitForThreadExit() {
 	if v.tid == -1 {
 		return
 	}
-	for syscall.Tgkill(v.tgid, v.tid, 0) == nil {
-		runtime.Gosched()
+	if v.pidfd >= 0 {
+		fds := []pollFd{{fd: int32(v.pidfd), events: pollIn}}
+		for {
+			_, _, errno := syscall.Syscall6(syscall.SYS_PPOLL, uintptr(unsafe.Pointer(&fds[0])), 1, 0, 0, 0, 0)
+			if errno != syscall.EINTR {
+				break
+			}
+		}
+		syscall.Close(v.pidfd)
+	}
+	for delay := 10 * time.Microsecond; syscall.Tgkill(v.tgid, v.tid, 0) == nil; {
+		time.Sleep(delay)
+		if delay < time.Millisecond {
+			delay *= 2
+		}
+	}
+	scwLaunchEnd(v.tid, v.nested)
+}
+
+// LaunchStats summarizes the contention between launches and the
+// process-wide privilege changes of the rest of the program, such as
+// (*Set).SetProc() and SetUID(). Only launches that require a
+// disposable security state are counted.
+type LaunchStats struct {
+	// Launches counts the launches, and MaxConcurrent is the most
+	// that have been in flight at once.
+	Launches      uint64
+	MaxConcurrent int
+
+	// LaunchWaits counts the launches that waited for a privilege
+	// change to complete, and LaunchWaitTime is their total wait.
+	LaunchWaits    uint64
+	LaunchWaitTime time.Duration
+
+	// Writes counts the process-wide privilege changes,
+	// WriteWaits those that waited for in-flight launches to
+	// complete, and WriteWaitTime is their total wait.
+	Writes        uint64
+	WriteWaits    uint64
+	WriteWaitTime time.Duration
+}
+
+// GetLaunchStats returns the launch contention statistics accumulated
+// since the program started.
+func GetLaunchStats() LaunchStats {
+	return LaunchStats{
+		Launches:       atomic.LoadUint64(&scwStats.launches),
+		MaxConcurrent:  int(atomic.LoadUint64(&scwStats.maxLaunches)),
+		LaunchWaits:    atomic.LoadUint64(&scwStats.launchWaits),
+		LaunchWaitTime: time.Duration(atomic.LoadUint64(&scwStats.launchWaitNS)),
+		Writes:         atomic.LoadUint64(&scwStats.writes),
+		WriteWaits:     atomic.LoadUint64(&scwStats.writeWaits),
+		WriteWaitTime:  time.Duration(atomic.LoadUint64(&scwStats.writeWaitNS)),
 	}
-	scwSetState(launchActive, launchIdle, v.tid)
 }
 
 // Launch performs a callback function and/or new program launch with
@@ -398,6 +509,11 @@ func (v lResult) pollForThreadExit() {
 // they should do it via the launch callback function mechanism. (The
 // Go runtime is complicated and this is why this Launch mechanism
 // provides the optional callback function.)
+//
+// A Launcher with no callback function, and no UID, groups, Mode, IAB
+// or chroot change, has no need of a disposable security state. It
+// simply forks the program from the calling goroutine's OS thread,
+// unless called from the callback of another launch.
 func (attr *Launcher) Launch(data interface{}) (int, error) {
 	if !LaunchSupported {
 		return -1, ErrNoLaunch
@@ -410,14 +526,26 @@ func (attr *Launcher) Launch(data interface{}) (int, error) {
 	if attr.callbackFn == nil && (attr.path == "" || len(attr.args) == 0) {
 		return -1, ErrLaunchFailed
 	}
+	// A launch from within the callback of another cannot fork
+	// from the caller's thread, since that has deviated from the
+	// process state, and it shares the outer launch's claim on
+	// that state.
+	nested := scwLauncher()
+	if !nested && attr.callbackFn == nil && !attr.changeUIDs && !attr.changeGIDs && !attr.changeMode && attr.iab == nil && attr.chroot == "" {
+		pid, err := syscall.ForkExec(attr.path, attr.args, attr.procAttr())
+		if err != nil {
+			return -1, err
+		}
+		return pid, nil
+	}
 
 	result := make(chan lResult)
-	go launch(result, attr, data, nil)
+	go launch(result, attr, data, nil, nested)
 	v, ok := <-result
 	if !ok {
 		return -1, ErrLaunchFailed
 	}
 	<-result // blocks until the launch() goroutine exits
-	v.pollForThreadExit()
+	v.waitForThreadExit()
 	return v.pid, v.err
 }
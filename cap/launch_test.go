@@ -0,0 +1,234 @@
+package cap
+
+import (
+	"fmt"
+	"os"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"testing"
+	"time"
+)
+
+// cpuTime returns the CPU time consumed by this process, excluding
+// that of its reaped children.
+func cpuTime() time.Duration {
+	var ru syscall.Rusage
+	syscall.Getrusage(syscall.RUSAGE_SELF, &ru)
+	return time.Duration(ru.Utime.Nano() + ru.Stime.Nano())
+}
+
+// TestConcurrentLaunch runs launches whose callbacks change their own
+// privilege state alongside process-wide changes, and confirms each
+// kind sees only its own.
+func TestConcurrentLaunch(t *testing.T) {
+	if !LaunchSupported {
+		t.Skip("launching not supported")
+	}
+	before := GetLaunchStats()
+	want, err := Prctl(prGetKeepCaps)
+	if err != nil {
+		t.Fatalf("failed to get PR_KEEP_CAPS: %v", err)
+	}
+	attr := FuncLauncher(func(interface{}) error {
+		for i := 0; i < 10; i++ {
+			if _, err := Prctlw(prSetKeepCaps, uintptr(i&1)); err != nil {
+				return err
+			}
+			if v, err := Prctl(prGetKeepCaps); err != nil {
+				return err
+			} else if v != i&1 {
+				return fmt.Errorf("launch PR_KEEP_CAPS: got=%d want=%d", v, i&1)
+			}
+		}
+		return nil
+	})
+	const launchers, launches = 8, 20
+	var wg sync.WaitGroup
+	for i := 0; i < launchers; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for j := 0; j < launches; j++ {
+				if _, err := attr.Launch(nil); err != nil {
+					t.Errorf("launch failed: %v", err)
+					return
+				}
+			}
+		}()
+	}
+	c := GetProc()
+	for i := 0; i < 50; i++ {
+		if err := c.SetProc(); err != nil {
+			t.Fatalf("SetProc failed: %v", err)
+		}
+		if v, err := Prctl(prGetKeepCaps); err != nil {
+			t.Fatalf("failed to get PR_KEEP_CAPS: %v", err)
+		} else if v != want {
+			t.Fatalf("launch leaked PR_KEEP_CAPS: got=%d want=%d", v, want)
+		}
+	}
+	wg.Wait()
+	after := GetLaunchStats()
+	if n := after.Launches - before.Launches; n != launchers*launches {
+		t.Errorf("launch count: got=%d want=%d", n, launchers*launches)
+	}
+	if after.Writes-before.Writes < 50 {
+		t.Errorf("write count: got=%d want>=50", after.Writes-before.Writes)
+	}
+	if after.MaxConcurrent < 1 || after.MaxConcurrent > launchers {
+		t.Errorf("implausible peak concurrency: %d", after.MaxConcurrent)
+	}
+}
+
+// TestNestedLaunch launches from within a launch callback while a
+// process-wide write is waiting for the outer launch to complete.
+func TestNestedLaunch(t *testing.T) {
+	if !LaunchSupported {
+		t.Skip("launching not supported")
+	}
+	wrote := make(chan error)
+	inner := FuncLauncher(func(interface{}) error { return nil })
+	outer := FuncLauncher(func(interface{}) error {
+		go func() {
+			wrote <- GetProc().SetProc()
+		}()
+		for atomic.LoadInt32(&scwWriters) == 0 {
+			time.Sleep(time.Millisecond)
+		}
+		_, err := inner.Launch(nil)
+		return err
+	})
+	done := make(chan error)
+	go func() {
+		_, err := outer.Launch(nil)
+		done <- err
+	}()
+	for i := 0; i < 2; i++ {
+		select {
+		case err := <-done:
+			if err != nil {
+				t.Fatalf("nested launch failed: %v", err)
+			}
+		case err := <-wrote:
+			if err != nil {
+				t.Fatalf("SetProc failed: %v", err)
+			}
+		case <-time.After(10 * time.Second):
+			t.Fatal("nested launch deadlocked")
+		}
+	}
+}
+
+// benchLaunch runs b.N launches of attr, reaping each child. The
+// launching process' own CPU time is reported, since waiting for a
+// launch should not consume any.
+func benchLaunch(b *testing.B, attr *Launcher) {
+	b.ReportAllocs()
+	start := cpuTime()
+	for i := 0; i < b.N; i++ {
+		pid, err := attr.Launch(nil)
+		if err != nil {
+			b.Fatalf("launch %d failed: %v", i, err)
+		}
+		if pid <= 0 {
+			continue
+		}
+		var ws syscall.WaitStatus
+		if _, err := syscall.Wait4(pid, &ws, 0, nil); err != nil {
+			b.Fatalf("wait for %d failed: %v", pid, err)
+		}
+		if !ws.Exited() || ws.ExitStatus() != 0 {
+			b.Fatalf("launched program failed: %v", ws)
+		}
+	}
+	b.ReportMetric(float64(cpuTime()-start)/float64(b.N), "cpu-ns/op")
+}
+
+// BenchmarkLaunch measures the cost of a launch. The "plain" launcher
+// makes no privilege change, "func" only runs a callback on a
+// disposable thread, and "callback" also execs a program from one.
+func BenchmarkLaunch(b *testing.B) {
+	if !LaunchSupported {
+		b.Skip("launching not supported")
+	}
+	path := "/bin/true"
+	if _, err := os.Stat(path); err != nil {
+		b.Skipf("no %s to launch", path)
+	}
+	b.Run("plain", func(b *testing.B) {
+		benchLaunch(b, NewLauncher(path, []string{"true"}, nil))
+	})
+	b.Run("func", func(b *testing.B) {
+		benchLaunch(b, FuncLauncher(func(interface{}) error { return nil }))
+	})
+	b.Run("callback", func(b *testing.B) {
+		attr := NewLauncher(path, []string{"true"}, nil)
+		attr.Callback(func(*syscall.ProcAttr, interface{}) error { return nil })
+		benchLaunch(b, attr)
+	})
+}
+
+// BenchmarkConcurrentLaunch runs FuncLauncher launches from N
+// goroutines at once, while another goroutine repeatedly rewrites
+// the process capabilities. It reports the mean latency of those
+// process-wide writes, the number completed per launch, and the
+// fraction of launches that waited for one.
+func BenchmarkConcurrentLaunch(b *testing.B) {
+	if !LaunchSupported {
+		b.Skip("launching not supported")
+	}
+	attr := FuncLauncher(func(interface{}) error { return nil })
+	for _, n := range []int{1, 4, 16} {
+		b.Run(fmt.Sprint("N=", n), func(b *testing.B) {
+			var writes int64
+			var wrote time.Duration
+			stop := make(chan struct{})
+			done := make(chan struct{})
+			go func() {
+				defer close(done)
+				c := GetProc()
+				for {
+					select {
+					case <-stop:
+						return
+					default:
+					}
+					start := time.Now()
+					if err := c.SetProc(); err != nil {
+						b.Errorf("SetProc failed: %v", err)
+						return
+					}
+					wrote += time.Since(start)
+					writes++
+				}
+			}()
+			var wg sync.WaitGroup
+			next := int64(0)
+			before := GetLaunchStats()
+			b.ResetTimer()
+			for i := 0; i < n; i++ {
+				wg.Add(1)
+				go func() {
+					defer wg.Done()
+					for atomic.AddInt64(&next, 1) <= int64(b.N) {
+						if _, err := attr.Launch(nil); err != nil {
+							b.Errorf("launch failed: %v", err)
+							return
+						}
+					}
+				}()
+			}
+			wg.Wait()
+			b.StopTimer()
+			close(stop)
+			<-done
+			if writes != 0 {
+				b.ReportMetric(float64(wrote.Nanoseconds())/float64(writes), "ns/write")
+			}
+			b.ReportMetric(float64(writes)/float64(b.N), "writes/op")
+			after := GetLaunchStats()
+			b.ReportMetric(float64(after.LaunchWaits-before.LaunchWaits)/float64(b.N), "waits/op")
+		})
+	}
+}
@@ -3,7 +3,9 @@ package cap
 import (
 	"runtime"
 	"sync"
+	"sync/atomic"
 	"syscall"
+	"time"
 
 	"kernel.org/pub/linux/libs/security/libcap/psx"
 )
@@ -28,94 +30,131 @@ var singlesc = &syscaller{
 	r6: syscall.RawSyscall6,
 }
 
-// launchState is used to track which variant of the write syscalls
-// should execute.
-type launchState int
-
-// these states are used to understand when a launch is in progress.
-const (
-	launchIdle launchState = iota
-	launchActive
-	launchBlocked
-)
-
-// scwMu is used to fully serialize the write system calls. Note, this
-// would generally not be necessary, but in the case of Launch we get
-// into a situation where the launching thread is temporarily allowed
-// to deviate from the kernel state of the rest of the runtime and
-// allowing other threads to perform w* syscalls will potentially
-// interfere with the launching process. In pure Go binaries, this
-// will lead inevitably to a panic when the AllThreadsSyscall
-// discovers inconsistent thread state.
+// scwMu orders the process-wide write system calls against
+// launches. This would generally not be necessary, but in the case
+// of Launch we get into a situation where the launching thread is
+// temporarily allowed to deviate from the kernel state of the rest of
+// the runtime and allowing other threads to perform w* syscalls will
+// potentially interfere with the launching process. In pure Go
+// binaries, this will lead inevitably to a panic when the
+// AllThreadsSyscall discovers inconsistent thread state.
 //
-// scwMu protects scwTIDs and scwState
-var scwMu sync.Mutex
+// Each launch holds a read lock from before its thread deviates until
+// that thread has exited, so any number of launches can be in
+// flight. Process-wide writes hold the write lock. Since a blocked
+// write lock excludes new read locks, a write waits only for the
+// launches already in flight, and not for launching to cease.
+var scwMu sync.RWMutex
+
+// scwTIDsMu protects scwTIDs.
+var scwTIDsMu sync.Mutex
 
 // scwTIDs holds the thread IDs of the threads that are executing a
 // launch it is empty when no launches are occurring.
 var scwTIDs = make(map[int]bool)
 
-// scwState captures whether a launch is in progress or not.
-var scwState = launchIdle
+// scwLaunches counts the entries of scwTIDs, and scwWriters the
+// writes holding, or waiting for, scwMu. They let the uncontended
+// paths avoid scwTIDsMu and the timing of lock waits.
+var scwLaunches, scwWriters int32
 
-// scwCond is used to announce when scwState changes to other
-// goroutines waiting for it to change.
-var scwCond = sync.NewCond(&scwMu)
+// scwStats holds the counters reported by GetLaunchStats. Its fields
+// are all 64-bit for the benefit of atomic access on 32-bit systems.
+var scwStats struct {
+	launches, maxLaunches, launchWaits, launchWaitNS uint64
+	writes, writeWaits, writeWaitNS                  uint64
+}
 
-// scwSetState blocks until a launch state change between states from
-// and to occurs. We use this for more context specific syscaller
-// use. In the case that the caller is requesting a launchActive ->
-// launchIdle transition they are declaring that tid is no longer
-// launching. If another thread is also launching the call will
-// complete, but the launchState will remain launchActive.
-func scwSetState(from, to launchState, tid int) {
-	scwMu.Lock()
-	for scwState != from {
-		if scwState == launchActive && from == launchIdle && to == launchActive {
-			break // This "transition" is also allowed.
+// scwLaunchBegin marks tid as launching, first waiting for any
+// process-wide write in progress or pending to complete. A nested
+// launch, made from the callback of another, is covered by the read
+// lock of the outer launch, which cannot end before it. It must not
+// take another, since a read lock blocks while a write is pending.
+func scwLaunchBegin(tid int, nested bool) {
+	if !nested {
+		if atomic.LoadInt32(&scwWriters) != 0 {
+			start := time.Now()
+			scwMu.RLock()
+			atomic.AddUint64(&scwStats.launchWaits, 1)
+			atomic.AddUint64(&scwStats.launchWaitNS, uint64(time.Since(start)))
+		} else {
+			scwMu.RLock()
 		}
-		scwCond.Wait()
 	}
-	if from == launchIdle && to == launchActive {
-		scwTIDs[tid] = true
-	} else if from == launchActive && to == launchIdle {
-		delete(scwTIDs, tid)
-		if len(scwTIDs) != 0 {
-			to = from // not actually idle
+	scwTIDsMu.Lock()
+	scwTIDs[tid] = true
+	n := uint64(atomic.AddInt32(&scwLaunches, 1))
+	scwTIDsMu.Unlock()
+	atomic.AddUint64(&scwStats.launches, 1)
+	for {
+		max := atomic.LoadUint64(&scwStats.maxLaunches)
+		if n <= max || atomic.CompareAndSwapUint64(&scwStats.maxLaunches, max, n) {
+			break
 		}
 	}
-	scwState = to
-	scwCond.Broadcast()
-	scwMu.Unlock()
+}
+
+// scwLaunchEnd declares that the tid thread, having exited, is no
+// longer launching.
+func scwLaunchEnd(tid int, nested bool) {
+	scwTIDsMu.Lock()
+	delete(scwTIDs, tid)
+	atomic.AddInt32(&scwLaunches, -1)
+	scwTIDsMu.Unlock()
+	if !nested {
+		scwMu.RUnlock()
+	}
+}
+
+// scwLauncher returns true if the current goroutine is executing a
+// launch. If so, it remains locked to its (doomed) OS thread.
+func scwLauncher() bool {
+	if atomic.LoadInt32(&scwLaunches) == 0 {
+		// A launching goroutine has always registered itself.
+		return false
+	}
+	runtime.LockOSThread()
+	scwTIDsMu.Lock()
+	launching := scwTIDs[syscall.Gettid()]
+	scwTIDsMu.Unlock()
+	if launching {
+		// note, we don't runtime.UnlockOSThread() here
+		// because we have no reason to ever allow this thread
+		// to return to normal use - we need it dead before the
+		// launch can end.
+		return true
+	}
+	runtime.UnlockOSThread()
+	return false
 }
 
 // scwStateSC blocks until the current syscaller is available for
-// writes, and then marks launchBlocked. Use scwSetState to perform
-// the reverse transition (blocked->returned state value).
-func scwStateSC() (launchState, *syscaller) {
-	sc := multisc
-	scwMu.Lock()
-	for {
-		if scwState == launchIdle {
-			break
-		}
-		runtime.LockOSThread()
-		if scwState == launchActive && scwTIDs[syscall.Gettid()] {
-			sc = singlesc
-			// note, we don't runtime.UnlockOSThread()
-			// here because we have no reason to ever
-			// allow this thread to return to normal use -
-			// we need it dead before we can return to the
-			// launchIdle state.
-			break
-		}
-		runtime.UnlockOSThread()
-		scwCond.Wait()
+// writes, and returns it. On a launching thread, that is singlesc,
+// which affects only that thread and needs no waiting. Otherwise, it
+// is multisc once no launch is in flight. Every call must be paired
+// with a call to scwDone.
+func scwStateSC() *syscaller {
+	if scwLauncher() {
+		return singlesc
+	}
+	atomic.AddInt32(&scwWriters, 1)
+	if atomic.LoadInt32(&scwLaunches) != 0 {
+		start := time.Now()
+		scwMu.Lock()
+		atomic.AddUint64(&scwStats.writeWaits, 1)
+		atomic.AddUint64(&scwStats.writeWaitNS, uint64(time.Since(start)))
+	} else {
+		scwMu.Lock()
 	}
-	old := scwState
-	scwState = launchBlocked
-	scwCond.Broadcast()
-	scwMu.Unlock()
+	atomic.AddUint64(&scwStats.writes, 1)
+	return multisc
+}
 
-	return old, sc
+// scwDone completes a write performed with the sc returned by
+// scwStateSC.
+func scwDone(sc *syscaller) {
+	if sc == multisc {
+		scwMu.Unlock()
+		atomic.AddInt32(&scwWriters, -1)
+	}
 }
@@ -0,0 +1,10 @@
+//go:build linux && !mips && !mipsle && !mips64 && !mips64le
+// +build linux,!mips,!mipsle,!mips64,!mips64le
+
+package cap
+
+// sysGetxattrat is the getxattrat(2) syscall number (Linux 6.13+).
+var sysGetxattrat = uintptr(464)
+
+// sysPidfdOpen is the pidfd_open(2) syscall number (Linux 5.3+).
+var sysPidfdOpen = uintptr(434)
@@ -0,0 +1,13 @@
+//go:build linux && (mips || mipsle || mips64 || mips64le)
+// +build linux
+// +build mips mipsle mips64 mips64le
+
+package cap
+
+// sysGetxattrat and sysPidfdOpen are zero because the MIPS ABIs
+// offset their syscall numbers. WalkFiles falls back to lgetxattr(2),
+// and Launch to polling for the exit of its launcher thread.
+var (
+	sysGetxattrat = uintptr(0)
+	sysPidfdOpen  = uintptr(0)
+)
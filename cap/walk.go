@@ -0,0 +1,259 @@
+package cap
+
+import (
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"unsafe"
+)
+
+// xattrArgs is the struct xattr_args of getxattrat(2).
+type xattrArgs struct {
+	value uint64
+	size  uint32
+	flags uint32
+}
+
+// uapi/linux/fcntl.h defined.
+const atSymlinkNoFollow = 0x100
+
+// noGetxattrat is set once the kernel is found to lack getxattrat(2).
+var noGetxattrat int32
+
+// Offsets of the fields of a struct linux_dirent64.
+var (
+	direntReclen = int(unsafe.Offsetof(syscall.Dirent{}.Reclen))
+	direntType   = int(unsafe.Offsetof(syscall.Dirent{}.Type))
+	direntName   = int(unsafe.Offsetof(syscall.Dirent{}.Name))
+)
+
+// walker holds the shared state of a WalkFiles scan. Directories to
+// be read are kept on a stack, and pending counts those queued or
+// being read.
+type walker struct {
+	mu      sync.Mutex
+	cond    sync.Cond
+	dirs    []string
+	pending int
+	stop    int32
+	err     error
+	fn      func(path string, c *Set, err error) error
+}
+
+// report calls the WalkFiles callback, and records the first error it
+// returns.
+func (w *walker) report(path string, c *Set, err error) {
+	if atomic.LoadInt32(&w.stop) != 0 {
+		return
+	}
+	if err = w.fn(path, c, err); err == nil {
+		return
+	}
+	w.mu.Lock()
+	if w.err == nil {
+		w.err = err
+		atomic.StoreInt32(&w.stop, 1)
+		w.cond.Broadcast()
+	}
+	w.mu.Unlock()
+}
+
+func (w *walker) push(dir string) {
+	w.mu.Lock()
+	w.dirs = append(w.dirs, dir)
+	w.pending++
+	w.cond.Signal()
+	w.mu.Unlock()
+}
+
+// next returns the next directory to read, or false once there are
+// none left.
+func (w *walker) next() (string, bool) {
+	w.mu.Lock()
+	defer w.mu.Unlock()
+	for len(w.dirs) == 0 && w.pending != 0 && w.err == nil {
+		w.cond.Wait()
+	}
+	if w.err != nil || len(w.dirs) == 0 {
+		return "", false
+	}
+	dir := w.dirs[len(w.dirs)-1]
+	w.dirs = w.dirs[:len(w.dirs)-1]
+	return dir, true
+}
+
+func (w *walker) done() {
+	w.mu.Lock()
+	if w.pending--; w.pending == 0 {
+		w.cond.Broadcast()
+	}
+	w.mu.Unlock()
+}
+
+// getxattrat reads the file capability of name, a NUL terminated
+// entry of the directory dirfd, into s.data. Without getxattrat(2) it
+// reads the capability of path instead. The blocking form of syscall
+// is used, since a walk is expected to wait on the disk.
+func (s *fileScratch) getxattrat(dirfd int, name *byte, path string) (int, error) {
+	if sysGetxattrat != 0 && atomic.LoadInt32(&noGetxattrat) == 0 {
+		s.args = xattrArgs{
+			value: uint64(uintptr(unsafe.Pointer(&s.data[0]))),
+			size:  uint32(len(s.data)),
+		}
+		sz, _, errno := syscall.Syscall6(sysGetxattrat, uintptr(dirfd), uintptr(unsafe.Pointer(name)), atSymlinkNoFollow, uintptr(unsafe.Pointer(xattrNameCaps)), uintptr(unsafe.Pointer(&s.args)), unsafe.Sizeof(s.args))
+		if errno == 0 {
+			return int(sz), nil
+		}
+		if errno != syscall.ENOSYS {
+			return 0, errno
+		}
+		atomic.StoreInt32(&noGetxattrat, 1)
+	}
+	p, err := s.cPath(path)
+	if err != nil {
+		return 0, err
+	}
+	sz, _, errno := syscall.Syscall6(syscall.SYS_LGETXATTR, uintptr(unsafe.Pointer(p)), uintptr(unsafe.Pointer(xattrNameCaps)), uintptr(unsafe.Pointer(&s.data[0])), uintptr(len(s.data)), 0, 0)
+	if errno != 0 {
+		return 0, errno
+	}
+	return int(sz), nil
+}
+
+// readDir examines the entries of dir, queuing its subdirectories.
+// The caller provides a buffer for the directory entries, a scratch
+// area for the file capabilities, and a Set to decode them into.
+func (w *walker) readDir(dir string, buf []byte, s *fileScratch, c *Set) {
+	dirfd, err := syscall.Open(dir, syscall.O_RDONLY|syscall.O_DIRECTORY|syscall.O_NOFOLLOW|syscall.O_CLOEXEC, 0)
+	if err != nil {
+		w.report(dir, nil, err)
+		return
+	}
+	defer syscall.Close(dirfd)
+	sep := "/"
+	if dir != "" && dir[len(dir)-1] == '/' {
+		sep = ""
+	}
+
+	for atomic.LoadInt32(&w.stop) == 0 {
+		n, err := syscall.ReadDirent(dirfd, buf)
+		if err != nil {
+			w.report(dir, nil, err)
+			return
+		}
+		if n <= 0 {
+			return
+		}
+		for off := 0; off < n; {
+			reclen := int(*(*uint16)(unsafe.Pointer(&buf[off+direntReclen])))
+			typ := buf[off+direntType]
+			name := buf[off+direntName : off+reclen]
+			off += reclen
+			for i, b := range name {
+				if b == 0 {
+					name = name[:i+1]
+					break
+				}
+			}
+			if len(name) <= 1 || (name[0] == '.' && (len(name) == 2 || (name[1] == '.' && len(name) == 3))) {
+				continue
+			}
+			if typ == syscall.DT_UNKNOWN {
+				var st syscall.Stat_t
+				if err := syscall.Lstat(dir+sep+string(name[:len(name)-1]), &st); err != nil {
+					continue
+				}
+				switch st.Mode & syscall.S_IFMT {
+				case syscall.S_IFDIR:
+					typ = syscall.DT_DIR
+				case syscall.S_IFREG:
+					typ = syscall.DT_REG
+				}
+			}
+			switch typ {
+			case syscall.DT_DIR:
+				w.push(dir + sep + string(name[:len(name)-1]))
+			case syscall.DT_REG:
+				var path string
+				if sysGetxattrat == 0 || atomic.LoadInt32(&noGetxattrat) != 0 {
+					path = dir + sep + string(name[:len(name)-1])
+				}
+				sz, err := s.getxattrat(dirfd, &name[0], path)
+				if err == syscall.ENODATA || err == syscall.ENOTSUP {
+					continue
+				}
+				if path == "" {
+					path = dir + sep + string(name[:len(name)-1])
+				}
+				if err = c.loadFileCap(s.data[:], sz, err); err != nil {
+					w.report(path, nil, err)
+				} else {
+					w.report(path, c, nil)
+				}
+			}
+		}
+	}
+}
+
+// WalkFiles scans the directory tree below root for regular files
+// with file capabilities, reading the directories with the given
+// number of concurrent goroutines (workers < 1 means 1). Symbolic
+// links are not followed. The function fn is called, possibly
+// concurrently, with the path and capabilities of each file found. To
+// avoid allocating a Set per file, each goroutine reuses the one it
+// passes to fn, so fn should Dup() any it wishes to keep. If a file
+// or directory cannot be examined, fn is called with a nil Set and
+// the error. Should fn return an error, the walk stops early and
+// WalkFiles returns that error.
+//
+// Where the kernel supports getxattrat(2), each file is examined
+// relative to its open directory without constructing its path, so a
+// walk performs no per-file allocation for files without
+// capabilities.
+func WalkFiles(root string, workers int, fn func(path string, c *Set, err error) error) error {
+	var st syscall.Stat_t
+	if err := syscall.Lstat(root, &st); err != nil {
+		return fn(root, nil, err)
+	}
+	switch st.Mode & syscall.S_IFMT {
+	case syscall.S_IFREG:
+		c := NewSet()
+		err := c.LoadFile(root)
+		if err == syscall.ENODATA || err == syscall.ENOTSUP {
+			return nil
+		} else if err != nil {
+			return fn(root, nil, err)
+		}
+		return fn(root, c, nil)
+	case syscall.S_IFDIR:
+	default:
+		return nil
+	}
+
+	if workers < 1 {
+		workers = 1
+	}
+	w := &walker{fn: fn}
+	w.cond.L = &w.mu
+	w.push(root)
+	var wg sync.WaitGroup
+	for i := 0; i < workers; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			buf := make([]byte, 32<<10)
+			s := new(fileScratch)
+			c := NewSet()
+			for {
+				dir, ok := w.next()
+				if !ok {
+					return
+				}
+				w.readDir(dir, buf, s, c)
+				w.done()
+			}
+		}()
+	}
+	wg.Wait()
+	return w.err
+}
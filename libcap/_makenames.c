@@ -35,9 +35,19 @@ static void *recalloc(void *p, int was, int is) {
     return n;
 }
 
+/*
+ * byname orders capability indices by the names they map to.
+ */
+static const char **sort_names;
+
+static int byname(const void *a, const void *b)
+{
+    return strcmp(sort_names[*(const int *)a], sort_names[*(const int *)b]);
+}
+
 int main(void)
 {
-    int i, maxcaps=0, maxlength=0;
+    int i, maxcaps=0, maxlength=0, named=0;
     const char **pointers = NULL;
     int pointers_avail = 0;
 
@@ -55,6 +65,7 @@ int main(void)
 	    }
         }
 	pointers[list[i].index] = list[i].name;
+	named++;
 	int n = strlen(list[i].name);
 	if (n > maxlength) {
 	    maxlength = n;
@@ -80,11 +91,38 @@ int main(void)
 	}
     }
 
+    printf("  }\n");
+
+    /*
+     * The named capabilities in name order, so names can be looked
+     * up with a binary search.
+     */
+    int *sorted = calloc(named, sizeof(int));
+    if (sorted == NULL) {
+	perror("unable to continue");
+	exit(1);
+    }
+    int j;
+    for (i = 0, j = 0; i < maxcaps; ++i) {
+	if (pointers[i]) {
+	    sorted[j++] = i;
+	}
+    }
+    sort_names = pointers;
+    qsort(sorted, named, sizeof(int), byname);
+
+    printf("\n"
+	   "#define __CAP_NAMED      %d\n"
+	   "#define LIBCAP_CAP_SORTED { \\\n", named);
+    for (i = 0; i < named; ++i) {
+	printf("      %d,\t/* %s */ \\\n", sorted[i], pointers[sorted[i]]);
+    }
     printf("  }\n"
 	   "#endif /* LIBCAP_PLEASE_INCLUDE_ARRAY */\n"
 	   "\n"
 	   "/* END OF FILE */\n");
 
+    free(sorted);
     free(pointers);
     exit(0);
 }
@@ -18,6 +18,9 @@ static __u8 __libcap_mutex;
  * These get set via the pre-main() executed constructor function below it.
  */
 static cap_value_t _cap_max_bits;
+static __u32 _cap_version;
+
+static __u32 _cap_kernel_version(void);
 
 __attribute__((visibility ("hidden")))
 __attribute__((constructor (300))) void _libcap_initialize(void)
@@ -26,6 +29,7 @@ __attribute__((constructor (300))) void _libcap_initialize(void)
     _cap_mu_lock(&__libcap_mutex);
     if (!_cap_max_bits) {
 	cap_set_syscall(NULL, NULL);
+	_cap_version = _cap_kernel_version();
 	_binary_search(_cap_max_bits, cap_get_bound, 0, __CAP_MAXBITS,
 		       __CAP_BITS);
     }
@@ -48,6 +52,9 @@ struct _cap_alloc_s {
 	struct _cap_struct set;
 	struct cap_iab_s iab;
 	struct cap_launch_s launcher;
+	struct cap_pool_s pool;
+	struct cap_zygote_s zygote;
+	struct _cap_alloc_s *next_idle; /* only while held by a pool */
     } u;
 };
 #define CAP_ALLOC_OFF_U offsetof(struct _cap_alloc_s, u)
@@ -56,27 +63,20 @@ libcap_static_assert(CAP_ALLOC_OFF_U == _CAP_ALLOC_OFF_TO_MAGIC,
   Member_u_has_an_unexpected_offset_in_cap_alloc_s);
 
 /*
- * Obtain a blank set of capabilities
+ * _cap_kernel_version probes the kernel for the capability version
+ * it supports. It returns 0 if the version is not one libcap knows.
+ * This is only called once, by _libcap_initialize(), and the result
+ * is cached in _cap_version.
  */
-cap_t cap_init(void)
+static __u32 _cap_kernel_version(void)
 {
-    struct _cap_alloc_s *raw_data;
-    cap_t result;
+    struct __user_cap_header_struct head;
 
-    raw_data = calloc(1, sizeof(struct _cap_alloc_s));
-    if (raw_data == NULL) {
-	_cap_debug("out of memory");
-	errno = ENOMEM;
-	return NULL;
-    }
-    raw_data->magic = CAP_T_MAGIC;
-    raw_data->size = sizeof(struct _cap_alloc_s);
+    head.version = _LIBCAP_CAPABILITY_VERSION;
+    head.pid = 0;
+    capget(&head, NULL);      /* load the kernel-capability version */
 
-    result = &raw_data->u.set;
-    result->head.version = _LIBCAP_CAPABILITY_VERSION;
-    capget(&result->head, NULL);      /* load the kernel-capability version */
-
-    switch (result->head.version) {
+    switch (head.version) {
 #ifdef _LINUX_CAPABILITY_VERSION_1
     case _LINUX_CAPABILITY_VERSION_1:
 	break;
@@ -90,12 +90,56 @@ cap_t cap_init(void)
 	break;
 #endif
     default:                          /* No idea what to do */
-	cap_free(result);
-	result = NULL;
-	break;
+	return 0;
     }
+    return head.version;
+}
 
-    return result;
+/*
+ * _cap_setup_set initializes a zeroed allocation as a blank set of
+ * capabilities for the given kernel capability version.
+ */
+static cap_t _cap_setup_set(struct _cap_alloc_s *raw_data, __u32 version)
+{
+    raw_data->magic = CAP_T_MAGIC;
+    raw_data->size = sizeof(struct _cap_alloc_s);
+    raw_data->u.set.head.version = version;
+    return &raw_data->u.set;
+}
+
+/*
+ * _cap_cached_version returns the cached kernel capability version,
+ * initializing the library if that has not happened yet (for
+ * example, when called from another constructor).
+ */
+static __u32 _cap_cached_version(void)
+{
+    if (!_cap_max_bits) {
+	_libcap_initialize();
+    }
+    return _cap_version;
+}
+
+/*
+ * Obtain a blank set of capabilities
+ */
+cap_t cap_init(void)
+{
+    struct _cap_alloc_s *raw_data;
+    __u32 version = _cap_cached_version();
+
+    if (version == 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+
+    raw_data = calloc(1, sizeof(struct _cap_alloc_s));
+    if (raw_data == NULL) {
+	_cap_debug("out of memory");
+	errno = ENOMEM;
+	return NULL;
+    }
+    return _cap_setup_set(raw_data, version);
 }
 
 /*
@@ -255,6 +299,171 @@ cap_launch_t cap_func_launcher(int (callback_fn)(void *detail))
     return attr;
 }
 
+/*
+ * cap_new_zygote allocates a zygote and starts its helper process,
+ * which forks pool children that each assume the security context
+ * described by attr. Since the helper is a fork()ed copy of the
+ * caller, this is best done early, while the caller is small. The
+ * zygote is shut down, and its idle children reaped, by cap_free().
+ */
+cap_zygote_t cap_new_zygote(cap_launch_t attr, int pool)
+{
+    if (!good_cap_launch_t(attr) || pool < 1) {
+	errno = EINVAL;
+	return NULL;
+    }
+    struct _cap_alloc_s *data = calloc(1, sizeof(struct _cap_alloc_s));
+    if (data == NULL) {
+	_cap_debug("out of memory");
+	return NULL;
+    }
+    data->magic = CAP_ZYGOTE_MAGIC;
+    data->size = sizeof(struct _cap_alloc_s);
+
+    struct cap_zygote_s *z = &data->u.zygote;
+    if (_cap_zygote_start(z, attr, pool)) {
+	int olderrno = errno;
+	free(data);
+	errno = olderrno;
+	return NULL;
+    }
+    return z;
+}
+
+/*
+ * cap_new_pool allocates an empty pool for recycling the memory of
+ * cap_t and cap_iab_t objects. The pool is released with cap_free().
+ */
+cap_pool_t cap_new_pool(void)
+{
+    __u32 version = _cap_cached_version();
+    if (version == 0) {
+	errno = EINVAL;
+	return NULL;
+    }
+
+    struct _cap_alloc_s *data = calloc(1, sizeof(struct _cap_alloc_s));
+    if (data == NULL) {
+	_cap_debug("out of memory");
+	errno = ENOMEM;
+	return NULL;
+    }
+    data->magic = CAP_POOL_MAGIC;
+    data->size = sizeof(struct _cap_alloc_s);
+    data->u.pool.version = version;
+    return &data->u.pool;
+}
+
+/*
+ * _cap_pool_take obtains a zeroed allocation, recycled from the pool
+ * when one is available.
+ */
+static struct _cap_alloc_s *_cap_pool_take(cap_pool_t pool)
+{
+    struct _cap_alloc_s *raw_data;
+
+    _cap_mu_lock(&pool->mutex);
+    raw_data = pool->idle;
+    if (raw_data != NULL) {
+	pool->idle = raw_data->u.next_idle;
+	pool->count--;
+	raw_data->u.next_idle = NULL;
+    }
+    _cap_mu_unlock(&pool->mutex);
+
+    if (raw_data == NULL) {
+	raw_data = calloc(1, sizeof(struct _cap_alloc_s));
+	if (raw_data == NULL) {
+	    _cap_debug("out of memory");
+	    errno = ENOMEM;
+	}
+    }
+    return raw_data;
+}
+
+/*
+ * cap_pool_init_set obtains a blank set of capabilities from pool.
+ */
+cap_t cap_pool_init_set(cap_pool_t pool)
+{
+    if (!good_cap_pool_t(pool)) {
+	errno = EINVAL;
+	return NULL;
+    }
+    struct _cap_alloc_s *raw_data = _cap_pool_take(pool);
+    if (raw_data == NULL) {
+	return NULL;
+    }
+    return _cap_setup_set(raw_data, pool->version);
+}
+
+/*
+ * cap_pool_init_iab obtains a blank iab tuple from pool.
+ */
+cap_iab_t cap_pool_init_iab(cap_pool_t pool)
+{
+    if (!good_cap_pool_t(pool)) {
+	errno = EINVAL;
+	return NULL;
+    }
+    struct _cap_alloc_s *raw_data = _cap_pool_take(pool);
+    if (raw_data == NULL) {
+	return NULL;
+    }
+    raw_data->magic = CAP_IAB_MAGIC;
+    raw_data->size = sizeof(struct _cap_alloc_s);
+    return &raw_data->u.iab;
+}
+
+/*
+ * cap_pool_release scrubs a cap_t or cap_iab_t and keeps its memory in
+ * pool for reuse, unless the pool already holds _LIBCAP_POOL_MAX_IDLE
+ * idle allocations, in which case the memory is freed. Any other
+ * libcap object is simply cap_free()d.
+ */
+int cap_pool_release(cap_pool_t pool, void *obj)
+{
+    if (!good_cap_pool_t(pool)) {
+	errno = EINVAL;
+	return -1;
+    }
+    if (obj == NULL) {
+	return 0;
+    }
+    if (good_cap_pool_t(obj)) {
+	errno = EINVAL;
+	return -1;
+    }
+    if (!good_cap_t(obj) && !good_cap_iab_t(obj)) {
+	return cap_free(obj);
+    }
+
+    struct _cap_alloc_s *data = (void *) ((char *) obj - CAP_ALLOC_OFF_U);
+    if (data->size != sizeof(struct _cap_alloc_s)) {
+	_cap_debug("unexpected object size %u", data->size);
+	errno = EINVAL;
+	return -1;
+    }
+    if (data->magic == CAP_T_MAGIC) {
+	_cap_mu_lock(&data->u.set.mutex);
+    } else {
+	_cap_mu_lock(&data->u.iab.mutex);
+    }
+    memset(data, 0, sizeof(struct _cap_alloc_s));
+
+    _cap_mu_lock(&pool->mutex);
+    if (pool->count >= _LIBCAP_POOL_MAX_IDLE) {
+	_cap_mu_unlock(&pool->mutex);
+	free(data);
+	return 0;
+    }
+    data->u.next_idle = pool->idle;
+    pool->idle = data;
+    pool->count++;
+    _cap_mu_unlock(&pool->mutex);
+    return 0;
+}
+
 /*
  * Scrub and then liberate the recognized allocated object.
  */
@@ -281,6 +490,18 @@ int cap_free(void *data_p)
     case CAP_S_MAGIC:
     case CAP_IAB_MAGIC:
 	break;
+    case CAP_POOL_MAGIC:
+	_cap_mu_lock(&data->u.pool.mutex);
+	while (data->u.pool.idle != NULL) {
+	    struct _cap_alloc_s *idle = data->u.pool.idle;
+	    data->u.pool.idle = idle->u.next_idle;
+	    free(idle);
+	}
+	break;
+    case CAP_ZYGOTE_MAGIC:
+	_cap_mu_lock(&data->u.zygote.mutex);
+	_cap_zygote_stop(&data->u.zygote);
+	break;
     case CAP_LAUNCH_MAGIC:
 	if (data->u.launcher.iab != NULL) {
 	    _cap_mu_unlock(&data->u.launcher.iab->mutex);
@@ -0,0 +1,194 @@
+/*
+ * cap_fcaps_bench fuzzes cap_fcaps_decode() and cap_fcaps_encode()
+ * against a reference decoder, and measures the rate at which they
+ * convert security.capability xattr values. It is not run by "make
+ * test", use "make bench". Usage:
+ *
+ *    ./cap_fcaps_bench [fuzz-rounds]
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "libcap.h"
+
+#define ROUNDS 20
+#define BLOBS  65536
+#define FUZZ   1000000
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, long count, const char *unit,
+		   double start)
+{
+    double elapsed = now_sec() - start;
+    printf("%-20s %12.0f %s/sec\n", what, count / elapsed, unit);
+}
+
+/*
+ * legacy_decode reproduces the original structure based decoding of
+ * a security.capability value, to provide a reference for the codec.
+ */
+static int legacy_decode(const void *xattr, size_t len, struct cap_fcaps *f)
+{
+    struct vfs_ns_cap_data raw;
+    __u32 magic;
+    unsigned i, tocopy;
+
+    if (len < sizeof(raw.magic_etc) || len > sizeof(raw)) {
+	return -1;
+    }
+    memset(&raw, 0, sizeof(raw));
+    memcpy(&raw, xattr, len);
+    magic = le32toh(raw.magic_etc);
+    switch (magic & VFS_CAP_REVISION_MASK) {
+    case VFS_CAP_REVISION_1:
+	tocopy = VFS_CAP_U32_1;
+	len -= XATTR_CAPS_SZ_1;
+	break;
+    case VFS_CAP_REVISION_2:
+	tocopy = VFS_CAP_U32_2;
+	len -= XATTR_CAPS_SZ_2;
+	break;
+    case VFS_CAP_REVISION_3:
+	tocopy = VFS_CAP_U32_3;
+	len -= XATTR_CAPS_SZ_3;
+	break;
+    default:
+	return -1;
+    }
+    if (len != 0) {
+	return -1;
+    }
+
+    memset(f, 0, sizeof(*f));
+    f->revision = magic & VFS_CAP_REVISION_MASK;
+    f->effective = magic & VFS_CAP_FLAGS_EFFECTIVE;
+    if (f->revision == VFS_CAP_REVISION_3) {
+	f->rootid = le32toh(raw.rootid);
+    }
+    for (i = 0; i < tocopy; i++) {
+	f->permitted[i] = le32toh(raw.data[i].permitted);
+	f->inheritable[i] = le32toh(raw.data[i].inheritable);
+    }
+    return 0;
+}
+
+/*
+ * fill makes a mostly valid xattr value of a random revision. When
+ * fuzzing, the size and the magic word are sometimes corrupted.
+ */
+static size_t fill(unsigned char *b, int fuzz)
+{
+    static const size_t sizes[] = {
+	XATTR_CAPS_SZ_1, XATTR_CAPS_SZ_2, XATTR_CAPS_SZ_3
+    };
+    long r = random();
+    size_t i, len = sizes[r % 3];
+
+    for (i = 0; i < XATTR_CAPS_SZ_3 + 4; i++) {
+	b[i] = random();
+    }
+    b[0] &= VFS_CAP_FLAGS_EFFECTIVE;
+    b[1] = b[2] = 0;
+    b[3] = 1 + r % 3;
+    if (fuzz) {
+	switch ((r >> 4) % 8) {
+	case 0:
+	    len = random() % (XATTR_CAPS_SZ_3 + 5);
+	    break;
+	case 1:
+	    b[3] = random();
+	    break;
+	case 2:
+	    b[random() % 3] = random();
+	    break;
+	}
+    }
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    static unsigned char blobs[BLOBS][XATTR_CAPS_SZ_3 + 4];
+    static size_t lens[BLOBS];
+    unsigned char out[XATTR_CAPS_SZ_3];
+    struct cap_fcaps want, got;
+    long fuzz = FUZZ, valid = 0, sum = 0;
+    int i, j;
+    double start;
+
+    if (argc > 1) {
+	fuzz = atol(argv[1]);
+    }
+
+    srandom(1);
+    for (i = 0; i < fuzz; i++) {
+	unsigned char b[XATTR_CAPS_SZ_3 + 4];
+	size_t len = fill(b, 1);
+	int w = legacy_decode(b, len, &want);
+	int g = cap_fcaps_decode(b, len, &got);
+	ssize_t n;
+
+	if (w != g || (w == 0 && memcmp(&want, &got, sizeof(got)))) {
+	    printf("decode mismatch for blob %d of %zu bytes\n", i, len);
+	    exit(1);
+	}
+	if (g) {
+	    continue;
+	}
+	valid++;
+	/* only the effective flag survives re-encoding */
+	b[0] &= VFS_CAP_FLAGS_EFFECTIVE;
+	b[1] = b[2] = 0;
+	n = cap_fcaps_encode(&got, out, sizeof(out));
+	if (n < 0 || (size_t) n != len || memcmp(out, b, n)) {
+	    printf("encode mismatch for blob %d\n", i);
+	    exit(1);
+	}
+    }
+    printf("fuzzed %ld blobs, %ld valid\n", fuzz, valid);
+
+    for (i = 0; i < BLOBS; i++) {
+	lens[i] = fill(blobs[i], 0);
+    }
+
+    start = now_sec();
+    for (j = 0; j < ROUNDS; j++) {
+	for (i = 0; i < BLOBS; i++) {
+	    sum += legacy_decode(blobs[i], lens[i], &got);
+	}
+    }
+    report("legacy decode", (long) ROUNDS * BLOBS, "xattrs", start);
+
+    start = now_sec();
+    for (j = 0; j < ROUNDS; j++) {
+	for (i = 0; i < BLOBS; i++) {
+	    sum += cap_fcaps_decode(blobs[i], lens[i], &got);
+	}
+    }
+    report("cap_fcaps_decode", (long) ROUNDS * BLOBS, "xattrs", start);
+
+    cap_fcaps_decode(blobs[0], lens[0], &got);
+    start = now_sec();
+    for (j = 0; j < ROUNDS; j++) {
+	for (i = 0; i < BLOBS; i++) {
+	    got.permitted[0] = i;
+	    sum += cap_fcaps_encode(&got, out, sizeof(out));
+	}
+    }
+    report("cap_fcaps_encode", (long) ROUNDS * BLOBS, "xattrs", start);
+
+    if (sum != (long) ROUNDS * BLOBS * lens[0]) {
+	printf("benchmark decoding failed\n");
+	exit(1);
+    }
+    exit(0);
+}
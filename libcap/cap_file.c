@@ -13,9 +13,11 @@
 #endif
 
 #include <sys/types.h>
-#include <byteswap.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 /*
@@ -25,6 +27,7 @@
  * other libraries to access them.
  */
 extern ssize_t getxattr(const char *, const char *, void *, size_t);
+extern ssize_t lgetxattr(const char *, const char *, void *, size_t);
 extern ssize_t fgetxattr(int, const char *, void *, size_t);
 extern int setxattr(const char *, const char *, const void *, size_t, int);
 extern int fsetxattr(int, const char *, const void *, size_t, int);
@@ -55,77 +58,151 @@ extern int fremovexattr(int, const char *);
 # error VFS representation of capabilities is not the same size as kernel
 #endif
 
-#if __BYTE_ORDER == __BIG_ENDIAN
-#define FIXUP_32BITS(x) bswap_32(x)
-#else
-#define FIXUP_32BITS(x) (x)
-#endif
+/*
+ * _cap_vfs_rev holds the size and number of 32-bit words of each
+ * revision of the security.capability xattr.
+ */
+static const struct {
+    unsigned char size, words;
+} _cap_vfs_rev[4] = {
+    { 0, 0 },
+    { XATTR_CAPS_SZ_1, VFS_CAP_U32_1 },
+    { XATTR_CAPS_SZ_2, VFS_CAP_U32_2 },
+    { XATTR_CAPS_SZ_3, VFS_CAP_U32_3 },
+};
+
+static inline __u32 _cap_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((__u32) p[3] << 24);
+}
 
-static cap_t _fcaps_load(struct vfs_ns_cap_data *rawvfscap, cap_t result,
-			 int bytes)
+static inline void _cap_put_le32(unsigned char *p, __u32 v)
 {
-    __u32 magic_etc;
-    unsigned tocopy, i;
-
-    magic_etc = FIXUP_32BITS(rawvfscap->magic_etc);
-    switch (magic_etc & VFS_CAP_REVISION_MASK) {
-    case VFS_CAP_REVISION_1:
-	tocopy = VFS_CAP_U32_1;
-	bytes -= XATTR_CAPS_SZ_1;
-	break;
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
 
-    case VFS_CAP_REVISION_2:
-	tocopy = VFS_CAP_U32_2;
-	bytes -= XATTR_CAPS_SZ_2;
-	break;
+/*
+ * Decode the bytes of a security.capability xattr. The xattr need
+ * not be aligned. Everything but the validation is done without
+ * branches: the second word of a revision 1 value, and the rootid of
+ * a revision 1 or 2 value, are read from an earlier valid offset and
+ * masked to zero.
+ */
 
-    case VFS_CAP_REVISION_3:
-	tocopy = VFS_CAP_U32_3;
-	bytes -= XATTR_CAPS_SZ_3;
-	result->rootid = FIXUP_32BITS(rawvfscap->rootid);
-	break;
+int cap_fcaps_decode(const void *xattr, size_t len, struct cap_fcaps *out)
+{
+    const unsigned char *p = xattr;
+    __u32 magic, rev, two, ns;
 
-    default:
-	cap_free(result);
-	result = NULL;
-	return result;
+    if (p == NULL || out == NULL || len < sizeof(__u32)) {
+	errno = EINVAL;
+	return -1;
+    }
+    magic = _cap_le32(p);
+    rev = magic >> VFS_CAP_REVISION_SHIFT;
+    if (rev - 1 > 2 || len != _cap_vfs_rev[rev].size) {
+	errno = EINVAL;
+	return -1;
     }
 
-    /*
-     * Verify that we loaded exactly the right number of bytes
-     */
-    if (bytes != 0) {
-	cap_free(result);
-	result = NULL;
-	return result;
-    }
-
-    for (i=0; i < tocopy; i++) {
-	result->u[i].flat[CAP_INHERITABLE]
-	    = FIXUP_32BITS(rawvfscap->data[i].inheritable);
-	result->u[i].flat[CAP_PERMITTED]
-	    = FIXUP_32BITS(rawvfscap->data[i].permitted);
-	if (magic_etc & VFS_CAP_FLAGS_EFFECTIVE) {
-	    result->u[i].flat[CAP_EFFECTIVE]
-		= result->u[i].flat[CAP_INHERITABLE]
-		| result->u[i].flat[CAP_PERMITTED];
-	}
+    two = _cap_vfs_rev[rev].words - 1;
+    ns = rev == 3;
+    out->revision = magic & VFS_CAP_REVISION_MASK;
+    out->effective = magic & VFS_CAP_FLAGS_EFFECTIVE;
+    out->permitted[0] = _cap_le32(p + 4);
+    out->inheritable[0] = _cap_le32(p + 8);
+    out->permitted[1] = _cap_le32(p + 4 + 8*two) & -two;
+    out->inheritable[1] = _cap_le32(p + 8 + 8*two) & -two;
+    out->rootid = _cap_le32(p + 20*ns) & -ns;
+    return 0;
+}
+
+/*
+ * Encode a security.capability xattr into the len bytes at xattr,
+ * returning the number of bytes used.
+ */
+
+ssize_t cap_fcaps_encode(const struct cap_fcaps *in, void *xattr, size_t len)
+{
+    unsigned char *p = xattr;
+    __u32 rev;
+
+    if (in == NULL || p == NULL || (in->revision & ~VFS_CAP_REVISION_MASK)) {
+	errno = EINVAL;
+	return -1;
     }
-    while (i < __CAP_BLKS) {
-	result->u[i].flat[CAP_INHERITABLE]
-	    = result->u[i].flat[CAP_PERMITTED]
-	    = result->u[i].flat[CAP_EFFECTIVE] = 0;
-	i++;
+    rev = in->revision >> VFS_CAP_REVISION_SHIFT;
+    if (rev - 1 > 2 ||
+	(rev == 1 && (in->permitted[1] | in->inheritable[1])) ||
+	(rev != 3 && in->rootid != 0)) {
+	errno = EINVAL;
+	return -1;
     }
+    if (len < _cap_vfs_rev[rev].size) {
+	errno = ERANGE;
+	return -1;
+    }
+
+    _cap_put_le32(p, in->revision | (in->effective ? VFS_CAP_FLAGS_EFFECTIVE : 0));
+    _cap_put_le32(p + 4, in->permitted[0]);
+    _cap_put_le32(p + 8, in->inheritable[0]);
+    if (rev != 1) {
+	_cap_put_le32(p + 12, in->permitted[1]);
+	_cap_put_le32(p + 16, in->inheritable[1]);
+    }
+    if (rev == 3) {
+	_cap_put_le32(p + 20, in->rootid);
+    }
+    return _cap_vfs_rev[rev].size;
+}
+
+/*
+ * _fcaps_decode fills result with the file capabilities held in the
+ * bytes of rawvfscap. It returns -1 (with result unchanged) if they
+ * are not a valid security.capability value.
+ */
+static int _fcaps_decode(const void *rawvfscap, cap_t result, ssize_t bytes)
+{
+    struct cap_fcaps f;
+    __u32 eff;
+    unsigned i;
 
+    if (bytes < 0 || cap_fcaps_decode(rawvfscap, bytes, &f) != 0) {
+	return -1;
+    }
+
+    eff = -(f.effective != 0);
+    result->rootid = f.rootid;
+    for (i = 0; i < __CAP_BLKS; i++) {
+	result->u[i].flat[CAP_INHERITABLE] = f.inheritable[i];
+	result->u[i].flat[CAP_PERMITTED] = f.permitted[i];
+	result->u[i].flat[CAP_EFFECTIVE]
+	    = (f.inheritable[i] | f.permitted[i]) & eff;
+    }
+
+    return 0;
+}
+
+static cap_t _fcaps_load(struct vfs_ns_cap_data *rawvfscap, cap_t result,
+			 int bytes)
+{
+    if (_fcaps_decode(rawvfscap, result, bytes) != 0) {
+	cap_free(result);
+	result = NULL;
+    }
     return result;
 }
 
 static int _fcaps_save(struct vfs_ns_cap_data *rawvfscap, cap_t cap_d,
 		       int *bytes_p)
 {
-    __u32 eff_not_zero, magic;
-    unsigned tocopy, i;
+    struct cap_fcaps f;
+    __u32 eff_not_zero;
+    unsigned words, i;
+    ssize_t bytes;
 
     if (!good_cap_t(cap_d)) {
 	errno = EINVAL;
@@ -133,18 +210,17 @@ static int _fcaps_save(struct vfs_ns_cap_data *rawvfscap, cap_t cap_d,
     }
     _cap_mu_lock(&cap_d->mutex);
 
+    memset(&f, 0, sizeof(f));
     switch (cap_d->head.version) {
     case _LINUX_CAPABILITY_VERSION_1:
-	magic = VFS_CAP_REVISION_1;
-	tocopy = VFS_CAP_U32_1;
-	*bytes_p = XATTR_CAPS_SZ_1;
+	f.revision = VFS_CAP_REVISION_1;
+	words = VFS_CAP_U32_1;
 	break;
 
     case _LINUX_CAPABILITY_VERSION_2:
     case _LINUX_CAPABILITY_VERSION_3:
-	magic = VFS_CAP_REVISION_2;
-	tocopy = VFS_CAP_U32_2;
-	*bytes_p = XATTR_CAPS_SZ_2;
+	f.revision = VFS_CAP_REVISION_2;
+	words = VFS_CAP_U32_2;
 	break;
 
     default:
@@ -158,15 +234,13 @@ static int _fcaps_save(struct vfs_ns_cap_data *rawvfscap, cap_t cap_d,
 	    errno = EINVAL;
 	    _cap_mu_unlock_return(&cap_d->mutex, -1);
 	}
-	magic = VFS_CAP_REVISION_3;
-	tocopy = VFS_CAP_U32_3;
-	*bytes_p = XATTR_CAPS_SZ_3;
-	rawvfscap->rootid = FIXUP_32BITS(cap_d->rootid);
+	f.revision = VFS_CAP_REVISION_3;
+	f.rootid = cap_d->rootid;
     }
 
     _cap_debug("setting named file capabilities");
 
-    for (eff_not_zero = 0, i = 0; i < tocopy; i++) {
+    for (eff_not_zero = 0, i = 0; i < words; i++) {
 	eff_not_zero |= cap_d->u[i].flat[CAP_EFFECTIVE];
     }
     while (i < __CAP_BLKS) {
@@ -182,11 +256,9 @@ static int _fcaps_save(struct vfs_ns_cap_data *rawvfscap, cap_t cap_d,
 	i++;
     }
 
-    for (i=0; i < tocopy; i++) {
-	rawvfscap->data[i].permitted
-	    = FIXUP_32BITS(cap_d->u[i].flat[CAP_PERMITTED]);
-	rawvfscap->data[i].inheritable
-	    = FIXUP_32BITS(cap_d->u[i].flat[CAP_INHERITABLE]);
+    for (i=0; i < words; i++) {
+	f.permitted[i] = cap_d->u[i].flat[CAP_PERMITTED];
+	f.inheritable[i] = cap_d->u[i].flat[CAP_INHERITABLE];
 
 	if (eff_not_zero
 	    && ((~(cap_d->u[i].flat[CAP_EFFECTIVE]))
@@ -196,12 +268,13 @@ static int _fcaps_save(struct vfs_ns_cap_data *rawvfscap, cap_t cap_d,
 	    _cap_mu_unlock_return(&cap_d->mutex, -1);
 	}
     }
+    f.effective = eff_not_zero != 0;
 
-    if (eff_not_zero == 0) {
-	rawvfscap->magic_etc = FIXUP_32BITS(magic);
-    } else {
-	rawvfscap->magic_etc = FIXUP_32BITS(magic|VFS_CAP_FLAGS_EFFECTIVE);
+    bytes = cap_fcaps_encode(&f, rawvfscap, sizeof(*rawvfscap));
+    if (bytes < 0) {
+	_cap_mu_unlock_return(&cap_d->mutex, -1);
     }
+    *bytes_p = bytes;
 
     _cap_mu_unlock_return(&cap_d->mutex, 0);    /* success */
 }
@@ -267,6 +340,194 @@ cap_t cap_get_file(const char *filename)
     return result;
 }
 
+/*
+ * getxattrat() (Linux 6.13) reads an xattr of a file named relative
+ * to a directory fd. Libc headers are slow to learn new syscall
+ * numbers, so we supply it for the architectures that share the
+ * unified syscall table. If the running kernel lacks it, we fall
+ * back to naming the file via /proc/self/fd/.
+ */
+#if !defined(SYS_getxattrat) && ((defined(__x86_64__) && !defined(__ILP32__)) \
+    || defined(__i386__) || defined(__aarch64__) || defined(__arm__)	\
+    || defined(__riscv) || defined(__loongarch__))
+#define SYS_getxattrat 464
+#endif
+
+#ifdef SYS_getxattrat
+struct _cap_xattr_args {
+    __u64 value;
+    __u32 size;
+    __u32 flags;
+};
+static int _cap_no_getxattrat;
+#endif
+
+static ssize_t _cap_getxattrat(int dirfd, const char *name, int flags,
+			       void *value, size_t size)
+{
+    char path[PATH_MAX];
+
+    if (dirfd == AT_FDCWD || name[0] == '/') {
+	if (flags & AT_SYMLINK_NOFOLLOW) {
+	    return lgetxattr(name, XATTR_NAME_CAPS, value, size);
+	}
+	return getxattr(name, XATTR_NAME_CAPS, value, size);
+    }
+
+#ifdef SYS_getxattrat
+    if (!_cap_no_getxattrat) {
+	struct _cap_xattr_args args = {
+	    .value = (__u64) (uintptr_t) value,
+	    .size = size,
+	};
+	ssize_t n = syscall(SYS_getxattrat, dirfd, name, flags,
+			    XATTR_NAME_CAPS, &args, sizeof(args));
+	if (n >= 0 || errno != ENOSYS) {
+	    return n;
+	}
+	_cap_no_getxattrat = 1;
+    }
+#endif
+
+    if (snprintf(path, sizeof(path), "/proc/self/fd/%d/%s", dirfd, name)
+	>= ssizeof(path)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    if (flags & AT_SYMLINK_NOFOLLOW) {
+	return lgetxattr(path, XATTR_NAME_CAPS, value, size);
+    }
+    return getxattr(path, XATTR_NAME_CAPS, value, size);
+}
+
+/*
+ * Get the capabilities of a file named relative to a directory file
+ * descriptor. When reuse is not NULL, it is filled in and returned
+ * instead of allocating a new cap_t. On failure reuse is unchanged.
+ */
+
+cap_t cap_get_fileat(int dirfd, const char *name, cap_t reuse, int flags)
+{
+    struct vfs_ns_cap_data rawvfscap;
+    ssize_t sizeofcaps;
+    cap_t result;
+
+    if (name == NULL || (flags & ~AT_SYMLINK_NOFOLLOW) ||
+	(reuse != NULL && !good_cap_t(reuse))) {
+	errno = EINVAL;
+	return NULL;
+    }
+
+    _cap_debug("getting dirfd relative capabilities");
+    sizeofcaps = _cap_getxattrat(dirfd, name, flags,
+				 &rawvfscap, sizeof(rawvfscap));
+    if (sizeofcaps < 0) {
+	return NULL;
+    }
+
+    result = reuse;
+    if (result == NULL) {
+	result = cap_init();
+	if (result == NULL) {
+	    return NULL;
+	}
+    } else {
+	_cap_mu_lock(&result->mutex);
+    }
+    if (_fcaps_decode(&rawvfscap, result, sizeofcaps) != 0) {
+	if (reuse == NULL) {
+	    cap_free(result);
+	} else {
+	    _cap_mu_unlock(&result->mutex);
+	}
+	errno = EINVAL;
+	return NULL;
+    }
+    if (reuse != NULL) {
+	_cap_mu_unlock(&result->mutex);
+    }
+    return result;
+}
+
+/*
+ * Invoke fn for each entry of the directory dirfd. The type of each
+ * entry is taken from the directory listing where the filesystem
+ * provides it. Only regular files are examined for capabilities,
+ * into a single cap_t owned by this function.
+ */
+
+int cap_scan_dir(int dirfd, cap_scan_fn_t fn, void *data)
+{
+    struct dirent *de;
+    DIR *dir;
+    cap_t caps;
+    int fd, err, ret = 0;
+
+    if (fn == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    fd = openat(dirfd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0) {
+	return -1;
+    }
+    dir = fdopendir(fd);
+    if (dir == NULL) {
+	close(fd);
+	return -1;
+    }
+    caps = cap_init();
+    if (caps == NULL) {
+	closedir(dir);
+	return -1;
+    }
+
+    for (;;) {
+	const char *name;
+	int type;
+
+	errno = 0;
+	de = readdir(dir);
+	if (de == NULL) {
+	    if (errno != 0) {
+		ret = -1;
+	    }
+	    break;
+	}
+	name = de->d_name;
+	if (name[0] == '.' &&
+	    (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+	    continue;
+	}
+
+	type = de->d_type;
+	if (type == DT_UNKNOWN) {
+	    struct stat st;
+	    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+		type = IFTODT(st.st_mode);
+	    }
+	}
+
+	if (type != DT_REG) {
+	    ret = fn(dirfd, name, type, NULL, data);
+	} else if (cap_get_fileat(dirfd, name, caps,
+				  AT_SYMLINK_NOFOLLOW) == NULL) {
+	    ret = fn(dirfd, name, type, NULL, data);
+	} else {
+	    ret = fn(dirfd, name, type, caps, data);
+	}
+	if (ret != 0) {
+	    break;
+	}
+    }
+
+    err = errno;
+    cap_free(caps);
+    closedir(dir);
+    errno = err;
+    return ret;
+}
+
 /*
  * Get rootid as seen in the current user namespace for the file capability
  * sets.
@@ -421,6 +682,30 @@ cap_t cap_get_file(const char *filename)
     return NULL;
 }
 
+cap_t cap_get_fileat(int dirfd, const char *name, cap_t reuse, int flags)
+{
+    errno = EINVAL;
+    return NULL;
+}
+
+int cap_scan_dir(int dirfd, cap_scan_fn_t fn, void *data)
+{
+    errno = EINVAL;
+    return -1;
+}
+
+int cap_fcaps_decode(const void *xattr, size_t len, struct cap_fcaps *out)
+{
+    errno = EINVAL;
+    return -1;
+}
+
+ssize_t cap_fcaps_encode(const struct cap_fcaps *in, void *xattr, size_t len)
+{
+    errno = EINVAL;
+    return -1;
+}
+
 uid_t cap_get_nsowner(cap_t cap_d)
 {
     errno = EINVAL;
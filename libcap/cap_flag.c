@@ -205,6 +205,148 @@ int cap_fill(cap_t cap_d, cap_flag_t to, cap_flag_t from)
     return cap_fill_flag(cap_d, to, cap_d, from);
 }
 
+/*
+ * The set algebra functions combine whole capability sets a block at
+ * a time. The second operand is copied under its own lock before the
+ * first is locked, so at most one lock is ever held (and a set can be
+ * combined with itself).
+ */
+enum _cap_op {
+    _CAP_UNION,
+    _CAP_INTERSECT,
+    _CAP_SUBTRACT,
+};
+
+static int _cap_combine(cap_t cap_d, cap_t ref, enum _cap_op op)
+{
+    __u32 flat[_LIBCAP_CAPABILITY_U32S][NUMBER_OF_CAP_SETS];
+    int i, f;
+
+    if (!good_cap_t(cap_d) || !good_cap_t(ref)) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    _cap_mu_lock(&ref->mutex);
+    for (i = 0; i < _LIBCAP_CAPABILITY_U32S; i++) {
+	for (f = 0; f < NUMBER_OF_CAP_SETS; f++) {
+	    flat[i][f] = ref->u[i].flat[f];
+	}
+    }
+    _cap_mu_unlock(&ref->mutex);
+
+    _cap_mu_lock(&cap_d->mutex);
+    for (i = 0; i < _LIBCAP_CAPABILITY_U32S; i++) {
+	for (f = 0; f < NUMBER_OF_CAP_SETS; f++) {
+	    switch (op) {
+	    case _CAP_UNION:
+		cap_d->u[i].flat[f] |= flat[i][f];
+		break;
+	    case _CAP_INTERSECT:
+		cap_d->u[i].flat[f] &= flat[i][f];
+		break;
+	    default:
+		cap_d->u[i].flat[f] &= ~flat[i][f];
+		break;
+	    }
+	}
+    }
+    _cap_mu_unlock(&cap_d->mutex);
+    return 0;
+}
+
+/*
+ * cap_union raises in cap_d every flag of every capability raised in
+ * ref.
+ */
+int cap_union(cap_t cap_d, cap_t ref)
+{
+    return _cap_combine(cap_d, ref, _CAP_UNION);
+}
+
+/*
+ * cap_intersect lowers in cap_d every flag of every capability not
+ * raised in ref.
+ */
+int cap_intersect(cap_t cap_d, cap_t ref)
+{
+    return _cap_combine(cap_d, ref, _CAP_INTERSECT);
+}
+
+/*
+ * cap_subtract lowers in cap_d every flag of every capability raised
+ * in ref.
+ */
+int cap_subtract(cap_t cap_d, cap_t ref)
+{
+    return _cap_combine(cap_d, ref, _CAP_SUBTRACT);
+}
+
+/*
+ * cap_count returns the number of capabilities raised in a flag of
+ * cap_d.
+ */
+int cap_count(cap_t cap_d, cap_flag_t flag)
+{
+    int i, n = 0;
+
+    if (!good_cap_t(cap_d) || flag < 0 || flag >= NUMBER_OF_CAP_SETS) {
+	errno = EINVAL;
+	return -1;
+    }
+    _cap_mu_lock(&cap_d->mutex);
+    for (i = 0; i < _LIBCAP_CAPABILITY_U32S; i++) {
+	n += __builtin_popcount(cap_d->u[i].flat[flag]);
+    }
+    _cap_mu_unlock(&cap_d->mutex);
+    return n;
+}
+
+/*
+ * _cap_next_bit returns the lowest bit >= from raised in the blocks of
+ * vec, or -1 if there is none.
+ */
+static cap_value_t _cap_next_bit(const __u32 *vec, cap_value_t from)
+{
+    unsigned i = from >> 5;
+    __u32 bits;
+
+    if (from < 0 || i >= _LIBCAP_CAPABILITY_U32S) {
+	return -1;
+    }
+    bits = vec[i] & (~0U << (from & 31));
+    while (!bits) {
+	if (++i == _LIBCAP_CAPABILITY_U32S) {
+	    return -1;
+	}
+	bits = vec[i];
+    }
+    return 32*i + __builtin_ctz(bits);
+}
+
+/*
+ * cap_next_raised returns the lowest capability value >= from that is
+ * raised in the flag of cap_d, or -1 when there are none left. This
+ * can be used to iterate over the raised capabilities of a set
+ * without testing each value in turn.
+ */
+cap_value_t cap_next_raised(cap_t cap_d, cap_flag_t flag, cap_value_t from)
+{
+    __u32 vec[_LIBCAP_CAPABILITY_U32S];
+    int i;
+
+    if (!good_cap_t(cap_d) || flag < 0 || flag >= NUMBER_OF_CAP_SETS) {
+	errno = EINVAL;
+	return -1;
+    }
+    _cap_mu_lock(&cap_d->mutex);
+    for (i = 0; i < _LIBCAP_CAPABILITY_U32S; i++) {
+	vec[i] = cap_d->u[i].flat[flag];
+    }
+    _cap_mu_unlock(&cap_d->mutex);
+    return _cap_next_bit(vec, from);
+}
+
 /*
  * cap_iab_get_vector reads the single bit value from an IAB vector set.
  */
@@ -367,3 +509,135 @@ int cap_iab_compare(cap_iab_t a, cap_iab_t b)
 
     return result;
 }
+
+/*
+ * _cap_iab_combine is the IAB counterpart of _cap_combine(). Each
+ * vector is combined independently, and then any A bits that are no
+ * longer in I are lowered.
+ */
+static int _cap_iab_combine(cap_iab_t iab, cap_iab_t ref, enum _cap_op op)
+{
+    __u32 i_[_LIBCAP_CAPABILITY_U32S], a[_LIBCAP_CAPABILITY_U32S],
+	nb[_LIBCAP_CAPABILITY_U32S];
+    int j;
+
+    if (!good_cap_iab_t(iab) || !good_cap_iab_t(ref)) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    _cap_mu_lock(&ref->mutex);
+    for (j = 0; j < _LIBCAP_CAPABILITY_U32S; j++) {
+	i_[j] = ref->i[j];
+	a[j] = ref->a[j];
+	nb[j] = ref->nb[j];
+    }
+    _cap_mu_unlock(&ref->mutex);
+
+    _cap_mu_lock(&iab->mutex);
+    for (j = 0; j < _LIBCAP_CAPABILITY_U32S; j++) {
+	switch (op) {
+	case _CAP_UNION:
+	    iab->i[j] |= i_[j];
+	    iab->a[j] |= a[j];
+	    iab->nb[j] |= nb[j];
+	    break;
+	case _CAP_INTERSECT:
+	    iab->i[j] &= i_[j];
+	    iab->a[j] &= a[j];
+	    iab->nb[j] &= nb[j];
+	    break;
+	default:
+	    iab->i[j] &= ~i_[j];
+	    iab->a[j] &= ~a[j];
+	    iab->nb[j] &= ~nb[j];
+	    break;
+	}
+	iab->a[j] &= iab->i[j];
+    }
+    _cap_mu_unlock(&iab->mutex);
+    return 0;
+}
+
+/*
+ * cap_iab_union raises in iab every bit of each vector raised in ref.
+ */
+int cap_iab_union(cap_iab_t iab, cap_iab_t ref)
+{
+    return _cap_iab_combine(iab, ref, _CAP_UNION);
+}
+
+/*
+ * cap_iab_intersect lowers in iab every bit of each vector not raised
+ * in ref.
+ */
+int cap_iab_intersect(cap_iab_t iab, cap_iab_t ref)
+{
+    return _cap_iab_combine(iab, ref, _CAP_INTERSECT);
+}
+
+/*
+ * cap_iab_subtract lowers in iab every bit of each vector raised in
+ * ref. Lowering an I bit also lowers the corresponding A bit.
+ */
+int cap_iab_subtract(cap_iab_t iab, cap_iab_t ref)
+{
+    return _cap_iab_combine(iab, ref, _CAP_SUBTRACT);
+}
+
+/*
+ * _cap_iab_vector returns the blocks of vec in iab, or NULL.
+ */
+static const __u32 *_cap_iab_vector(cap_iab_t iab, cap_iab_vector_t vec)
+{
+    switch (vec) {
+    case CAP_IAB_INH:
+	return iab->i;
+    case CAP_IAB_AMB:
+	return iab->a;
+    case CAP_IAB_BOUND:
+	return iab->nb;
+    default:
+	return NULL;
+    }
+}
+
+/*
+ * cap_iab_count returns the number of bits raised in a vector of iab.
+ */
+int cap_iab_count(cap_iab_t iab, cap_iab_vector_t vec)
+{
+    const __u32 *v;
+    int j, n = 0;
+
+    if (!good_cap_iab_t(iab) || (v = _cap_iab_vector(iab, vec)) == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    _cap_mu_lock(&iab->mutex);
+    for (j = 0; j < _LIBCAP_CAPABILITY_U32S; j++) {
+	n += __builtin_popcount(v[j]);
+    }
+    _cap_mu_unlock(&iab->mutex);
+    return n;
+}
+
+/*
+ * cap_iab_next_raised returns the lowest bit >= from raised in a
+ * vector of iab, or -1 when there are none left.
+ */
+cap_value_t cap_iab_next_raised(cap_iab_t iab, cap_iab_vector_t vec,
+				cap_value_t from)
+{
+    const __u32 *v;
+    cap_value_t n;
+
+    if (!good_cap_iab_t(iab) || (v = _cap_iab_vector(iab, vec)) == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    _cap_mu_lock(&iab->mutex);
+    n = _cap_next_bit(v, from);
+    _cap_mu_unlock(&iab->mutex);
+    return n;
+}
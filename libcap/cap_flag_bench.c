@@ -0,0 +1,186 @@
+/*
+ * cap_flag_bench compares the whole set operations, cap_union() and
+ * friends, with the equivalent loops over cap_get_flag() and
+ * cap_set_flag() a caller would otherwise write. It is not run by
+ * "make test", use "make bench".
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+
+#include "libcap.h"
+
+#define ROUNDS 20000
+#define SETS   64
+
+static const cap_flag_t flags[] = {
+    CAP_EFFECTIVE, CAP_PERMITTED, CAP_INHERITABLE
+};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, long count, const char *unit,
+		   double start)
+{
+    double elapsed = now_sec() - start;
+    printf("%-20s %12.0f %s/sec\n", what, count / elapsed, unit);
+}
+
+/*
+ * legacy_combine applies a set operation one bit at a time: op 0 is
+ * union, 1 is intersection and 2 subtraction.
+ */
+static void legacy_combine(cap_t to, cap_t from, int op)
+{
+    cap_value_t c;
+    int f;
+
+    for (f = 0; f < 3; f++) {
+	for (c = 0; c < __CAP_MAXBITS; c++) {
+	    cap_flag_value_t a, b;
+	    cap_get_flag(to, c, flags[f], &a);
+	    cap_get_flag(from, c, flags[f], &b);
+	    switch (op) {
+	    case 0:
+		a |= b;
+		break;
+	    case 1:
+		a &= b;
+		break;
+	    default:
+		a &= !b;
+		break;
+	    }
+	    cap_set_flag(to, flags[f], 1, &c, a);
+	}
+    }
+}
+
+static int legacy_count(cap_t caps, cap_flag_t f)
+{
+    cap_flag_value_t v;
+    cap_value_t c;
+    int n = 0;
+
+    for (c = 0; c < __CAP_MAXBITS; c++) {
+	if (cap_get_flag(caps, c, f, &v) == 0 && v) {
+	    n++;
+	}
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *opnames[] = { "union", "intersect", "subtract" };
+    int (*ops[3])(cap_t, cap_t) = { cap_union, cap_intersect, cap_subtract };
+    cap_t sets[SETS], work = cap_init(), want = cap_init();
+    char name[32];
+    long sum = 0, check = 0, walked = 0;
+    int counts[SETS];
+    cap_value_t c;
+    double start;
+    int i, j, k;
+
+    srandom(1);
+    for (i = 0; i < SETS; i++) {
+	sets[i] = cap_init();
+	for (c = 0; c < __CAP_MAXBITS; c++) {
+	    for (k = 0; k < 3; k++) {
+		if (random() & 1) {
+		    cap_set_flag(sets[i], flags[k], 1, &c, CAP_SET);
+		}
+	    }
+	}
+    }
+
+    for (k = 0; k < 3; k++) {
+	for (i = 0; i < SETS; i++) {
+	    j = (i + 1) % SETS;
+	    cap_clear(want);
+	    cap_clear(work);
+	    cap_union(want, sets[i]);
+	    cap_union(work, sets[i]);
+	    legacy_combine(want, sets[j], k);
+	    ops[k](work, sets[j]);
+	    if (cap_compare(want, work)) {
+		printf("%s mismatch for sets %d and %d\n", opnames[k], i, j);
+		exit(1);
+	    }
+	}
+    }
+    for (i = 0; i < SETS; i++) {
+	for (k = 0; k < 3; k++) {
+	    int n = 0;
+	    for (c = cap_next_raised(sets[i], flags[k], 0); c >= 0;
+		 c = cap_next_raised(sets[i], flags[k], c + 1)) {
+		n++;
+	    }
+	    if (flags[k] == CAP_PERMITTED) {
+		counts[i] = n;
+	    }
+	    if (n != legacy_count(sets[i], flags[k]) ||
+		n != cap_count(sets[i], flags[k])) {
+		printf("count mismatch for set %d\n", i);
+		exit(1);
+	    }
+	}
+    }
+
+    for (k = 0; k < 3; k++) {
+	snprintf(name, sizeof(name), "legacy %s", opnames[k]);
+	start = now_sec();
+	for (i = 0; i < ROUNDS / 10; i++) {
+	    legacy_combine(work, sets[i % SETS], k);
+	}
+	report(name, ROUNDS / 10, "sets", start);
+
+	snprintf(name, sizeof(name), "cap_%s", opnames[k]);
+	start = now_sec();
+	for (i = 0; i < ROUNDS * 10; i++) {
+	    ops[k](work, sets[i % SETS]);
+	}
+	report(name, ROUNDS * 10, "sets", start);
+    }
+
+    start = now_sec();
+    for (i = 0; i < ROUNDS / 10; i++) {
+	check += legacy_count(sets[i % SETS], CAP_PERMITTED);
+    }
+    report("legacy count", ROUNDS / 10, "sets", start);
+
+    start = now_sec();
+    for (i = 0; i < ROUNDS * 10; i++) {
+	sum += cap_count(sets[i % SETS], CAP_PERMITTED);
+    }
+    report("cap_count", ROUNDS * 10, "sets", start);
+
+    start = now_sec();
+    for (i = 0; i < ROUNDS / 10; i++) {
+	for (c = cap_next_raised(sets[i % SETS], CAP_PERMITTED, 0); c >= 0;
+	     c = cap_next_raised(sets[i % SETS], CAP_PERMITTED, c + 1)) {
+	    walked++;
+	}
+    }
+    report("cap_next_raised", ROUNDS / 10, "sets", start);
+
+    for (i = 0; i < ROUNDS * 10; i++) {
+	sum -= counts[i % SETS];
+    }
+    if (sum != 0 || walked != check) {
+	printf("benchmark counting failed\n");
+	exit(1);
+    }
+    for (i = 0; i < SETS; i++) {
+	cap_free(sets[i]);
+    }
+    cap_free(work);
+    cap_free(want);
+    exit(0);
+}
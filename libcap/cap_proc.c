@@ -11,8 +11,13 @@
 #include <errno.h>
 #include <fcntl.h>              /* Obtain O_* constant definitions */
 #include <grp.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/securebits.h>
+#include <sys/socket.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -53,6 +58,7 @@ struct syscaller_s {
     long int (*six)(long int syscall_nr,
 		    long int arg1, long int arg2, long int arg3,
 		    long int arg4, long int arg5, long int arg6);
+    int (*vec)(struct psx_call *calls, int n);
 };
 
 /* use this syscaller for multi-threaded code */
@@ -85,12 +91,40 @@ void cap_set_syscall(long int (*new_syscall)(long int,
 						     long int)) {
     if (new_syscall == NULL) {
 	psx_load_syscalls(&multithread.three, &multithread.six);
+	psx_load_syscall_vec(&multithread.vec);
     } else {
 	multithread.three = new_syscall;
 	multithread.six = new_syscall6;
+	multithread.vec = NULL;
     }
 }
 
+/*
+ * _libcap_vec_ok determines if a syscaller can perform a whole
+ * sequence of state changing syscalls with a single psx_syscall_vec()
+ * broadcast.
+ */
+#define _libcap_vec_ok(sc) (_libcap_overrode_syscalls && (sc)->vec != NULL)
+
+/*
+ * _libcap_add_call appends a call to a psx_syscall_vec() sequence.
+ */
+static void _libcap_add_call(struct psx_call *calls, int *n, int flags,
+			     long int syscall_nr, long int arg1,
+			     long int arg2, long int arg3, long int arg4,
+			     long int arg5)
+{
+    struct psx_call *c = &calls[(*n)++];
+    c->syscall_nr = syscall_nr;
+    c->flags = flags;
+    c->arg[0] = arg1;
+    c->arg[1] = arg2;
+    c->arg[2] = arg3;
+    c->arg[3] = arg4;
+    c->arg[4] = arg5;
+    c->arg[5] = 0;
+}
+
 static int _libcap_capset(struct syscaller_s *sc,
 			  cap_user_header_t header, const cap_user_data_t data)
 {
@@ -307,7 +341,10 @@ int cap_set_ambient(cap_value_t cap, cap_flag_value_t set)
     return _cap_set_ambient(&multithread, cap, set);
 }
 
-static int _cap_reset_ambient(struct syscaller_s *sc)
+/*
+ * _cap_some_ambient returns 1 if any ambient capability is raised.
+ */
+static int _cap_some_ambient(void)
 {
     int olderrno = errno;
     cap_value_t c;
@@ -320,6 +357,14 @@ static int _cap_reset_ambient(struct syscaller_s *sc)
 	    return 0;
 	}
     }
+    return 1;
+}
+
+static int _cap_reset_ambient(struct syscaller_s *sc)
+{
+    if (!_cap_some_ambient()) {
+	return 0;
+    }
 
     return _libcap_wprctl6(sc, PR_CAP_AMBIENT,
 			   pr_arg(PR_CAP_AMBIENT_CLEAR_ALL),
@@ -402,6 +447,88 @@ int cap_prctlw(long int pr_cmd, long int arg1, long int arg2,
 
 static cap_value_t raise_cap_setpcap[] = {CAP_SETPCAP};
 
+/*
+ * _cap_set_mode_vec performs the whole of a (valid) cap_set_mode()
+ * transition with a single psx_syscall_vec() broadcast. Like
+ * _cap_set_mode(), it stops at the first failing step; in that case
+ * a second capset only drops the Effective flags (and the
+ * Inheritable ones, if the mode clears them and SETPCAP was raised).
+ */
+static int _cap_set_mode_vec(struct syscaller_s *sc, cap_t working,
+			     cap_mode_t flavor)
+{
+    int i, n = 0, ret;
+    unsigned secbits = CAP_SECURED_BITS_AMBIENT;
+    struct _cap_struct final = *working;
+    struct psx_call *calls = calloc(__CAP_MAXBITS + 5,
+				    sizeof(struct psx_call));
+    if (calls == NULL) {
+	errno = ENOMEM;
+	return -1;
+    }
+
+    (void) cap_set_flag(working, CAP_EFFECTIVE, 1, raise_cap_setpcap, CAP_SET);
+    _libcap_add_call(calls, &n, 0, SYS_capset, (long int) &working->head,
+		     (long int) &working->u[0].set, 0, 0, 0);
+
+    if (flavor == CAP_MODE_HYBRID) {
+	_libcap_add_call(calls, &n, 0, SYS_prctl, PR_SET_SECUREBITS, 0,
+			 0, 0, 0);
+    } else {
+	if (!CAP_AMBIENT_SUPPORTED()) {
+	    secbits = CAP_SECURED_BITS_BASIC;
+	} else if (_cap_some_ambient()) {
+	    _libcap_add_call(calls, &n, 0, SYS_prctl, PR_CAP_AMBIENT,
+			     pr_arg(PR_CAP_AMBIENT_CLEAR_ALL), 0, 0, 0);
+	}
+	_libcap_add_call(calls, &n, 0, SYS_prctl, PR_SET_SECUREBITS,
+			 secbits, 0, 0, 0);
+    }
+
+    for (i = 0; i < _LIBCAP_CAPABILITY_U32S; i++) {
+	final.u[i].flat[CAP_EFFECTIVE] = 0;
+	if (flavor != CAP_MODE_HYBRID && flavor != CAP_MODE_PURE1E) {
+	    final.u[i].flat[CAP_INHERITABLE] = 0;
+	}
+	if (flavor == CAP_MODE_NOPRIV) {
+	    final.u[i].flat[CAP_PERMITTED] = 0;
+	}
+    }
+
+    if (flavor == CAP_MODE_NOPRIV) {
+	cap_value_t c;
+	int v;
+	for (c = 0; (v = cap_get_bound(c)) >= 0; c++) {
+	    if (v) {
+		_libcap_add_call(calls, &n, PSX_CALL_OPTIONAL,
+				 SYS_prctl, PR_CAPBSET_DROP, pr_arg(c),
+				 0, 0, 0);
+	    }
+	}
+	/* for good measure */
+	_libcap_add_call(calls, &n, PSX_CALL_OPTIONAL,
+			 SYS_prctl, PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+    }
+
+    _libcap_add_call(calls, &n, 0, SYS_capset,
+		     (long int) &final.head, (long int) &final.u[0].set,
+		     0, 0, 0);
+
+    ret = sc->vec(calls, n);
+    if (ret) {
+	int olderrno = errno;
+	(void) cap_clear_flag(working, CAP_EFFECTIVE);
+	if (calls[0].retval != -1 &&
+	    flavor != CAP_MODE_HYBRID && flavor != CAP_MODE_PURE1E) {
+	    (void) cap_clear_flag(working, CAP_INHERITABLE);
+	}
+	(void) _cap_set_proc(sc, working);
+	errno = olderrno;
+    }
+    free(calls);
+    return ret;
+}
+
 static int _cap_set_mode(struct syscaller_s *sc, cap_mode_t flavor)
 {
     int ret;
@@ -413,6 +540,13 @@ static int _cap_set_mode(struct syscaller_s *sc, cap_mode_t flavor)
 	return -1;
     }
 
+    if (_libcap_vec_ok(sc) &&
+	flavor >= CAP_MODE_NOPRIV && flavor <= CAP_MODE_HYBRID) {
+	ret = _cap_set_mode_vec(sc, working, flavor);
+	(void) cap_free(working);
+	return ret;
+    }
+
     ret = cap_set_flag(working, CAP_EFFECTIVE, 1, raise_cap_setpcap, CAP_SET) |
 	_cap_set_proc(sc, working);
     if (ret == 0) {
@@ -602,6 +736,30 @@ static int _cap_setuid(struct syscaller_s *sc, uid_t uid)
 
     (void) cap_set_flag(working, CAP_EFFECTIVE,
 			1, raise_cap_setuid, CAP_SET);
+    if (_libcap_vec_ok(sc)) {
+	struct psx_call calls[5];
+	struct _cap_struct cleared = *working;
+	int i, n = 0;
+	for (i = 0; i < _LIBCAP_CAPABILITY_U32S; i++) {
+	    cleared.u[i].flat[CAP_EFFECTIVE] = 0;
+	}
+	_libcap_add_call(calls, &n, PSX_CALL_OPTIONAL, SYS_prctl,
+			 PR_SET_KEEPCAPS, 1, 0, 0, 0);
+	_libcap_add_call(calls, &n, 0, SYS_capset, (long int) &working->head,
+			 (long int) &working->u[0].set, 0, 0, 0);
+	_libcap_add_call(calls, &n, 0, sys_setuid_variant, (long int) uid,
+			 0, 0, 0, 0);
+	_libcap_add_call(calls, &n, PSX_CALL_ALWAYS | PSX_CALL_OPTIONAL,
+			 SYS_prctl, PR_SET_KEEPCAPS, 0, 0, 0, 0);
+	_libcap_add_call(calls, &n, PSX_CALL_ALWAYS | PSX_CALL_OPTIONAL,
+			 SYS_capset, (long int) &cleared.head,
+			 (long int) &cleared.u[0].set, 0, 0, 0);
+	int ret = sc->vec(calls, n);
+	int olderrno = errno;
+	(void) cap_free(working);
+	errno = olderrno;
+	return ret;
+    }
     /*
      * Note, we are cognizant of not using glibc's setuid in the case
      * that we've modified the way libcap is doing setting
@@ -654,6 +812,28 @@ static int _cap_setgroups(struct syscaller_s *sc,
 
     (void) cap_set_flag(working, CAP_EFFECTIVE,
 			1, raise_cap_setgid, CAP_SET);
+    if (_libcap_vec_ok(sc)) {
+	struct psx_call calls[4];
+	struct _cap_struct cleared = *working;
+	int i, n = 0;
+	for (i = 0; i < _LIBCAP_CAPABILITY_U32S; i++) {
+	    cleared.u[i].flat[CAP_EFFECTIVE] = 0;
+	}
+	_libcap_add_call(calls, &n, 0, SYS_capset, (long int) &working->head,
+			 (long int) &working->u[0].set, 0, 0, 0);
+	_libcap_add_call(calls, &n, 0, sys_setgid_variant, (long int) gid,
+			 0, 0, 0, 0);
+	_libcap_add_call(calls, &n, 0, sys_setgroups_variant,
+			 (long int) ngroups, (long int) groups, 0, 0, 0);
+	_libcap_add_call(calls, &n, PSX_CALL_ALWAYS | PSX_CALL_OPTIONAL,
+			 SYS_capset, (long int) &cleared.head,
+			 (long int) &cleared.u[0].set, 0, 0, 0);
+	int ret = sc->vec(calls, n);
+	int olderrno = errno;
+	(void) cap_free(working);
+	errno = olderrno;
+	return ret;
+    }
     /*
      * Note, we are cognizant of not using glibc's setgid etc in the
      * case that we've modified the way libcap is doing setting
@@ -744,6 +924,51 @@ cap_iab_t cap_iab_get_proc(void)
     return iab;
 }
 
+/*
+ * _cap_iab_set_proc_vec performs the syscalls of _cap_iab_set_proc()
+ * with a single psx_syscall_vec() broadcast. The working value
+ * holds the capabilities needed to apply the iab change, and temp
+ * those to restore once it is done.
+ */
+static int _cap_iab_set_proc_vec(struct syscaller_s *sc, cap_iab_t iab,
+				 cap_t working, cap_t temp, int check_bound)
+{
+    int n = 0, ret;
+    cap_value_t c;
+    struct psx_call *calls = calloc(2 * __CAP_MAXBITS + 3,
+				    sizeof(struct psx_call));
+    if (calls == NULL) {
+	errno = ENOMEM;
+	return -1;
+    }
+
+    _libcap_add_call(calls, &n, 0, SYS_capset, (long int) &working->head,
+		     (long int) &working->u[0].set, 0, 0, 0);
+    if (_cap_some_ambient()) {
+	_libcap_add_call(calls, &n, 0, SYS_prctl, PR_CAP_AMBIENT,
+			 pr_arg(PR_CAP_AMBIENT_CLEAR_ALL), 0, 0, 0);
+    }
+    for (c = cap_max_bits(); c-- != 0; ) {
+	unsigned offset = c >> 5;
+	__u32 mask = 1U << (c & 31);
+	if (iab->a[offset] & mask) {
+	    _libcap_add_call(calls, &n, 0, SYS_prctl, PR_CAP_AMBIENT,
+			     pr_arg(PR_CAP_AMBIENT_RAISE), pr_arg(c), 0, 0);
+	}
+	if (check_bound && (iab->nb[offset] & mask)) {
+	    _libcap_add_call(calls, &n, 0, SYS_prctl, PR_CAPBSET_DROP,
+			     pr_arg(c), 0, 0, 0);
+	}
+    }
+    _libcap_add_call(calls, &n, PSX_CALL_ALWAYS | PSX_CALL_OPTIONAL,
+		     SYS_capset, (long int) &temp->head,
+		     (long int) &temp->u[0].set, 0, 0, 0);
+
+    ret = sc->vec(calls, n);
+    free(calls);
+    return ret;
+}
+
 /*
  * _cap_iab_set_proc sets the iab collection using the requested
  * syscaller.  The iab value is locked by the caller. Note, if needed,
@@ -797,6 +1022,10 @@ static int _cap_iab_set_proc(struct syscaller_s *sc, cap_iab_t iab)
 	    goto defer;
 	}
     }
+    if (_libcap_vec_ok(sc)) {
+	ret = _cap_iab_set_proc_vec(sc, iab, working, temp, check_bound);
+	goto defer;
+    }
     if ((ret = _cap_set_proc(sc, working))) {
 	goto defer;
     }
@@ -968,6 +1197,26 @@ int cap_launcher_set_chroot(cap_launch_t attr, const char *chroot)
     return 0;
 }
 
+/*
+ * cap_launcher_set_vfork selects how cap_launch() creates the child
+ * process. By default, the child is a fork()ed copy of the caller. If
+ * vfork is non-zero, the child instead shares the memory of the
+ * caller, running on a stack of its own, and the calling thread is
+ * suspended until the child has exec'd or exited. This avoids copying
+ * the page tables of a large process for every launch.
+ */
+int cap_launcher_set_vfork(cap_launch_t attr, int vfork)
+{
+    if (!good_cap_launch_t(attr)) {
+	errno = EINVAL;
+	return -1;
+    }
+    _cap_mu_lock(&attr->mutex);
+    attr->vfork = !!vfork;
+    _cap_mu_unlock(&attr->mutex);
+    return 0;
+}
+
 static int _cap_chroot(struct syscaller_s *sc, const char *root)
 {
     const cap_value_t raise_cap_sys_chroot[] = {CAP_SYS_CHROOT};
@@ -1002,14 +1251,44 @@ static int _cap_chroot(struct syscaller_s *sc, const char *root)
     return ret;
 }
 
+/*
+ * _cap_launch_prepare moves the calling process to the security
+ * context described by attr. It is invoked in a launched child, once
+ * any callback has completed.
+ */
+static int _cap_launch_prepare(struct syscaller_s *sc, cap_launch_t attr)
+{
+    if (attr->change_uids && _cap_setuid(sc, attr->uid)) {
+	return -1;
+    }
+    if (attr->change_gids &&
+	_cap_setgroups(sc, attr->gid, attr->ngroups, attr->groups)) {
+	return -1;
+    }
+    if (attr->change_mode && _cap_set_mode(sc, attr->mode)) {
+	return -1;
+    }
+    if (attr->iab && _cap_iab_set_proc(sc, attr->iab)) {
+	return -1;
+    }
+    if (attr->chroot != NULL && _cap_chroot(sc, attr->chroot)) {
+	return -1;
+    }
+    return 0;
+}
+
 /*
  * _cap_launch is invoked in the forked child, it cannot return but is
  * required to exit, if the execve fails. It will write the errno
  * value for any failure over the filedescriptor, fd, and exit with
- * status 1.
+ * status 1. A child sharing the memory of its parent passes fd < 0,
+ * and instead stores the errno value in *shared_errno. Such a child
+ * must not run the atexit() handlers, or flush the stdio buffers, of
+ * its parent, so it uses _exit().
  */
 __attribute__ ((noreturn))
-static void _cap_launch(int fd, cap_launch_t attr, void *detail) {
+static void _cap_launch(int fd, int *shared_errno, cap_launch_t attr,
+			void *detail) {
     struct syscaller_s *sc = &singlethread;
     int my_errno;
 
@@ -1018,23 +1297,13 @@ static void _cap_launch(int fd, cap_launch_t attr, void *detail) {
     }
     if (attr->arg0 == NULL) {
 	/* handle the successful cap_func_launcher completion */
+	if (fd < 0) {
+	    _exit(0);
+	}
 	exit(0);
     }
 
-    if (attr->change_uids && _cap_setuid(sc, attr->uid)) {
-	goto defer;
-    }
-    if (attr->change_gids &&
-	_cap_setgroups(sc, attr->gid, attr->ngroups, attr->groups)) {
-	goto defer;
-    }
-    if (attr->change_mode && _cap_set_mode(sc, attr->mode)) {
-	goto defer;
-    }
-    if (attr->iab && _cap_iab_set_proc(sc, attr->iab)) {
-	goto defer;
-    }
-    if (attr->chroot != NULL && _cap_chroot(sc, attr->chroot)) {
+    if (_cap_launch_prepare(sc, attr)) {
 	goto defer;
     }
 
@@ -1054,6 +1323,10 @@ defer:
      * communicated to the parent
      */
     my_errno = errno;
+    if (fd < 0) {
+	*shared_errno = my_errno;
+	_exit(1);
+    }
     for (;;) {
 	int n = write(fd, &my_errno, sizeof(my_errno));
 	if (n < 0 && errno == EAGAIN) {
@@ -1065,26 +1338,164 @@ defer:
     exit(1);
 }
 
+/* the size of the stack used by a child sharing its parent's memory */
+#define _CAP_VFORK_STACK (1 << 20)
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+
 /*
- * cap_launch performs a wrapped fork+(callback and/or exec) that
- * works in both an unthreaded environment and also where libcap is
- * linked with psx+pthreads. The function supports dropping privilege
- * in the forked thread, but retaining privilege in the parent
- * thread(s).
- *
- * When applying the IAB vector inside the fork, since the ambient set
- * is fragile with respect to changes in I or P, the function
- * carefully orders setting of these inheritable characteristics, to
- * make sure they stick.
- *
- * This function will return an error of -1 setting errno if the
- * launch failed.
+ * _cap_pidfd_open obtains a pidfd for a child of this process.
  */
-pid_t cap_launch(cap_launch_t attr, void *detail) {
+static int _cap_pidfd_open(pid_t child)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, child, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * struct _cap_vfork_s is shared by cap_launch() and the child it
+ * starts with CLONE_VM|CLONE_VFORK.
+ */
+struct _cap_vfork_s {
+    cap_launch_t attr;
+    void *detail;
+    sigset_t mask;
+    int my_errno;
+};
+
+/*
+ * _cap_vfork_child is the entry point of a child sharing the memory
+ * of its parent. The parent's signal handlers would run on the wrong
+ * stack with the parent's data, so any that are installed are reset
+ * before the signals blocked by the parent are unblocked.
+ */
+static int _cap_vfork_child(void *arg)
+{
+    struct _cap_vfork_s *v = arg;
+    struct sigaction dfl;
+    int sig;
+
+    memset(&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    for (sig = 1; sig < _NSIG; sig++) {
+	struct sigaction old;
+	if (sigaction(sig, NULL, &old) == 0 &&
+	    old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN) {
+	    (void) sigaction(sig, &dfl, NULL);
+	}
+    }
+    (void) sigprocmask(SIG_SETMASK, &v->mask, NULL);
+    prctl(PR_SET_NAME, "cap-launcher", 0, 0, 0);
+    _cap_launch(-1, &v->my_errno, v->attr, v->detail);
+    /* no return from above function */
+}
+
+/*
+ * _cap_vfork_launch is the _cap_launch_fd() variant for a launcher
+ * configured with cap_launcher_set_vfork(). Since the parent only
+ * resumes once the child has exec'd or exited, the child reports any
+ * failure through shared memory rather than a pipe, and the kernel
+ * can provide a pidfd for the child without any race. It is called
+ * with attr locked, and unlocks it.
+ */
+static pid_t _cap_vfork_launch(cap_launch_t attr, void *detail,
+			       int *pidfd, int *done_fd)
+{
+    struct _cap_vfork_s v;
+    sigset_t all;
+    char *stack;
+    pid_t child;
+    int my_errno, ps[2];
+    int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+
+    if (done_fd != NULL && pipe2(ps, O_CLOEXEC | O_NONBLOCK) != 0) {
+	_cap_mu_unlock_return(&attr->mutex, -1);
+    }
+    stack = mmap(NULL, _CAP_VFORK_STACK, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+		 -1, 0);
+    if (stack == MAP_FAILED) {
+	my_errno = errno;
+	if (done_fd != NULL) {
+	    close(ps[0]);
+	    close(ps[1]);
+	}
+	errno = my_errno;
+	_cap_mu_unlock_return(&attr->mutex, -1);
+    }
+
+    v.attr = attr;
+    v.detail = detail;
+    v.my_errno = 0;
+    if (pidfd != NULL) {
+	flags |= CLONE_PIDFD;
+    }
+    sigfillset(&all);
+    (void) sigprocmask(SIG_BLOCK, &all, &v.mask);
+
+    child = clone(_cap_vfork_child, stack + _CAP_VFORK_STACK, flags, &v,
+		  pidfd);
+    my_errno = errno;
+
+    (void) sigprocmask(SIG_SETMASK, &v.mask, NULL);
+    (void) munmap(stack, _CAP_VFORK_STACK);
+    _cap_mu_unlock(&attr->mutex);
+
+    /* kernels before 5.2 ignore CLONE_PIDFD, leaving *pidfd as -1 */
+    if (child > 0 && pidfd != NULL && *pidfd < 0) {
+	int ignored;
+	kill(child, SIGKILL);
+	waitpid(child, &ignored, 0);
+	child = -1;
+	my_errno = ENOSYS;
+    }
+
+    if (done_fd != NULL) {
+	if (child > 0 && v.my_errno != 0) {
+	    (void) write(ps[1], &v.my_errno, sizeof(v.my_errno));
+	}
+	close(ps[1]);
+	if (child < 0) {
+	    close(ps[0]);
+	} else {
+	    *done_fd = ps[0];
+	}
+    } else if (child > 0 && v.my_errno != 0) {
+	int ignored;
+	if (pidfd != NULL) {
+	    close(*pidfd);
+	    *pidfd = -1;
+	}
+	waitpid(child, &ignored, 0);
+	child = -1;
+	my_errno = ECHILD;
+    }
+    errno = my_errno;
+    return child;
+}
+
+/*
+ * _cap_launch_fd implements the cap_launch() family. When pidfd is
+ * not NULL, a pidfd for the child is returned in *pidfd. When done_fd
+ * is not NULL, the function does not wait for the child to complete
+ * its setup, but returns in *done_fd the (non-blocking) read end of
+ * the pipe over which the child reports any setup failure.
+ */
+static pid_t _cap_launch_fd(cap_launch_t attr, void *detail,
+			    int *pidfd, int *done_fd) {
     int my_errno;
     int ps[2];
     pid_t child;
 
+    if (pidfd != NULL) {
+	*pidfd = -1;
+    }
     if (!good_cap_launch_t(attr)) {
 	errno = EINVAL;
 	return -1;
@@ -1098,6 +1509,10 @@ pid_t cap_launch(cap_launch_t attr, void *detail) {
 	_cap_mu_unlock_return(&attr->mutex, -1);
     }
 
+    if (attr->vfork) {
+	return _cap_vfork_launch(attr, detail, pidfd, done_fd);
+    }
+
     if (pipe2(ps, O_CLOEXEC) != 0) {
 	_cap_mu_unlock_return(&attr->mutex, -1);
     }
@@ -1108,7 +1523,7 @@ pid_t cap_launch(cap_launch_t attr, void *detail) {
     if (!child) {
 	close(ps[0]);
 	prctl(PR_SET_NAME, "cap-launcher", 0, 0, 0);
-	_cap_launch(ps[1], attr, detail);
+	_cap_launch(ps[1], NULL, attr, detail);
 	/* no return from above function */
     }
 
@@ -1119,6 +1534,26 @@ pid_t cap_launch(cap_launch_t attr, void *detail) {
 	goto defer;
     }
 
+    /*
+     * The child cannot be reaped, and its pid reused, until we wait
+     * for it, so this pidfd is sure to refer to it. The launch is
+     * abandoned if one is not available.
+     */
+    if (pidfd != NULL && (*pidfd = _cap_pidfd_open(child)) < 0) {
+	int ignored;
+	my_errno = errno;
+	kill(child, SIGKILL);
+	waitpid(child, &ignored, 0);
+	child = -1;
+	goto defer;
+    }
+
+    if (done_fd != NULL) {
+	(void) fcntl(ps[0], F_SETFL, O_NONBLOCK);
+	*done_fd = ps[0];
+	return child;
+    }
+
     /*
      * Extend this function's return codes to include setup failures
      * in the child.
@@ -1132,6 +1567,10 @@ pid_t cap_launch(cap_launch_t attr, void *detail) {
 	if (n < 0 && errno == EAGAIN) {
 	    continue;
 	}
+	if (pidfd != NULL) {
+	    close(*pidfd);
+	    *pidfd = -1;
+	}
 	waitpid(child, &ignored, 0);
 	child = -1;
 	my_errno = ECHILD;
@@ -1143,3 +1582,597 @@ defer:
     errno = my_errno;
     return child;
 }
+
+/*
+ * cap_launch performs a wrapped fork+(callback and/or exec) that
+ * works in both an unthreaded environment and also where libcap is
+ * linked with psx+pthreads. The function supports dropping privilege
+ * in the forked thread, but retaining privilege in the parent
+ * thread(s).
+ *
+ * When applying the IAB vector inside the fork, since the ambient set
+ * is fragile with respect to changes in I or P, the function
+ * carefully orders setting of these inheritable characteristics, to
+ * make sure they stick.
+ *
+ * This function will return an error of -1 setting errno if the
+ * launch failed.
+ */
+pid_t cap_launch(cap_launch_t attr, void *detail) {
+    return _cap_launch_fd(attr, detail, NULL, NULL);
+}
+
+/*
+ * cap_launch_pidfd is cap_launch() that also returns, in *pidfd, a
+ * pidfd referring to the launched child. The caller should close()
+ * it. On failure, *pidfd is set to -1.
+ */
+pid_t cap_launch_pidfd(cap_launch_t attr, void *detail, int *pidfd) {
+    if (pidfd == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    return _cap_launch_fd(attr, detail, pidfd, NULL);
+}
+
+/*
+ * cap_launch_async starts a launch without waiting for the child to
+ * complete its setup. It returns a non-blocking file descriptor that
+ * becomes readable once the child has exec'd, or failed, and should
+ * be passed to cap_launch_result() to learn which. The pid of the
+ * child is returned in *pid and, if pidfd is not NULL, a pidfd for it
+ * in *pidfd. The caller is responsible for reaping the child, even
+ * when it reports a failure. On error, -1 is returned.
+ */
+int cap_launch_async(cap_launch_t attr, void *detail, pid_t *pid, int *pidfd)
+{
+    int done_fd = -1;
+    pid_t child;
+
+    if (pid == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    child = _cap_launch_fd(attr, detail, pidfd, &done_fd);
+    if (child < 0) {
+	return -1;
+    }
+    *pid = child;
+    return done_fd;
+}
+
+/*
+ * cap_launch_result collects the outcome of a cap_launch_async()
+ * launch from its file descriptor, fd. It returns 0 if the child
+ * exec'd (or, for a cap_func_launcher(), completed its callback), and
+ * -1 with errno set to the child's setup error if it failed. In both
+ * cases fd is closed. If the child has yet to reach either outcome,
+ * -1 is returned with errno set to EAGAIN, and fd remains open.
+ */
+int cap_launch_result(int fd)
+{
+    int my_errno, n;
+
+    do {
+	n = read(fd, &my_errno, sizeof(my_errno));
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+	return -1;
+    }
+    close(fd);
+    if (n == 0) {
+	return 0;
+    }
+    if (n != sizeof(my_errno)) {
+	my_errno = EIO;
+    }
+    errno = my_errno;
+    return -1;
+}
+
+/*
+ * The zygote protocol. A launch request is a single message of at
+ * most _CAP_ZYGOTE_MAX bytes: a struct _cap_zygote_req followed by
+ * the NUL terminated arg0, argv and envp strings. It carries, as
+ * SCM_RIGHTS, the write end of a close-on-exec pipe over which the
+ * launched child reports any execve() failure. The zygote forwards
+ * the request to an idle pool child, and answers with a struct
+ * _cap_zygote_reply. When the launching process shuts down its end
+ * of the socket, the zygote stops its idle children and sends one
+ * last message listing their pids, for the launching process to reap.
+ */
+#define _CAP_ZYGOTE_MAX (64 << 10)
+#define _CAP_ZYGOTE_NO_ENV 0xffffffffU
+
+struct _cap_zygote_req {
+    __u32 argc;
+    __u32 envc;
+};
+
+struct _cap_zygote_reply {
+    pid_t pid;
+    int err;
+    pid_t reap;
+};
+
+/*
+ * struct _cap_zygote_kid records a pool child, and the zygote's end
+ * of the socket it waits on. state is -1 until the child reports it
+ * has (0) or has not (an errno value) assumed its security context.
+ */
+struct _cap_zygote_kid {
+    pid_t pid;
+    int fd;
+    int state;
+};
+
+struct _cap_zygote_s {
+    cap_launch_t attr;
+    int ctl;
+    int pool;
+    struct _cap_zygote_kid *kids;
+    int fd;
+};
+
+/*
+ * _cap_zygote_send sends a message, with an optional file descriptor.
+ */
+static int _cap_zygote_send(int sock, void *buf, size_t len, int fd)
+{
+    union {
+	struct cmsghdr h;
+	char buf[CMSG_SPACE(sizeof(int))];
+    } u;
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (fd >= 0) {
+	memset(&u, 0, sizeof(u));
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    ssize_t n;
+    do {
+	n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * _cap_zygote_recv receives a message of up to len bytes, and any
+ * file descriptor that accompanies it into *fd (else -1).
+ */
+static ssize_t _cap_zygote_recv(int sock, void *buf, size_t len, int *fd)
+{
+    union {
+	struct cmsghdr h;
+	char buf[CMSG_SPACE(sizeof(int))];
+    } u;
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    struct msghdr msg = {
+	.msg_iov = &iov, .msg_iovlen = 1,
+	.msg_control = u.buf, .msg_controllen = sizeof(u.buf)
+    };
+    ssize_t n;
+
+    *fd = -1;
+    do {
+	n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n >= 0) {
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	if (c != NULL && c->cmsg_level == SOL_SOCKET &&
+	    c->cmsg_type == SCM_RIGHTS) {
+	    memcpy(fd, CMSG_DATA(c), sizeof(int));
+	}
+    }
+    return n;
+}
+
+/*
+ * _cap_zygote_child is the body of a pool child. It assumes the
+ * security context of the launcher, reports success to the zygote,
+ * and then waits for a program to exec. Any callback is invoked with
+ * a NULL detail argument, since there is no launch yet.
+ */
+static int _cap_zygote_child(void *arg)
+{
+    struct _cap_zygote_s *zs = arg;
+    cap_launch_t attr = zs->attr;
+    char *buf, *p, *end;
+    const char **args;
+    int i, fd = zs->fd, status_fd, my_errno = 0;
+    ssize_t n;
+
+    close(zs->ctl);
+    for (i = 0; i < zs->pool; i++) {
+	if (zs->kids[i].fd >= 0) {
+	    close(zs->kids[i].fd);
+	}
+    }
+    prctl(PR_SET_NAME, "cap-launcher", 0, 0, 0);
+
+    if ((attr->custom_setup_fn && attr->custom_setup_fn(NULL)) ||
+	_cap_launch_prepare(&singlethread, attr)) {
+	my_errno = errno ? errno : ECHILD;
+    }
+    if (send(fd, &my_errno, sizeof(my_errno), MSG_NOSIGNAL) < 0 || my_errno) {
+	_exit(1);
+    }
+
+    buf = malloc(_CAP_ZYGOTE_MAX);
+    if (buf == NULL) {
+	_exit(1);
+    }
+    n = _cap_zygote_recv(fd, buf, _CAP_ZYGOTE_MAX, &status_fd);
+    if (n <= 0) {
+	/* the zygote is shutting down */
+	_exit(0);
+    }
+    close(fd);
+
+    struct _cap_zygote_req req;
+    memcpy(&req, buf, sizeof(req));
+    args = calloc(req.argc + 1 + (req.envc == _CAP_ZYGOTE_NO_ENV ?
+				  0 : req.envc + 1) + 1, sizeof(char *));
+    if (args == NULL) {
+	goto defer;
+    }
+    p = buf + sizeof(req);
+    end = buf + n;
+    /* args[0] is arg0, then argv..., NULL, then envp..., NULL */
+    for (i = 0; i < (int) (req.argc + 1 + (req.envc == _CAP_ZYGOTE_NO_ENV ?
+					  0 : req.envc + 1)); i++) {
+	if (i == (int) req.argc + 1) {
+	    continue;
+	}
+	if (p >= end) {
+	    errno = EINVAL;
+	    goto defer;
+	}
+	args[i] = p;
+	p += strnlen(p, end - p) + 1;
+    }
+    const void *temp_args = args + 1;
+    const void *temp_envp = req.envc == _CAP_ZYGOTE_NO_ENV ? NULL :
+	args + req.argc + 2;
+    execve(args[0], temp_args, temp_envp);
+
+defer:
+    my_errno = errno;
+    if (status_fd >= 0) {
+	(void) write(status_fd, &my_errno, sizeof(my_errno));
+    }
+    _exit(1);
+}
+
+/*
+ * _cap_zygote_spawn replaces pool child k. The child is cloned with
+ * CLONE_PARENT, making it a child of the launching process (which
+ * can then wait for it) and not of the zygote.
+ */
+static void _cap_zygote_spawn(struct _cap_zygote_s *zs, int k, char *stack)
+{
+    struct _cap_zygote_kid *kid = &zs->kids[k];
+    int sv[2];
+
+    kid->pid = -1;
+    kid->fd = -1;
+    kid->state = -1;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+	kid->state = errno;
+	return;
+    }
+    /* the child closes all of the zygote's ends, including its own */
+    kid->fd = sv[0];
+    zs->fd = sv[1];
+    kid->pid = clone(_cap_zygote_child, stack + _CAP_VFORK_STACK,
+		     CLONE_PARENT | SIGCHLD, zs);
+    if (kid->pid < 0) {
+	kid->state = errno;
+	kid->fd = -1;
+	close(sv[0]);
+    }
+    close(sv[1]);
+}
+
+/*
+ * _cap_zygote_ready waits for pool child k to report whether it is
+ * ready to exec a program, returning 0 if it is.
+ */
+static int _cap_zygote_ready(struct _cap_zygote_kid *kid)
+{
+    if (kid->state == -1) {
+	int status;
+	ssize_t n;
+	do {
+	    n = recv(kid->fd, &status, sizeof(status), 0);
+	} while (n < 0 && errno == EINTR);
+	kid->state = n == sizeof(status) ? status : ECHILD;
+    }
+    return kid->state;
+}
+
+/*
+ * _cap_zygote_close_fds closes every file descriptor of the zygote
+ * other than 0, 1, 2 and keep, so its pool children, and the
+ * programs they launch, do not hold on to whatever the caller had
+ * open when the zygote was started.
+ */
+static void _cap_zygote_close_fds(int keep)
+{
+    struct rlimit lim;
+    int fd, max;
+
+#ifdef SYS_close_range
+    if ((keep <= 3 || syscall(SYS_close_range, 3, keep - 1, 0) == 0) &&
+	syscall(SYS_close_range, keep < 3 ? 3 : keep + 1, ~0U, 0) == 0) {
+	return;
+    }
+#endif
+    max = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY) {
+	max = lim.rlim_cur;
+    }
+    for (fd = 3; fd < max; fd++) {
+	if (fd != keep) {
+	    (void) close(fd);
+	}
+    }
+}
+
+/*
+ * _cap_zygote_main is the body of the zygote process. It never
+ * returns.
+ */
+__attribute__ ((noreturn))
+static void _cap_zygote_main(int ctl, cap_launch_t attr, int pool)
+{
+    struct _cap_zygote_s zs = { .attr = attr, .ctl = ctl, .pool = pool };
+    struct _cap_zygote_reply reply;
+    char *buf, *stack;
+    int i, ok, next = 0;
+
+    prctl(PR_SET_NAME, "cap-zygote", 0, 0, 0);
+    _cap_zygote_close_fds(ctl);
+    buf = malloc(_CAP_ZYGOTE_MAX);
+    zs.kids = calloc(pool, sizeof(*zs.kids));
+    stack = mmap(NULL, _CAP_VFORK_STACK, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+		 -1, 0);
+    memset(&reply, 0, sizeof(reply));
+    if (buf == NULL || zs.kids == NULL || stack == MAP_FAILED) {
+	reply.pid = -1;
+	reply.err = ENOMEM;
+	(void) send(ctl, &reply, sizeof(reply), MSG_NOSIGNAL);
+	_exit(1);
+    }
+    for (i = 0; i < pool; i++) {
+	zs.kids[i].fd = -1;
+    }
+    for (i = 0; i < pool; i++) {
+	_cap_zygote_spawn(&zs, i, stack);
+    }
+
+    /* confirm that the security context can be assumed at all */
+    reply.err = _cap_zygote_ready(&zs.kids[0]);
+    reply.pid = reply.err ? -1 : 0;
+    ok = send(ctl, &reply, sizeof(reply), MSG_NOSIGNAL) == sizeof(reply) &&
+	reply.err == 0;
+
+    while (ok) {
+	struct _cap_zygote_kid *kid = &zs.kids[next];
+	int status_fd;
+	ssize_t n = _cap_zygote_recv(ctl, buf, _CAP_ZYGOTE_MAX, &status_fd);
+	if (n <= 0) {
+	    break;
+	}
+	memset(&reply, 0, sizeof(reply));
+	reply.err = _cap_zygote_ready(kid);
+	if (reply.err == 0 &&
+	    _cap_zygote_send(kid->fd, buf, n, status_fd) != 0) {
+	    reply.err = errno;
+	}
+	if (reply.err == 0) {
+	    reply.pid = kid->pid;
+	} else {
+	    reply.pid = -1;
+	    reply.reap = kid->pid;
+	}
+	if (status_fd >= 0) {
+	    close(status_fd);
+	}
+	if (kid->fd >= 0) {
+	    close(kid->fd);
+	}
+	_cap_zygote_spawn(&zs, next, stack);
+	next = (next + 1) % pool;
+	ok = send(ctl, &reply, sizeof(reply), MSG_NOSIGNAL) == sizeof(reply);
+    }
+
+    /* idle children exit when their socket is closed */
+    pid_t *pids = (pid_t *) buf;
+    int npids = 0;
+    for (i = 0; i < pool; i++) {
+	if (zs.kids[i].fd >= 0) {
+	    close(zs.kids[i].fd);
+	}
+	if (zs.kids[i].pid > 0) {
+	    pids[npids++] = zs.kids[i].pid;
+	}
+    }
+    (void) send(ctl, pids, npids * sizeof(pid_t), MSG_NOSIGNAL);
+    _exit(0);
+}
+
+/*
+ * _cap_zygote_start forks the zygote process for z, and confirms
+ * its pool children can assume the security context of attr.
+ */
+int _cap_zygote_start(struct cap_zygote_s *z, cap_launch_t attr, int pool)
+{
+    struct _cap_zygote_reply reply;
+    int sv[2];
+    ssize_t n;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+	return -1;
+    }
+    _cap_mu_lock(&attr->mutex);
+    z->pid = fork();
+    if (z->pid == 0) {
+	close(sv[0]);
+	_cap_zygote_main(sv[1], attr, pool);
+	/* no return from above function */
+    }
+    _cap_mu_unlock(&attr->mutex);
+    close(sv[1]);
+    z->fd = sv[0];
+    z->pool = pool;
+    if (z->pid < 0) {
+	close(sv[0]);
+	return -1;
+    }
+
+    do {
+	n = recv(z->fd, &reply, sizeof(reply), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n == sizeof(reply) && reply.err == 0) {
+	return 0;
+    }
+    _cap_zygote_stop(z);
+    errno = n == sizeof(reply) ? reply.err : ECHILD;
+    return -1;
+}
+
+/*
+ * _cap_zygote_stop shuts down the zygote of z, reaping it and any
+ * idle pool children. It preserves errno.
+ */
+void _cap_zygote_stop(struct cap_zygote_s *z)
+{
+    int olderrno = errno, ignored, i;
+    pid_t *pids;
+    ssize_t n;
+
+    if (z->pid <= 0) {
+	return;
+    }
+    shutdown(z->fd, SHUT_WR);
+    pids = calloc(z->pool, sizeof(pid_t));
+    do {
+	n = pids == NULL ? -1 : recv(z->fd, pids, z->pool * sizeof(pid_t), 0);
+    } while (n < 0 && errno == EINTR);
+    for (i = 0; i < n / (ssize_t) sizeof(pid_t); i++) {
+	waitpid(pids[i], &ignored, 0);
+    }
+    free(pids);
+    waitpid(z->pid, &ignored, 0);
+    close(z->fd);
+    z->pid = -1;
+    z->fd = -1;
+    errno = olderrno;
+}
+
+/*
+ * cap_zygote_launch execs a program in one of the prepared children
+ * of the zygote z. Like cap_launch(), it returns the pid of the
+ * launched child, which the caller should wait for. If the program
+ * cannot be exec'd, the child is reaped and -1 is returned with errno
+ * set to the reason.
+ */
+pid_t cap_zygote_launch(cap_zygote_t z, const char *arg0,
+			const char * const *argv, const char * const *envp)
+{
+    struct _cap_zygote_req req;
+    struct _cap_zygote_reply reply;
+    size_t len = sizeof(req) + strlen(arg0 ? arg0 : "") + 1;
+    int i, ps[2], my_errno, ignored;
+    char *buf, *p;
+    ssize_t n;
+
+    if (!good_cap_zygote_t(z) || arg0 == NULL || argv == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    for (i = 0; argv[i] != NULL; i++) {
+	len += strlen(argv[i]) + 1;
+    }
+    req.argc = i;
+    req.envc = _CAP_ZYGOTE_NO_ENV;
+    if (envp != NULL) {
+	for (i = 0; envp[i] != NULL; i++) {
+	    len += strlen(envp[i]) + 1;
+	}
+	req.envc = i;
+    }
+    if (len > _CAP_ZYGOTE_MAX) {
+	errno = E2BIG;
+	return -1;
+    }
+    if ((buf = malloc(len)) == NULL) {
+	return -1;
+    }
+    memcpy(buf, &req, sizeof(req));
+    p = buf + sizeof(req);
+    p = stpcpy(p, arg0) + 1;
+    for (i = 0; argv[i] != NULL; i++) {
+	p = stpcpy(p, argv[i]) + 1;
+    }
+    for (i = 0; envp != NULL && envp[i] != NULL; i++) {
+	p = stpcpy(p, envp[i]) + 1;
+    }
+
+    if (pipe2(ps, O_CLOEXEC) != 0) {
+	my_errno = errno;
+	free(buf);
+	errno = my_errno;
+	return -1;
+    }
+    _cap_mu_lock(&z->mutex);
+    if (_cap_zygote_send(z->fd, buf, len, ps[1]) != 0) {
+	n = -1;
+    } else {
+	do {
+	    n = recv(z->fd, &reply, sizeof(reply), 0);
+	} while (n < 0 && errno == EINTR);
+    }
+    my_errno = errno;
+    _cap_mu_unlock(&z->mutex);
+    free(buf);
+    close(ps[1]);
+
+    if (n != sizeof(reply)) {
+	close(ps[0]);
+	errno = n < 0 ? my_errno : ECHILD;
+	return -1;
+    }
+    if (reply.reap > 0) {
+	waitpid(reply.reap, &ignored, 0);
+    }
+    if (reply.pid < 0) {
+	close(ps[0]);
+	errno = reply.err;
+	return -1;
+    }
+
+    /* the pipe closes without data when the exec succeeds */
+    do {
+	n = read(ps[0], &my_errno, sizeof(my_errno));
+    } while (n < 0 && errno == EINTR);
+    close(ps[0]);
+    if (n == 0) {
+	return reply.pid;
+    }
+    waitpid(reply.pid, &ignored, 0);
+    errno = n == sizeof(my_errno) ? my_errno : ECHILD;
+    return -1;
+}
@@ -20,3 +20,16 @@ void psx_load_syscalls(long int (**syscall_fn)(long int,
 {
     _libcap_overrode_syscalls = 0;
 }
+
+/*
+ * psx_load_syscall_vec() is weakly defined for the same reason. When
+ * libpsx is not linked (or predates psx_syscall_vec()), libcap
+ * performs its multi-step state changes one syscall at a time.
+ */
+
+__attribute__((weak))
+void psx_load_syscall_vec(int (**syscall_vec_fn)(struct psx_call *calls,
+						 int n))
+{
+    *syscall_vec_fn = NULL;
+}
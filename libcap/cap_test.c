@@ -1,8 +1,25 @@
 #define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "libcap.h"
 
+/*
+ * capget is interposed here to count the kernel queries libcap makes.
+ */
+static int capget_calls;
+
+int capget(cap_user_header_t header, cap_user_data_t data)
+{
+    capget_calls++;
+    return syscall(SYS_capget, header, data);
+}
+
 static cap_value_t top;
 
 static int cf(cap_value_t x)
@@ -254,6 +271,498 @@ drop_c:
     return retval;
 }
 
+static int test_names(void)
+{
+    static const char *bad[] = {
+	"cap_chow", "cap_chown2", "cap_chownx", "cap_", "zzz", "", NULL
+    };
+    cap_value_t c, v, max = cap_max_bits();
+    int i, failed = 0;
+
+    if (max > __CAP_BITS) {
+	max = __CAP_BITS;
+    }
+    for (c = 0; c < max; c++) {
+	char *name = cap_to_name(c);
+	if (name == NULL || cap_from_name(name, &v) || v != c) {
+	    printf("name of %d (%s) did not map back\n", c, name);
+	    failed = -1;
+	}
+	for (i = 0; name[i]; i++) {
+	    name[i] = toupper((unsigned char) name[i]);
+	}
+	if (cap_from_name(name, &v) || v != c) {
+	    printf("name %s did not map back to %d\n", name, c);
+	    failed = -1;
+	}
+	cap_free(name);
+    }
+    for (i = 0; bad[i]; i++) {
+	if (cap_from_name(bad[i], &v) == 0) {
+	    printf("bad name %s mapped to %d\n", bad[i], v);
+	    failed = -1;
+	}
+    }
+    for (c = 0; c < __CAP_MAXBITS; c++) {
+	const char *fixed = cap_name_static(c);
+	char *name = cap_to_name(c);
+	if (fixed == NULL || name == NULL || strcmp(fixed, name) ||
+	    fixed != cap_name_static(c)) {
+	    printf("static name of %d (%s) differs from %s\n", c, fixed, name);
+	    failed = -1;
+	}
+	cap_free(name);
+    }
+    if (cap_name_static(-1) != NULL || cap_name_static(__CAP_MAXBITS) != NULL) {
+	printf("cap_name_static named an invalid capability\n");
+	failed = -1;
+    }
+    errno = 0;
+    char *name = cap_to_name(__CAP_MAXBITS);
+    if (name == NULL || errno != 0) {
+	printf("cap_to_name(%d) gave %s, errno=%d\n", __CAP_MAXBITS, name, errno);
+	failed = -1;
+    }
+    cap_free(name);
+    return failed;
+}
+
+static int test_text_r(void)
+{
+    static const char *sets[] = {
+	"=", "=ep", "cap_chown=ep cap_setuid+i", "all=p cap_kill-p", NULL
+    };
+    char buf[1024];
+    int i, failed = 0;
+
+    for (i = 0; sets[i]; i++) {
+	cap_t c = cap_from_text(sets[i]);
+	ssize_t want, got;
+	char *text = cap_to_text(c, &want);
+	got = cap_to_text_r(c, buf, sizeof(buf));
+	if (got != want || strcmp(text, buf)) {
+	    printf("cap_to_text_r(%s) gave %zd:\"%s\" not %zd:\"%s\"\n",
+		   sets[i], got, buf, want, text);
+	    failed = -1;
+	}
+	got = cap_to_text_r(c, buf, want);
+	if (got != want || buf[0] != '\0') {
+	    printf("cap_to_text_r(%s) too short gave %zd:\"%s\"\n",
+		   sets[i], got, buf);
+	    failed = -1;
+	}
+	cap_free(text);
+	cap_free(c);
+    }
+
+    cap_iab_t iab = cap_iab_from_text("!cap_chown,^cap_setuid,%cap_kill");
+    char *text = cap_iab_to_text(iab);
+    ssize_t got = cap_iab_to_text_r(iab, buf, sizeof(buf));
+    if (got != (ssize_t) strlen(text) || strcmp(text, buf) ||
+	cap_iab_to_text_r(iab, NULL, 0) != got ||
+	cap_iab_to_text_r(NULL, buf, sizeof(buf)) != -1) {
+	printf("cap_iab_to_text_r gave %zd:\"%s\" not \"%s\"\n",
+	       got, buf, text);
+	failed = -1;
+    }
+    cap_free(text);
+    cap_free(iab);
+
+    return failed;
+}
+
+static int test_pool(void)
+{
+    cap_pool_t pool = cap_new_pool();
+    cap_value_t v[1] = { CAP_KILL };
+    cap_flag_value_t f;
+    int failed = 0;
+
+    if (pool == NULL) {
+	printf("failed to allocate a pool\n");
+	return -1;
+    }
+    cap_t a = cap_pool_init_set(pool);
+    cap_set_flag(a, CAP_EFFECTIVE, 1, v, CAP_SET);
+    if (cap_pool_release(pool, a)) {
+	printf("failed to release a set to the pool\n");
+	failed = -1;
+    }
+    cap_t b = cap_pool_init_set(pool);
+    if (b != a) {
+	printf("pool did not recycle the set memory\n");
+	failed = -1;
+    }
+    if (cap_get_flag(b, CAP_KILL, CAP_EFFECTIVE, &f) || f != CAP_CLEAR) {
+	printf("recycled set was not scrubbed\n");
+	failed = -1;
+    }
+    cap_t c = cap_init();
+    if (cap_compare(b, c)) {
+	printf("recycled set differs from a fresh one\n");
+	failed = -1;
+    }
+    cap_free(c);
+    if (cap_pool_release(pool, b)) {
+	failed = -1;
+    }
+
+    cap_iab_t iab = cap_pool_init_iab(pool);
+    if ((void *) iab != (void *) a ||
+	cap_iab_set_vector(iab, CAP_IAB_AMB, CAP_KILL, CAP_SET) ||
+	cap_pool_release(pool, iab)) {
+	printf("pool did not recycle an iab\n");
+	failed = -1;
+    }
+    c = cap_pool_init_set(pool);
+    char *text = cap_to_text(c, NULL);
+    if (cap_pool_release(pool, text) || cap_pool_release(pool, c)) {
+	printf("pool did not cap_free() a string\n");
+	failed = -1;
+    }
+    cap_t held[_LIBCAP_POOL_MAX_IDLE + 1];
+    int i;
+    for (i = 0; i <= _LIBCAP_POOL_MAX_IDLE; i++) {
+	held[i] = cap_init();
+    }
+    for (i = 0; i <= _LIBCAP_POOL_MAX_IDLE; i++) {
+	if (cap_pool_release(pool, held[i])) {
+	    failed = -1;
+	}
+    }
+    if (pool->count != _LIBCAP_POOL_MAX_IDLE) {
+	printf("pool holds %u idle objects, want at most %d\n",
+	       pool->count, _LIBCAP_POOL_MAX_IDLE);
+	failed = -1;
+    }
+    if (cap_pool_release(NULL, c) != -1 ||
+	cap_pool_init_set(NULL) != NULL) {
+	printf("pool accepted a bad argument\n");
+	failed = -1;
+    }
+    if (cap_free(pool)) {
+	printf("failed to free the pool\n");
+	failed = -1;
+    }
+    return failed;
+}
+
+static int test_cached_version(void)
+{
+    int i, before = capget_calls, failed = 0;
+    char ext[256];
+
+    for (i = 0; i < 100; i++) {
+	cap_t a = cap_from_text("cap_chown,cap_kill=ep cap_setuid+i");
+	cap_t b = cap_dup(a);
+	cap_copy_ext(ext, b, sizeof(ext));
+	cap_t c = cap_copy_int(ext);
+	if (a == NULL || b == NULL || c == NULL || cap_compare(a, c)) {
+	    printf("failed to generate sets\n");
+	    failed = -1;
+	}
+	cap_free(a);
+	cap_free(b);
+	cap_free(c);
+    }
+    if (capget_calls != before) {
+	printf("expected no capget() calls, got %d\n", capget_calls - before);
+	failed = -1;
+    }
+
+    /* confirm the counter works */
+    cap_free(cap_get_proc());
+    if (capget_calls != before + 1) {
+	printf("capget() counter did not count cap_get_proc()\n");
+	failed = -1;
+    }
+    return failed;
+}
+
+struct scan_counts {
+    int files, capped, dirs, links, other;
+    cap_t want;
+};
+
+static int count_entry(int dirfd, const char *name, int type, cap_t caps,
+		       void *data)
+{
+    struct scan_counts *c = data;
+
+    switch (type) {
+    case DT_REG:
+	c->files++;
+	if (caps != NULL) {
+	    c->capped++;
+	    if (strcmp(name, "capped") || cap_compare(caps, c->want)) {
+		printf("unexpected capabilities on %s\n", name);
+		c->other++;
+	    }
+	}
+	break;
+    case DT_DIR:
+	c->dirs++;
+	break;
+    case DT_LNK:
+	c->links++;
+	break;
+    default:
+	c->other++;
+    }
+    if (type != DT_REG && caps != NULL) {
+	printf("non-regular file %s was examined\n", name);
+	c->other++;
+    }
+    return 0;
+}
+
+static int test_fileat(void)
+{
+    char dir[] = "/tmp/cap_test.XXXXXX";
+    struct scan_counts c;
+    int dirfd, failed = 0, fd, capped;
+    cap_t want, reuse, got;
+
+    if (mkdtemp(dir) == NULL) {
+	perror("unable to make a temporary directory");
+	return -1;
+    }
+    dirfd = open(dir, O_RDONLY|O_DIRECTORY);
+    if (dirfd < 0 || mkdirat(dirfd, "sub", 0700) ||
+	symlinkat("capped", dirfd, "link")) {
+	perror("unable to populate the temporary directory");
+	return -1;
+    }
+    fd = openat(dirfd, "plain", O_CREAT|O_WRONLY, 0600);
+    close(fd);
+    fd = openat(dirfd, "capped", O_CREAT|O_WRONLY, 0700);
+    want = cap_from_text("cap_chown,cap_kill=p cap_setuid=i");
+    /* Only a privileged caller can set file capabilities. */
+    capped = (cap_set_fd(fd, want) == 0);
+    close(fd);
+
+    reuse = cap_from_text("all=eip");
+    got = cap_get_fileat(dirfd, "capped", reuse, AT_SYMLINK_NOFOLLOW);
+    if (capped && (got != reuse || cap_compare(got, want))) {
+	printf("cap_get_fileat failed to read capped file\n");
+	failed = -1;
+    }
+    if (!capped && (got != NULL || errno != ENODATA)) {
+	printf("cap_get_fileat found capabilities on a plain file\n");
+	failed = -1;
+    }
+    got = cap_get_fileat(dirfd, "link", NULL, 0);
+    if (capped && (got == NULL || cap_compare(got, want))) {
+	printf("cap_get_fileat failed to follow a symlink\n");
+	failed = -1;
+    }
+    cap_free(got);
+    if (cap_get_fileat(dirfd, "link", reuse, AT_SYMLINK_NOFOLLOW) != NULL ||
+	cap_get_fileat(dirfd, "plain", reuse, 0) != NULL) {
+	printf("cap_get_fileat found capabilities where there are none\n");
+	failed = -1;
+    }
+    if (cap_get_fileat(dirfd, "plain", NULL, -1) != NULL || errno != EINVAL ||
+	cap_get_fileat(dirfd, "plain", (cap_t) dir, 0) != NULL ||
+	errno != EINVAL) {
+	printf("cap_get_fileat accepted bad arguments\n");
+	failed = -1;
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.want = want;
+    if (cap_scan_dir(dirfd, count_entry, &c) || c.files != 2 ||
+	c.capped != capped || c.dirs != 1 || c.links != 1 || c.other) {
+	printf("cap_scan_dir found files=%d capped=%d dirs=%d links=%d"
+	       " other=%d\n", c.files, c.capped, c.dirs, c.links, c.other);
+	failed = -1;
+    }
+    printf("cap_scan_dir %s capabilities\n",
+	   capped ? "found the" : "had no privilege to set");
+
+    cap_free(reuse);
+    cap_free(want);
+    unlinkat(dirfd, "plain", 0);
+    unlinkat(dirfd, "capped", 0);
+    unlinkat(dirfd, "link", 0);
+    unlinkat(dirfd, "sub", AT_REMOVEDIR);
+    close(dirfd);
+    rmdir(dir);
+    return failed;
+}
+
+/*
+ * test_fcaps checks cap_fcaps_decode() and cap_fcaps_encode() against
+ * known security.capability values of each revision.
+ */
+static int test_fcaps(void)
+{
+    static const struct {
+	unsigned char raw[24];
+	size_t len;
+	struct cap_fcaps f;
+    } vectors[] = {
+	{ { 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00,
+	    0x20, 0x00, 0x00, 0x00 }, 12,
+	  { 0x01000000, 0, 0, { 0x1, 0 }, { 0x20, 0 } } },
+	{ { 0x01, 0x00, 0x00, 0x02, 0x00, 0x04, 0x00, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+	    0x02, 0x00, 0x00, 0x00 }, 20,
+	  { 0x02000000, 1, 0, { 0x400, 0x1 }, { 0, 0x2 } } },
+	{ { 0x00, 0x00, 0x00, 0x03, 0x80, 0x00, 0x00, 0x00,
+	    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+	    0x00, 0x00, 0x00, 0x00, 0xe8, 0x03, 0x00, 0x00 }, 24,
+	  { 0x03000000, 0, 1000, { 0x80, 0x80000000 }, { 0, 0 } } },
+    };
+    unsigned char out[24];
+    struct cap_fcaps f;
+    int i, failed = 0;
+    ssize_t n;
+
+    for (i = 0; i < (int) (sizeof(vectors)/sizeof(vectors[0])); i++) {
+	if (cap_fcaps_decode(vectors[i].raw, vectors[i].len, &f) ||
+	    memcmp(&f, &vectors[i].f, sizeof(f))) {
+	    printf("cap_fcaps_decode failed on revision %d\n", i+1);
+	    failed = -1;
+	}
+	n = cap_fcaps_encode(&vectors[i].f, out, sizeof(out));
+	if (n != (ssize_t) vectors[i].len || memcmp(out, vectors[i].raw, n)) {
+	    printf("cap_fcaps_encode failed on revision %d\n", i+1);
+	    failed = -1;
+	}
+	if (cap_fcaps_decode(vectors[i].raw, vectors[i].len - 1, &f) == 0 ||
+	    cap_fcaps_decode(vectors[i].raw, vectors[i].len + 4, &f) == 0) {
+	    printf("cap_fcaps_decode accepted a bad size for revision %d\n",
+		   i+1);
+	    failed = -1;
+	}
+	if (cap_fcaps_encode(&vectors[i].f, out, vectors[i].len - 1) != -1 ||
+	    errno != ERANGE) {
+	    printf("cap_fcaps_encode overran a short buffer\n");
+	    failed = -1;
+	}
+    }
+
+    f = vectors[0].f;
+    f.permitted[1] = 1;
+    if (cap_fcaps_encode(&f, out, sizeof(out)) != -1) {
+	printf("cap_fcaps_encode accepted an upper word for revision 1\n");
+	failed = -1;
+    }
+    f = vectors[1].f;
+    f.rootid = 1;
+    if (cap_fcaps_encode(&f, out, sizeof(out)) != -1) {
+	printf("cap_fcaps_encode accepted a rootid for revision 2\n");
+	failed = -1;
+    }
+    memset(out, 0, sizeof(out));
+    out[3] = 0x04;
+    if (cap_fcaps_decode(out, 24, &f) == 0 ||
+	cap_fcaps_decode(out, 0, &f) == 0) {
+	printf("cap_fcaps_decode accepted a bad revision\n");
+	failed = -1;
+    }
+    return failed;
+}
+
+/*
+ * test_algebra checks the whole set operations against their text
+ * equivalents.
+ */
+static int test_algebra(void)
+{
+    static const struct {
+	const char *a, *b, *u, *n, *s;
+    } vs[] = {
+	{ "cap_chown=ep cap_kill=i", "cap_kill,cap_setuid=p",
+	  "cap_chown=ep cap_setuid=p cap_kill=ip", "cap_kill-eip",
+	  "cap_chown=ep cap_kill=i" },
+	{ "=ep", "cap_setpcap=eip", "=ep cap_setpcap+i", "cap_setpcap=ep",
+	  "=ep cap_setpcap-ep" },
+    };
+    static const cap_value_t raised[] = { 0, 5, 31, 32, 40, -1 };
+    cap_iab_t iab, ref;
+    cap_value_t c;
+    int i, failed = 0;
+    char *t;
+
+    for (i = 0; i < (int) (sizeof(vs)/sizeof(vs[0])); i++) {
+	const char *want[3] = { vs[i].u, vs[i].n, vs[i].s };
+	int (*fn[3])(cap_t, cap_t) = { cap_union, cap_intersect,
+				       cap_subtract };
+	int j;
+	for (j = 0; j < 3; j++) {
+	    cap_t a = cap_from_text(vs[i].a), b = cap_from_text(vs[i].b);
+	    cap_t w = cap_from_text(want[j]);
+	    if (fn[j](a, b) || cap_compare(a, w)) {
+		t = cap_to_text(a, NULL);
+		printf("set op %d on \"%s\", \"%s\" gave \"%s\", want \"%s\"\n",
+		       j, vs[i].a, vs[i].b, t, want[j]);
+		cap_free(t);
+		failed = -1;
+	    }
+	    cap_free(a);
+	    cap_free(b);
+	    cap_free(w);
+	}
+    }
+
+    {
+	cap_t a = cap_init();
+	for (i = 0; raised[i] >= 0; i++) {
+	    cap_set_flag(a, CAP_PERMITTED, 1, &raised[i], CAP_SET);
+	}
+	if (cap_count(a, CAP_PERMITTED) != i ||
+	    cap_count(a, CAP_EFFECTIVE) != 0) {
+	    printf("cap_count miscounted\n");
+	    failed = -1;
+	}
+	for (i = 0, c = cap_next_raised(a, CAP_PERMITTED, 0); c >= 0;
+	     c = cap_next_raised(a, CAP_PERMITTED, c+1), i++) {
+	    if (c != raised[i]) {
+		printf("cap_next_raised gave %d, want %d\n", c, raised[i]);
+		failed = -1;
+		break;
+	    }
+	}
+	if (raised[i] != -1 || cap_next_raised(a, CAP_PERMITTED, 64) != -1 ||
+	    cap_union(a, a) || cap_count(a, CAP_PERMITTED) != i ||
+	    cap_subtract(a, a) || cap_count(a, CAP_PERMITTED) != 0 ||
+	    cap_count(NULL, CAP_PERMITTED) != -1 || cap_union(a, NULL) != -1) {
+	    printf("cap_next_raised and friends misbehaved\n");
+	    failed = -1;
+	}
+	cap_free(a);
+    }
+
+    iab = cap_iab_from_text("!cap_chown,^cap_kill,cap_setuid");
+    ref = cap_iab_from_text("cap_kill,%cap_setgid");
+    if (cap_iab_subtract(iab, ref) ||
+	strcmp((t = cap_iab_to_text(iab)), "!cap_chown,cap_setuid")) {
+	printf("cap_iab_subtract gave \"%s\"\n", t);
+	failed = -1;
+    }
+    cap_free(t);
+    if (cap_iab_union(iab, ref) ||
+	strcmp((t = cap_iab_to_text(iab)), "!cap_chown,cap_kill,cap_setgid,cap_setuid")) {
+	printf("cap_iab_union gave \"%s\"\n", t);
+	failed = -1;
+    }
+    cap_free(t);
+    if (cap_iab_count(iab, CAP_IAB_INH) != 3 ||
+	cap_iab_next_raised(iab, CAP_IAB_BOUND, 0) != CAP_CHOWN ||
+	cap_iab_next_raised(iab, CAP_IAB_INH, CAP_CHOWN) != CAP_KILL ||
+	cap_iab_next_raised(iab, CAP_IAB_AMB, 0) != -1 ||
+	cap_iab_intersect(iab, ref) || cap_iab_count(iab, CAP_IAB_INH) != 2 ||
+	cap_iab_count(iab, CAP_IAB_BOUND) != 0) {
+	printf("cap_iab vector operations misbehaved\n");
+	failed = -1;
+    }
+    cap_free(ref);
+    cap_free(iab);
+    return failed;
+}
+
 static int test_prctl(void)
 {
     int ret, retval=0;
@@ -284,6 +793,27 @@ int main(int argc, char **argv) {
     printf("test_alloc: being called\n");
     fflush(stdout);
     result = test_alloc() | result;
+    printf("test_names: being called\n");
+    fflush(stdout);
+    result = test_names() | result;
+    printf("test_text_r: being called\n");
+    fflush(stdout);
+    result = test_text_r() | result;
+    printf("test_pool: being called\n");
+    fflush(stdout);
+    result = test_pool() | result;
+    printf("test_cached_version: being called\n");
+    fflush(stdout);
+    result = test_cached_version() | result;
+    printf("test_fileat: being called\n");
+    fflush(stdout);
+    result = test_fileat() | result;
+    printf("test_fcaps: being called\n");
+    fflush(stdout);
+    result = test_fcaps() | result;
+    printf("test_algebra: being called\n");
+    fflush(stdout);
+    result = test_algebra() | result;
     printf("test_prctl: being called\n");
     fflush(stdout);
     result = test_prctl() | result;
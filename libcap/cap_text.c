@@ -25,6 +25,11 @@ static char const *_cap_names[__CAP_BITS] = LIBCAP_CAP_NAMES;
 #include INCLUDE_GPERF_OUTPUT
 #endif
 
+#ifndef GPERF_DOWNCASE
+/* capability indices in name order for binary search lookups */
+static unsigned char const _cap_sorted[__CAP_NAMED] = LIBCAP_CAP_SORTED;
+#endif
+
 /* Maximum output text length */
 #define CAP_TEXT_SIZE    (__CAP_NAME_SIZE * __CAP_MAXBITS)
 
@@ -61,6 +66,23 @@ static char const *namcmp(char const *str, char const *nam)
     return str;
 }
 
+/*
+ * namorder compares the len characters of str, case insensitively,
+ * with the (lowercase) capability name nam. The result is ordered
+ * like strcmp().
+ */
+static int namorder(char const *str, size_t len, char const *nam)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+	int d = tolower((unsigned char)str[i]) - (unsigned char)nam[i];
+	if (d) {
+	    return d;
+	}
+    }
+    return -(unsigned char)nam[len];
+}
+
 /*
  * forceall forces all of the kernel named capabilities to be assigned
  * the masked value, and zeroed otherwise. Note, if the kernel is ahead
@@ -117,14 +139,25 @@ static int lookupname(char const **strp)
 	    return token_info->index;
 	}
 #else /* ie., ndef GPERF_DOWNCASE */
-	char const *s;
-	unsigned n = cap_max_bits();
-	if (n > __CAP_BITS) {
-	    n = __CAP_BITS;
-	}
-	while (n--) {
-	    if (_cap_names[n] && (s = namcmp(str.constp, _cap_names[n]))) {
-		*strp = s;
+	/*
+	 * Binary search of the names sorted by _makenames. Names
+	 * beyond those supported by the running kernel are not
+	 * recognized.
+	 */
+	int low = 0, high = __CAP_NAMED - 1;
+	while (low <= high) {
+	    int mid = (low + high) / 2;
+	    unsigned n = _cap_sorted[mid];
+	    int d = namorder(str.constp, len, _cap_names[n]);
+	    if (d < 0) {
+		high = mid - 1;
+	    } else if (d > 0) {
+		low = mid + 1;
+	    } else {
+		if (n >= (unsigned) cap_max_bits() || isdigit(c)) {
+		    break;
+		}
+		*strp = str.constp + len;
 		return n;
 	    }
 	}
@@ -305,15 +338,64 @@ int cap_from_name(const char *name, cap_value_t *value_p)
     return -(n < 0);
 }
 
+/*
+ * _cap_numbers holds the decimal names of the capabilities that have
+ * no name, indexed by value.
+ */
+#if __CAP_MAXBITS != 64
+# error "_cap_numbers[] needs updating for __CAP_MAXBITS"
+#endif
+static char const _cap_numbers[__CAP_MAXBITS][3] = {
+    "0",  "1",  "2",  "3",  "4",  "5",  "6",  "7",  "8",  "9",
+    "10", "11", "12", "13", "14", "15", "16", "17", "18", "19",
+    "20", "21", "22", "23", "24", "25", "26", "27", "28", "29",
+    "30", "31", "32", "33", "34", "35", "36", "37", "38", "39",
+    "40", "41", "42", "43", "44", "45", "46", "47", "48", "49",
+    "50", "51", "52", "53", "54", "55", "56", "57", "58", "59",
+    "60", "61", "62", "63",
+};
+
+/*
+ * _cap_name_static looks up the static name of cap, returning NULL
+ * (without touching errno) for values outside [0, __CAP_MAXBITS).
+ */
+static const char *_cap_name_static(cap_value_t cap)
+{
+    if (cap < 0 || cap >= __CAP_MAXBITS) {
+	return NULL;
+    }
+    if (cap < __CAP_BITS && _cap_names[cap] != NULL) {
+	return _cap_names[cap];
+    }
+    return _cap_numbers[cap];
+}
+
+/*
+ * cap_name_static returns the name of a capability without allocating
+ * memory. The returned string is read-only and remains valid for the
+ * life of the program. Capabilities without a name are named by their
+ * decimal value. Values outside [0, __CAP_MAXBITS) return NULL.
+ */
+const char *cap_name_static(cap_value_t cap)
+{
+    const char *name = _cap_name_static(cap);
+
+    if (name == NULL) {
+	errno = EINVAL;
+    }
+    return name;
+}
+
 /*
  * Convert a single capability index number into a string representation
  */
 char *cap_to_name(cap_value_t cap)
 {
     char *tmp, *result;
+    const char *name = _cap_name_static(cap);
 
-    if ((cap >= 0) && (cap < __CAP_BITS)) {
-	return _libcap_strdup(_cap_names[cap]);
+    if (name != NULL) {
+	return _libcap_strdup(name);
     }
     if (asprintf(&tmp, "%u", cap) <= 0) {
 	_cap_debug("asprintf filed");
@@ -326,39 +408,112 @@ char *cap_to_name(cap_value_t cap)
 }
 
 /*
- * Convert an internal representation to a textual one. The textual
- * representation is stored in static memory. It will be overwritten
- * on the next occasion that this function is called.
+ * This code assumes that the longest named capability is longer than
+ * the decimal text representation of __CAP_MAXBITS. This is very true
+ * at the time of writing and likely to remain so. However, we have
+ * a test in cap_text to validate it at build time.
+ */
+#define CAP_TEXT_BUFFER_ZONE 100
+
+/*
+ * _cap_text_name appends the name of capability n at p, using the
+ * static name tables where possible, and returns the end of the
+ * appended text.
  */
+static char *_cap_text_name(char *p, cap_value_t n)
+{
+    const char *name = _cap_name_static(n);
+
+    if (name != NULL) {
+	size_t len = strlen(name);
+	memcpy(p, name, len + 1);
+	return p + len;
+    }
+    return p + sprintf(p, "%u", n);
+}
 
-static int getstateflags(cap_t caps, int capno)
+/*
+ * _cap_range_mask returns the mask of the capability bits of block,
+ * blk, that fall in the range [low, high).
+ */
+static __u32 _cap_range_mask(unsigned blk, unsigned low, unsigned high)
 {
-    int f = 0;
+    unsigned base = 32*blk;
+    __u32 mask = ~0U;
 
-    if (isset_cap(caps, capno, CAP_EFFECTIVE)) {
-	f |= LIBCAP_EFF;
+    if (high <= base || low >= base + 32) {
+	return 0;
     }
-    if (isset_cap(caps, capno, CAP_PERMITTED)) {
-	f |= LIBCAP_PER;
+    if (low > base) {
+	mask &= ~0U << (low - base);
     }
-    if (isset_cap(caps, capno, CAP_INHERITABLE)) {
-	f |= LIBCAP_INH;
+    if (high < base + 32) {
+	mask &= (1U << (high - base)) - 1;
     }
+    return mask;
+}
 
-    return f;
+/*
+ * _cap_text_masks computes, a block at a time, masks[t] of the
+ * capabilities in the range [low, high) that are raised in exactly
+ * the combination, t, of LIBCAP_{EFF,INH,PER} flags. The number of
+ * such capabilities is accumulated in histo[t].
+ */
+static void _cap_text_masks(cap_t caps, unsigned low, unsigned high,
+			    __u32 masks[8][__CAP_BLKS], int histo[8])
+{
+    unsigned blk;
+    int t;
+
+    memset(histo, 0, 8*sizeof(int));
+    for (blk = 0; blk < __CAP_BLKS; blk++) {
+	__u32 range = _cap_range_mask(blk, low, high);
+	__u32 e = caps->u[blk].flat[CAP_EFFECTIVE];
+	__u32 i = caps->u[blk].flat[CAP_INHERITABLE];
+	__u32 p = caps->u[blk].flat[CAP_PERMITTED];
+	for (t = 0; t < 8; t++) {
+	    __u32 m = range
+		& ((t & LIBCAP_EFF) ? e : ~e)
+		& ((t & LIBCAP_INH) ? i : ~i)
+		& ((t & LIBCAP_PER) ? p : ~p);
+	    masks[t][blk] = m;
+	    histo[t] += __builtin_popcount(m);
+	}
+    }
 }
 
 /*
- * This code assumes that the longest named capability is longer than
- * the decimal text representation of __CAP_MAXBITS. This is very true
- * at the time of writing and likely to remain so. However, we have
- * a test in cap_text to validate it at build time.
+ * _cap_text_list appends the comma separated names of the
+ * capabilities in mask to p. It returns the end of the list, or NULL
+ * if the text would be too long for buf.
  */
-#define CAP_TEXT_BUFFER_ZONE 100
+static char *_cap_text_list(char *buf, char *p, const __u32 mask[__CAP_BLKS])
+{
+    unsigned blk;
 
-char *cap_to_text(cap_t caps, ssize_t *length_p)
+    for (blk = 0; blk < __CAP_BLKS; blk++) {
+	__u32 m;
+	for (m = mask[blk]; m; m &= m - 1) {
+	    if (p - buf + __CAP_NAME_SIZE > CAP_TEXT_SIZE) {
+		return NULL;
+	    }
+	    p = _cap_text_name(p, 32*blk + __builtin_ctz(m));
+	    *p++ = ',';
+	}
+    }
+    return p - 1;
+}
+
+/*
+ * _cap_text_format writes the text representation of caps into buf,
+ * which must be CAP_TEXT_SIZE+CAP_TEXT_BUFFER_ZONE bytes long. It
+ * returns the start of the text (which may be a little beyond buf)
+ * and its length in *length_p. It does not allocate any memory. On
+ * failure it returns NULL with errno set.
+ */
+static char *_cap_text_format(cap_t caps, char *buf, ssize_t *length_p)
 {
-    char buf[CAP_TEXT_SIZE+CAP_TEXT_BUFFER_ZONE];
+    __u32 masks[8][__CAP_BLKS];
     char *p, *base;
     int histo[8];
     int m, t;
@@ -374,12 +529,9 @@ char *cap_to_text(cap_t caps, ssize_t *length_p)
     _cap_debugcap("i = ", *caps, CAP_INHERITABLE);
     _cap_debugcap("p = ", *caps, CAP_PERMITTED);
 
-    memset(histo, 0, sizeof(histo));
-
     /* default prevailing state to the named bits */
     cap_value_t cmb = cap_max_bits();
-    for (n = 0; n < cmb; n++)
-	histo[getstateflags(caps, n)]++;
+    _cap_text_masks(caps, 0, cmb, masks, histo);
 
     /* find which combination of capability sets shares the most bits
        we bias to preferring non-set (m=0) with the >= 0 test. Failing
@@ -401,22 +553,11 @@ char *cap_to_text(cap_t caps, ssize_t *length_p)
 	    continue;
 	}
 	*p++ = ' ';
-	for (n = 0; n < cmb; n++) {
-	    if (getstateflags(caps, n) == t) {
-	        char *this_cap_name = cap_to_name(n);
-		if (this_cap_name == NULL) {
-		    return NULL;
-		}
-	        if ((strlen(this_cap_name) + (p - buf)) > CAP_TEXT_SIZE) {
-		    cap_free(this_cap_name);
-		    errno = ERANGE;
-		    return NULL;
-	        }
-	        p += sprintf(p, "%s,", this_cap_name);
-	        cap_free(this_cap_name);
-	    }
+	p = _cap_text_list(buf, p, masks[t]);
+	if (p == NULL) {
+	    errno = ERANGE;
+	    return NULL;
 	}
-	p--;
 	n = t & ~m;
 	if (n) {
 	    char op = '+';
@@ -447,31 +588,18 @@ char *cap_to_text(cap_t caps, ssize_t *length_p)
     }
 
     /* capture remaining unnamed bits - which must all be +. */
-    memset(histo, 0, sizeof(histo));
-    for (n = cmb; n < __CAP_MAXBITS; n++)
-	histo[getstateflags(caps, n)]++;
+    _cap_text_masks(caps, cmb, __CAP_MAXBITS, masks, histo);
 
     for (t = 8; t-- > 1; ) {
 	if (!histo[t]) {
 	    continue;
 	}
 	*p++ = ' ';
-	for (n = cmb; n < __CAP_MAXBITS; n++) {
-	    if (getstateflags(caps, n) == t) {
-		char *this_cap_name = cap_to_name(n);
-		if (this_cap_name == NULL) {
-		    return NULL;
-		}
-	        if ((strlen(this_cap_name) + (p - buf)) > CAP_TEXT_SIZE) {
-		    cap_free(this_cap_name);
-		    errno = ERANGE;
-		    return NULL;
-	        }
-		p += sprintf(p, "%s,", this_cap_name);
-		cap_free(this_cap_name);
-	    }
+	p = _cap_text_list(buf, p, masks[t]);
+	if (p == NULL) {
+	    errno = ERANGE;
+	    return NULL;
 	}
-	p--;
 	p += sprintf(p, "+%s%s%s",
 		     (t & LIBCAP_EFF) ? "e" : "",
 		     (t & LIBCAP_INH) ? "i" : "",
@@ -483,13 +611,67 @@ char *cap_to_text(cap_t caps, ssize_t *length_p)
     }
 
     _cap_debug("%s", base);
-    if (length_p) {
-	*length_p = p - base;
+    *length_p = p - base;
+    return base;
+}
+
+/*
+ * _cap_text_copy copies the length long text into the caller's
+ * buffer, text, of len bytes. When it does not fit, text is set to
+ * the empty string. It returns length.
+ */
+static ssize_t _cap_text_copy(char *text, size_t len,
+			      const char *base, ssize_t length)
+{
+    if (text != NULL && len > 0) {
+	if ((size_t) length < len) {
+	    memcpy(text, base, length + 1);
+	} else {
+	    text[0] = '\0';
+	}
     }
+    return length;
+}
+
+/*
+ * Convert an internal representation to a textual one. The returned
+ * text should be released with cap_free().
+ */
+char *cap_to_text(cap_t caps, ssize_t *length_p)
+{
+    char buf[CAP_TEXT_SIZE+CAP_TEXT_BUFFER_ZONE];
+    ssize_t length;
+    char *base = _cap_text_format(caps, buf, &length);
 
+    if (base == NULL) {
+	return NULL;
+    }
+    if (length_p) {
+	*length_p = length;
+    }
     return (_libcap_strdup(base));
 }
 
+/*
+ * cap_to_text_r is a version of cap_to_text() that does not allocate
+ * memory. It writes the text into the caller's buffer, text, of len
+ * bytes. The return value is the length of the text (excluding the
+ * nul terminator). If this is not less than len, the text did not
+ * fit and the buffer holds an empty string. On error, -1 is
+ * returned.
+ */
+ssize_t cap_to_text_r(cap_t caps, char *text, size_t len)
+{
+    char buf[CAP_TEXT_SIZE+CAP_TEXT_BUFFER_ZONE];
+    ssize_t length;
+    char *base = _cap_text_format(caps, buf, &length);
+
+    if (base == NULL) {
+	return -1;
+    }
+    return _cap_text_copy(text, len, base, length);
+}
+
 /*
  * cap_mode_name returns a text token naming the specified mode.
  */
@@ -511,12 +693,13 @@ const char *cap_mode_name(cap_mode_t flavor) {
 }
 
 /*
- * cap_iab_to_text serializes an iab into a canonical text
- * representation.
+ * _cap_iab_text_format writes the canonical text representation of
+ * iab into buf, which must be CAP_TEXT_SIZE+CAP_TEXT_BUFFER_ZONE
+ * bytes long. It returns the length of the text. An invalid iab is
+ * represented as the empty string.
  */
-char *cap_iab_to_text(cap_iab_t iab)
+static ssize_t _cap_iab_text_format(cap_iab_t iab, char *buf)
 {
-    char buf[CAP_TEXT_SIZE+CAP_TEXT_BUFFER_ZONE];
     char *p = buf;
     cap_value_t c, cmb = cap_max_bits();
     int first = 1;
@@ -547,21 +730,43 @@ char *cap_iab_to_text(cap_iab_t iab)
 		*p++ = '%';
 	    }
 	    if (keep || ib) {
-		if (c < __CAP_BITS) {
-		    strcpy(p, _cap_names[c]);
-		} else {
-		    sprintf(p, "%u", c);
-		}
-		p += strlen(p);
+		p = _cap_text_name(p, c);
 		first = 0;
 	    }
 	}
 	_cap_mu_unlock(&iab->mutex);
     }
     *p = '\0';
+    return p - buf;
+}
+
+/*
+ * cap_iab_to_text serializes an iab into a canonical text
+ * representation.
+ */
+char *cap_iab_to_text(cap_iab_t iab)
+{
+    char buf[CAP_TEXT_SIZE+CAP_TEXT_BUFFER_ZONE];
+    _cap_iab_text_format(iab, buf);
     return _libcap_strdup(buf);
 }
 
+/*
+ * cap_iab_to_text_r is a version of cap_iab_to_text() that does not
+ * allocate memory. Its buffer handling and return value are the same
+ * as for cap_to_text_r().
+ */
+ssize_t cap_iab_to_text_r(cap_iab_t iab, char *text, size_t len)
+{
+    char buf[CAP_TEXT_SIZE+CAP_TEXT_BUFFER_ZONE];
+
+    if (!good_cap_iab_t(iab)) {
+	errno = EINVAL;
+	return -1;
+    }
+    return _cap_text_copy(text, len, buf, _cap_iab_text_format(iab, buf));
+}
+
 cap_iab_t cap_iab_from_text(const char *text)
 {
     cap_iab_t iab = cap_iab_init();
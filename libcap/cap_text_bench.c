@@ -0,0 +1,291 @@
+/*
+ * cap_text_bench measures the rate at which libcap parses textual
+ * capability names, and formats capability sets as text. It is not
+ * run by "make test", use "make bench".
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+
+#include "libcap.h"
+
+#define ROUNDS 20000
+#define SETS   64
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *what, long count, const char *unit,
+		   double start)
+{
+    double elapsed = now_sec() - start;
+    printf("%-20s %12.0f %s/sec\n", what, count / elapsed, unit);
+}
+
+/*
+ * legacy_flags and legacy_to_text reproduce the original cap_to_text()
+ * formatter, which scanned the capabilities once per combination of
+ * flags, a bit at a time, to provide a reference for the current
+ * implementation.
+ */
+static int legacy_flags(cap_t caps, cap_value_t n)
+{
+    cap_flag_value_t v;
+    int f = 0;
+
+    if (cap_get_flag(caps, n, CAP_EFFECTIVE, &v) == 0 && v) {
+	f |= LIBCAP_EFF;
+    }
+    if (cap_get_flag(caps, n, CAP_PERMITTED, &v) == 0 && v) {
+	f |= LIBCAP_PER;
+    }
+    if (cap_get_flag(caps, n, CAP_INHERITABLE, &v) == 0 && v) {
+	f |= LIBCAP_INH;
+    }
+    return f;
+}
+
+static char *legacy_to_text(cap_t caps)
+{
+    char buf[__CAP_NAME_SIZE * __CAP_MAXBITS + 100];
+    char *p, *base;
+    int histo[8];
+    int m, t;
+    cap_value_t n, cmb = cap_max_bits();
+
+    memset(histo, 0, sizeof(histo));
+    for (n = 0; n < cmb; n++) {
+	histo[legacy_flags(caps, n)]++;
+    }
+    for (m=t=7; t--; ) {
+	if (histo[t] >= histo[m]) {
+	    m = t;
+	}
+    }
+    base = buf;
+    p = sprintf(buf, "=%s%s%s",
+		(m & LIBCAP_EFF) ? "e" : "",
+		(m & LIBCAP_INH) ? "i" : "",
+		(m & LIBCAP_PER) ? "p" : "") + buf;
+    for (t = 8; t--; ) {
+	int k;
+	if (t == m || !histo[t]) {
+	    continue;
+	}
+	*p++ = ' ';
+	for (n = 0; n < cmb; n++) {
+	    if (legacy_flags(caps, n) == t) {
+		char *name = cap_to_name(n);
+		p += sprintf(p, "%s,", name);
+		cap_free(name);
+	    }
+	}
+	p--;
+	k = t & ~m;
+	if (k) {
+	    char op = '+';
+	    if (base[0] == '=' && base[1] == ' ') {
+		base += 2;
+		op = '=';
+	    }
+	    p += sprintf(p, "%c%s%s%s", op,
+			 (k & LIBCAP_EFF) ? "e" : "",
+			 (k & LIBCAP_INH) ? "i" : "",
+			 (k & LIBCAP_PER) ? "p" : "");
+	}
+	k = ~t & m;
+	if (k) {
+	    p += sprintf(p, "-%s%s%s",
+			 (k & LIBCAP_EFF) ? "e" : "",
+			 (k & LIBCAP_INH) ? "i" : "",
+			 (k & LIBCAP_PER) ? "p" : "");
+	}
+    }
+    memset(histo, 0, sizeof(histo));
+    for (n = cmb; n < __CAP_MAXBITS; n++) {
+	histo[legacy_flags(caps, n)]++;
+    }
+    for (t = 8; t-- > 1; ) {
+	if (!histo[t]) {
+	    continue;
+	}
+	*p++ = ' ';
+	for (n = cmb; n < __CAP_MAXBITS; n++) {
+	    if (legacy_flags(caps, n) == t) {
+		char *name = cap_to_name(n);
+		p += sprintf(p, "%s,", name);
+		cap_free(name);
+	    }
+	}
+	p--;
+	p += sprintf(p, "+%s%s%s",
+		     (t & LIBCAP_EFF) ? "e" : "",
+		     (t & LIBCAP_INH) ? "i" : "",
+		     (t & LIBCAP_PER) ? "p" : "");
+    }
+    *p = '\0';
+    return _libcap_strdup(base);
+}
+
+/*
+ * format_bench times the legacy and current formatters on the sets,
+ * after confirming they agree.
+ */
+static void format_bench(const char *what, cap_t *sets, int n)
+{
+    char buf[__CAP_NAME_SIZE * __CAP_MAXBITS + 100];
+    double start;
+    int i, j;
+
+    for (j = 0; j < n; j++) {
+	char *want = legacy_to_text(sets[j]);
+	char *got = cap_to_text(sets[j], NULL);
+	if (strcmp(want, got)) {
+	    printf("formatter mismatch: \"%s\" vs \"%s\"\n", got, want);
+	    exit(1);
+	}
+	cap_free(want);
+	cap_free(got);
+    }
+
+    printf("formatting %s sets:\n", what);
+    start = now_sec();
+    for (i = 0; i < ROUNDS / 10; i++) {
+	for (j = 0; j < n; j++) {
+	    cap_free(legacy_to_text(sets[j]));
+	}
+    }
+    report("  legacy", (long) ROUNDS / 10 * n, "sets", start);
+    start = now_sec();
+    for (i = 0; i < ROUNDS / 10; i++) {
+	for (j = 0; j < n; j++) {
+	    cap_free(cap_to_text(sets[j], NULL));
+	}
+    }
+    report("  cap_to_text", (long) ROUNDS / 10 * n, "sets", start);
+    start = now_sec();
+    for (i = 0; i < ROUNDS / 10; i++) {
+	for (j = 0; j < n; j++) {
+	    cap_to_text_r(sets[j], buf, sizeof(buf));
+	}
+    }
+    report("  cap_to_text_r", (long) ROUNDS / 10 * n, "sets", start);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *typical[] = {
+	"=", "=ep", "cap_net_bind_service=ep", "cap_setuid,cap_setgid=p",
+	"cap_chown,cap_dac_override,cap_fowner+ep cap_setuid+i",
+	"all=ep cap_sys_admin-ep", "=eip cap_setpcap-e", NULL
+    };
+    cap_t sets[SETS];
+    char *names[__CAP_BITS];
+    char text[__CAP_BITS * (__CAP_NAME_SIZE + 1) + 4];
+    char iab_text[__CAP_BITS * (__CAP_NAME_SIZE + 2) + 1];
+    cap_value_t c, max = cap_max_bits();
+    int i, n = 0;
+    char *t = text, *it = iab_text;
+    double start;
+
+    if (max > __CAP_BITS) {
+	max = __CAP_BITS;
+    }
+    for (c = 0; c < max; c++) {
+	names[n] = cap_to_name(c);
+	t += sprintf(t, "%s%s", n ? "," : "", names[n]);
+	it += sprintf(it, "%s%c%s", n ? "," : "", "!^%"[c % 3], names[n]);
+	n++;
+    }
+    strcpy(t, "=ep");
+
+    start = now_sec();
+    for (i = 0; i < ROUNDS; i++) {
+	cap_t caps = cap_from_text(text);
+	if (caps == NULL) {
+	    perror("cap_from_text failed");
+	    exit(1);
+	}
+	cap_free(caps);
+    }
+    report("cap_from_text", (long) ROUNDS * n, "tokens", start);
+
+    start = now_sec();
+    for (i = 0; i < ROUNDS; i++) {
+	int j;
+	for (j = 0; j < n; j++) {
+	    cap_value_t v;
+	    if (cap_from_name(names[j], &v)) {
+		perror("cap_from_name failed");
+		exit(1);
+	    }
+	}
+    }
+    report("cap_from_name", (long) ROUNDS * n, "tokens", start);
+
+    start = now_sec();
+    for (i = 0; i < ROUNDS; i++) {
+	for (c = 0; c < max; c++) {
+	    cap_free(cap_to_name(c));
+	}
+    }
+    report("cap_to_name", (long) ROUNDS * n, "names", start);
+
+    start = now_sec();
+    for (i = 0; i < ROUNDS; i++) {
+	for (c = 0; c < max; c++) {
+	    if (cap_name_static(c) == NULL) {
+		perror("cap_name_static failed");
+		exit(1);
+	    }
+	}
+    }
+    report("cap_name_static", (long) ROUNDS * n, "names", start);
+
+    start = now_sec();
+    for (i = 0; i < ROUNDS; i++) {
+	cap_iab_t iab = cap_iab_from_text(iab_text);
+	if (iab == NULL) {
+	    perror("cap_iab_from_text failed");
+	    exit(1);
+	}
+	cap_free(iab);
+    }
+    report("cap_iab_from_text", (long) ROUNDS * n, "tokens", start);
+
+    for (i = 0; typical[i]; i++) {
+	sets[i] = cap_from_text(typical[i]);
+    }
+    format_bench("typical", sets, i);
+    while (i--) {
+	cap_free(sets[i]);
+    }
+
+    srandom(1);
+    for (i = 0; i < SETS; i++) {
+	sets[i] = cap_init();
+	for (c = 0; c < __CAP_MAXBITS; c++) {
+	    cap_value_t v[1] = { c };
+	    cap_flag_t f;
+	    for (f = CAP_EFFECTIVE; f <= CAP_INHERITABLE; f++) {
+		if (random() & 1) {
+		    cap_set_flag(sets[i], f, 1, v, CAP_SET);
+		}
+	    }
+	}
+    }
+    format_bench("random", sets, SETS);
+    for (i = 0; i < SETS; i++) {
+	cap_free(sets[i]);
+    }
+
+    for (i = 0; i < n; i++) {
+	cap_free(names[i]);
+    }
+    exit(0);
+}
@@ -29,9 +29,7 @@ static void summary(void)
     } else if (bits < CAP_LAST_CAP+1) {
 	printf("=> Newer kernels also provide support for:");
 	for (c = bits; c <= CAP_LAST_CAP; c++) {
-	    char *name = cap_to_name(c);
-	    printf(" %s", name);
-	    cap_free(name);
+	    printf(" %s", cap_name_static(c));
 	}
     } else {
 	return;
@@ -136,6 +136,20 @@ extern cap_t      cap_init(void);
 extern cap_iab_t  cap_iab_dup(cap_iab_t);
 extern cap_iab_t  cap_iab_init(void);
 
+/*
+ * A cap_pool_t caches the memory of released cap_t and cap_iab_t
+ * objects for reuse, avoiding a malloc() for each short lived
+ * object. Objects obtained from a pool
+ * can also be released with cap_free(), and the pool itself, with
+ * any memory it holds, is released with cap_free().
+ */
+typedef struct cap_pool_s *cap_pool_t;
+
+extern cap_pool_t cap_new_pool(void);
+extern cap_t      cap_pool_init_set(cap_pool_t pool);
+extern cap_iab_t  cap_pool_init_iab(cap_pool_t pool);
+extern int        cap_pool_release(cap_pool_t pool, void *obj);
+
 /* libcap/cap_flag.c */
 extern int     cap_get_flag(cap_t, cap_value_t, cap_flag_t, cap_flag_value_t *);
 extern int     cap_set_flag(cap_t, cap_flag_t, int, const cap_value_t *,
@@ -146,6 +160,12 @@ extern int     cap_fill_flag(cap_t cap_d, cap_flag_t to,
                              cap_t ref, cap_flag_t from);
 extern int     cap_fill(cap_t, cap_flag_t, cap_flag_t);
 
+extern int     cap_union(cap_t, cap_t);
+extern int     cap_intersect(cap_t, cap_t);
+extern int     cap_subtract(cap_t, cap_t);
+extern int     cap_count(cap_t, cap_flag_t);
+extern cap_value_t cap_next_raised(cap_t, cap_flag_t, cap_value_t);
+
 #define CAP_DIFFERS(result, flag)  (((result) & (1 << (flag))) != 0)
 extern int     cap_compare(cap_t, cap_t);
 #define CAP_IAB_DIFFERS(result, vector)  (((result) & (1 << (vector))) != 0)
@@ -156,15 +176,40 @@ extern cap_flag_value_t cap_iab_get_vector(cap_iab_t, cap_iab_vector_t,
 extern int     cap_iab_set_vector(cap_iab_t, cap_iab_vector_t, cap_value_t,
 				cap_flag_value_t);
 extern int     cap_iab_fill(cap_iab_t, cap_iab_vector_t, cap_t, cap_flag_t);
+extern int     cap_iab_union(cap_iab_t, cap_iab_t);
+extern int     cap_iab_intersect(cap_iab_t, cap_iab_t);
+extern int     cap_iab_subtract(cap_iab_t, cap_iab_t);
+extern int     cap_iab_count(cap_iab_t, cap_iab_vector_t);
+extern cap_value_t cap_iab_next_raised(cap_iab_t, cap_iab_vector_t,
+				       cap_value_t);
 
 /* libcap/cap_file.c */
 extern cap_t   cap_get_fd(int);
 extern cap_t   cap_get_file(const char *);
+extern cap_t   cap_get_fileat(int, const char *, cap_t, int);
+typedef int (*cap_scan_fn_t)(int dirfd, const char *name, int type,
+			     cap_t caps, void *data);
+extern int     cap_scan_dir(int, cap_scan_fn_t, void *);
 extern uid_t   cap_get_nsowner(cap_t);
 extern int     cap_set_fd(int, cap_t);
 extern int     cap_set_file(const char *, cap_t);
 extern int     cap_set_nsowner(cap_t, uid_t);
 
+/*
+ * struct cap_fcaps is the decoded form of a security.capability
+ * xattr. The revision is one of the kernel's VFS_CAP_REVISION_*
+ * values, and the rootid is only meaningful for revision 3.
+ */
+struct cap_fcaps {
+    uint32_t revision;
+    uint32_t effective;
+    uint32_t rootid;
+    uint32_t permitted[2];
+    uint32_t inheritable[2];
+};
+extern int     cap_fcaps_decode(const void *, size_t, struct cap_fcaps *);
+extern ssize_t cap_fcaps_encode(const struct cap_fcaps *, void *, size_t);
+
 /* libcap/cap_proc.c */
 extern cap_t   cap_get_proc(void);
 extern cap_t   cap_get_pid(pid_t);
@@ -188,10 +233,13 @@ extern cap_t   cap_copy_int_check(const void *cap_ext, ssize_t length);
 /* libcap/cap_text.c */
 extern cap_t   cap_from_text(const char *);
 extern char *  cap_to_text(cap_t, ssize_t *);
+extern ssize_t cap_to_text_r(cap_t, char *, size_t);
 extern int     cap_from_name(const char *, cap_value_t *);
 extern char *  cap_to_name(cap_value_t);
+extern const char *cap_name_static(cap_value_t);
 
 extern char *     cap_iab_to_text(cap_iab_t iab);
+extern ssize_t    cap_iab_to_text_r(cap_iab_t iab, char *text, size_t len);
 extern cap_iab_t  cap_iab_from_text(const char *text);
 
 /* libcap/cap_proc.c */
@@ -232,7 +280,23 @@ extern int cap_launcher_setgroups(cap_launch_t attr, gid_t gid,
 extern int cap_launcher_set_mode(cap_launch_t attr, cap_mode_t flavor);
 extern cap_iab_t cap_launcher_set_iab(cap_launch_t attr, cap_iab_t iab);
 extern int cap_launcher_set_chroot(cap_launch_t attr, const char *chroot);
+extern int cap_launcher_set_vfork(cap_launch_t attr, int vfork);
 extern pid_t cap_launch(cap_launch_t attr, void *detail);
+extern pid_t cap_launch_pidfd(cap_launch_t attr, void *detail, int *pidfd);
+extern int cap_launch_async(cap_launch_t attr, void *detail, pid_t *pid,
+			    int *pidfd);
+extern int cap_launch_result(int fd);
+
+/*
+ * A cap_zygote_t is a helper process holding a pool of children that
+ * have already assumed the security context of a launcher.
+ */
+typedef struct cap_zygote_s *cap_zygote_t;
+
+extern cap_zygote_t cap_new_zygote(cap_launch_t attr, int pool);
+extern pid_t cap_zygote_launch(cap_zygote_t z, const char *arg0,
+			       const char * const *argv,
+			       const char * const *envp);
 
 /*
  * system calls - look to libc for function to system call
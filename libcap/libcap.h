@@ -212,6 +212,24 @@ extern void psx_load_syscalls(
     long int (**syscall6_fn)(long int, long int, long int, long int,
 			     long int, long int, long int));
 
+/*
+ * Similarly, this mirrors the psx_syscall_vec() call description
+ * and loader of <sys/psx_syscall.h>. The two must be kept in sync.
+ */
+struct psx_call {
+    long int syscall_nr;
+    long int arg[6];
+    int flags;
+    long int retval;
+    int error;
+    int differ;
+};
+#define PSX_CALL_OPTIONAL  1
+#define PSX_CALL_ALWAYS    2
+
+extern void psx_load_syscall_vec(
+    int (**syscall_vec_fn)(struct psx_call *calls, int n));
+
 #define EXECABLE_INITIALIZE _libcap_initialize()
 
 /*
@@ -316,6 +334,12 @@ struct cap_launch_s {
     /* chroot holds a preferred chroot for the launched child. */
     char *chroot;
 
+    /*
+     * vfork selects a child that shares the memory of cap_launch()'s
+     * caller, see cap_launcher_set_vfork().
+     */
+    int vfork;
+
     /*
      * execve style arguments
      */
@@ -324,8 +348,46 @@ struct cap_launch_s {
     const char *const *envp;
 };
 
+/* pool magic for cap_free */
+#define CAP_POOL_MAGIC 0xCA91A0
+
+/*
+ * A cap_pool_s recycles the scrubbed allocations of released cap_t
+ * and cap_iab_t objects. It records the kernel's capability version
+ * when the pool is created. At most _LIBCAP_POOL_MAX_IDLE (count)
+ * allocations are held idle, beyond that released objects are freed.
+ */
+#define _LIBCAP_POOL_MAX_IDLE 256
+
+struct cap_pool_s {
+    __u8 mutex;
+    __u32 version;
+    unsigned count;
+    struct _cap_alloc_s *idle;
+};
+
+/* zygote magic for cap_free */
+#define CAP_ZYGOTE_MAGIC 0xCA91A2
+
+/*
+ * A cap_zygote_s is the launching process' handle on a zygote: a
+ * helper process, forked from it, that keeps a pool of children
+ * already moved to the security context of a launcher. Requests to
+ * exec a program are sent to it over the fd socket.
+ */
+struct cap_zygote_s {
+    __u8 mutex;
+    pid_t pid;
+    int fd;
+    int pool;
+};
+
+extern int _cap_zygote_start(struct cap_zygote_s *z, cap_launch_t attr,
+			     int pool);
+extern void _cap_zygote_stop(struct cap_zygote_s *z);
+
 #define _CAP_STRUCTS_ALIGN \
-        __alignof__(union {struct _cap_struct s; struct cap_iab_s i; struct cap_launch_s l;})
+        __alignof__(union {struct _cap_struct s; struct cap_iab_s i; struct cap_launch_s l; struct cap_pool_s p; struct cap_zygote_s z;})
 
 #define _CAP_ALLOC_OFF_TO_MAGIC (_CAP_STRUCTS_ALIGN > 2*sizeof(__u32) ? \
                                 (_CAP_STRUCTS_ALIGN) : (2*sizeof(__u32)))
@@ -336,6 +398,8 @@ struct cap_launch_s {
 #define good_cap_t(x)         (CAP_T_MAGIC   == magic_of(x))
 #define good_cap_iab_t(x)     (CAP_IAB_MAGIC == magic_of(x))
 #define good_cap_launch_t(x)  (CAP_LAUNCH_MAGIC == magic_of(x))
+#define good_cap_pool_t(x)    (CAP_POOL_MAGIC == magic_of(x))
+#define good_cap_zygote_t(x)  (CAP_ZYGOTE_MAGIC == magic_of(x))
 
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
 #define libcap_static_assert(cond, text) \
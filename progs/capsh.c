@@ -92,17 +92,16 @@ static void display_prctl_set(const char *name, int (*fn)(cap_value_t))
 
     printf("%s set =", name);
     for (sep = "", cap=0; (set = fn(cap)) >= 0; cap++) {
-	char *ptr;
+	const char *ptr;
 	if (!set) {
 	    continue;
 	}
 
-	ptr = cap_to_name(cap);
+	ptr = cap_name_static(cap);
 	if (ptr == NULL) {
 	    printf("%s%u", sep, cap);
 	} else {
 	    printf("%s%s", sep, ptr);
-	    cap_free(ptr);
 	}
 	sep = ",";
     }
@@ -941,12 +940,11 @@ int main(int argc, char *argv[], char *envp[])
 
 	    for (cap=0; (cap < 64) && (value >> cap); ++cap) {
 		if (value & (1ULL << cap)) {
-		    char *ptr;
+		    const char *ptr;
 
-		    ptr = cap_to_name(cap);
+		    ptr = cap_name_static(cap);
 		    if (ptr != NULL) {
 			printf("%s%s", sep, ptr);
-			cap_free(ptr);
 		    } else {
 			printf("%s%u", sep, cap);
 		    }
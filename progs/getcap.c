@@ -5,57 +5,371 @@
  */
 
 #undef _XOPEN_SOURCE
-#define _XOPEN_SOURCE 500
+#define _XOPEN_SOURCE 700
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <endian.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/xattr.h>
 #include <sys/capability.h>
 
 #include <ftw.h>
 
+#ifdef GETCAP_THREADS
+#include <pthread.h>
+#endif
+
 static int verbose = 0;
 static int recursive = 0;
 static int namespace = 0;
+static int sorted = 0;
+static int threads = 1;
+static long entries = 0;
 
 static void usage(int code)
 {
     fprintf(stderr,
-    "usage: getcap [-h] [-l] [-n] [-r] [-v] <filename> [<filename> ...]\n"
+    "usage: getcap [-h] [-l] [-n] [-r] [-s] [-t] [-v] [-j <n>]"
+    " [--format=<fmt>]\n"
+    "              [--index=<file>] <filename> [<filename> ...]\n"
+    "       getcap [-s] [--format=<fmt>] --index=<file>\n"
     "\n"
     "\tdisplays the capabilities on the queried file(s).\n"
+    "\t<fmt> is one of text (default), jsonl, nul or raw.\n"
+    "\tWithout filenames, --index lists the files recorded in <file>.\n"
 	);
     exit(code);
 }
 
-static int do_getcap(const char *fname, const struct stat *stbuf,
-		     int tflag, struct FTW* ftwbuf)
+/*
+ * Each record of output is formatted in a per-thread buffer and then
+ * either written as a whole to stdout, or (with -s) collected and
+ * written in sorted order once the scan of each argument is
+ * complete. Records in the nul and raw formats contain NULs, so the
+ * length of each is tracked.
+ */
+enum format {
+    FORMAT_TEXT,
+    FORMAT_JSONL,
+    FORMAT_NUL,
+    FORMAT_RAW,
+};
+
+static enum format format = FORMAT_TEXT;
+
+struct record {
+    char *data;
+    size_t len, size;
+};
+
+static __thread struct record rec;
+
+struct line {
+    size_t len;
+    char data[];
+};
+
+static struct {
+    struct line **lines;
+    size_t count, size;
+#ifdef GETCAP_THREADS
+    pthread_mutex_t mu;
+#endif
+} output = {
+#ifdef GETCAP_THREADS
+    .mu = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+static void *checked(void *ptr)
 {
-    cap_t cap_d;
-    char *result;
-    uid_t rootid;
+    if (ptr == NULL) {
+	perror("getcap: out of memory");
+	exit(1);
+    }
+    return ptr;
+}
 
-    if (tflag != FTW_F) {
-	if (verbose) {
-	    printf("%s (Not a regular file)\n", fname);
+static void rec_put(const void *data, size_t len)
+{
+    if (rec.len + len > rec.size) {
+	rec.size = 2 * (rec.len + len) + 256;
+	rec.data = checked(realloc(rec.data, rec.size));
+    }
+    memcpy(rec.data + rec.len, data, len);
+    rec.len += len;
+}
+
+static void rec_printf(const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(rec.data + rec.len, rec.size - rec.len, fmt, ap);
+    va_end(ap);
+    if (rec.len + n >= rec.size) {
+	rec.size = 2 * (rec.len + n) + 256;
+	rec.data = checked(realloc(rec.data, rec.size));
+	va_start(ap, fmt);
+	vsnprintf(rec.data + rec.len, rec.size - rec.len, fmt, ap);
+	va_end(ap);
+    }
+    rec.len += n;
+}
+
+/*
+ * utf8_len returns the length of the valid UTF-8 encoded character
+ * that starts at s, or 0 if there is none.
+ */
+static int utf8_len(const unsigned char *s)
+{
+    unsigned char lo = 0x80, hi = 0xbf;
+    int i, n;
+
+    if (*s < 0x80) {
+	return 1;
+    } else if (*s >= 0xc2 && *s <= 0xdf) {
+	n = 2;
+    } else if (*s >= 0xe0 && *s <= 0xef) {
+	n = 3;
+	if (*s == 0xe0) {
+	    lo = 0xa0;
+	} else if (*s == 0xed) {
+	    hi = 0x9f;
 	}
+    } else if (*s >= 0xf0 && *s <= 0xf4) {
+	n = 4;
+	if (*s == 0xf0) {
+	    lo = 0x90;
+	} else if (*s == 0xf4) {
+	    hi = 0x8f;
+	}
+    } else {
 	return 0;
     }
+    for (i = 1; i < n; i++, lo = 0x80, hi = 0xbf) {
+	if (s[i] < lo || s[i] > hi) {
+	    return 0;
+	}
+    }
+    return n;
+}
+
+/*
+ * rec_json appends str as a JSON string. Valid UTF-8 is passed
+ * through unchanged, and each byte that is not part of it is escaped
+ * as a lone surrogate, \udc80 to \udcff, following the
+ * "surrogateescape" convention of Python's os.fsdecode().
+ */
+static void rec_json(const char *str)
+{
+    const unsigned char *s = (const unsigned char *) str;
+
+    rec_put("\"", 1);
+    while (*s) {
+	int n = utf8_len(s);
+	if (*s == '"' || *s == '\\') {
+	    char esc[2] = { '\\', *s };
+	    rec_put(esc, 2);
+	} else if (*s < 0x20 || *s == 0x7f) {
+	    rec_printf("\\u%04x", *s);
+	} else if (n == 0) {
+	    rec_printf("\\udc%02x", *s);
+	    n = 1;
+	} else {
+	    rec_put(s, n);
+	}
+	s += n;
+    }
+    rec_put("\"", 1);
+}
+
+/*
+ * rec_emit outputs the record formatted in rec and resets it.
+ */
+static void rec_emit(void)
+{
+    struct line *line;
+
+    if (!sorted) {
+	fwrite(rec.data, 1, rec.len, stdout);
+	rec.len = 0;
+	return;
+    }
+
+    line = checked(malloc(sizeof(struct line) + rec.len));
+    line->len = rec.len;
+    memcpy(line->data, rec.data, rec.len);
+    rec.len = 0;
+
+#ifdef GETCAP_THREADS
+    pthread_mutex_lock(&output.mu);
+#endif
+    if (output.count == output.size) {
+	output.size = output.size ? 2*output.size : 1024;
+	output.lines = checked(realloc(output.lines,
+				       output.size * sizeof(struct line *)));
+    }
+    output.lines[output.count++] = line;
+#ifdef GETCAP_THREADS
+    pthread_mutex_unlock(&output.mu);
+#endif
+}
+
+static int by_line(const void *a, const void *b)
+{
+    const struct line *x = *(struct line * const *) a;
+    const struct line *y = *(struct line * const *) b;
+    int d = memcmp(x->data, y->data, x->len < y->len ? x->len : y->len);
+
+    if (d == 0) {
+	d = (x->len > y->len) - (x->len < y->len);
+    }
+    return d;
+}
+
+/*
+ * flush_sorted writes and discards the records collected by
+ * rec_emit().
+ */
+static void flush_sorted(void)
+{
+    size_t i;
+
+    qsort(output.lines, output.count, sizeof(struct line *), by_line);
+    for (i = 0; i < output.count; i++) {
+	fwrite(output.lines[i]->data, 1, output.lines[i]->len, stdout);
+	free(output.lines[i]);
+    }
+    output.count = 0;
+}
+
+/*
+ * show_record outputs fname in the selected format. The text form of
+ * its capabilities, cap_d, is result. The machine readable formats
+ * also report the revision and effective bit of the raw xattr. When
+ * the caller does not have it (bytes < 0) it is reread here, since
+ * only a small fraction of files have one.
+ */
+static void show_record(const char *fname, cap_t cap_d, const char *result,
+			int regular, const struct vfs_ns_cap_data *known,
+			ssize_t bytes)
+{
+    struct vfs_ns_cap_data raw;
+    ssize_t i;
+    __u32 magic = 0;
+    uid_t rootid = 0;
+
+    if (format == FORMAT_TEXT) {
+	if (!regular) {
+	    rec_printf("%s (Not a regular file)\n", fname);
+	} else if (cap_d == NULL) {
+	    rec_printf("%s\n", fname);
+	} else {
+	    rootid = cap_get_nsowner(cap_d);
+	    if (namespace && (rootid+1 > 1)) {
+		rec_printf("%s %s [rootid=%d]\n", fname, result, rootid);
+	    } else {
+		rec_printf("%s %s\n", fname, result);
+	    }
+	}
+	rec_emit();
+	return;
+    }
+
+    if (cap_d != NULL) {
+	rootid = cap_get_nsowner(cap_d);
+	if (bytes < 0) {
+	    bytes = getxattr(fname, "security.capability", &raw, sizeof(raw));
+	} else {
+	    memcpy(&raw, known, bytes);
+	}
+	if (bytes >= (ssize_t) sizeof(raw.magic_etc)) {
+	    magic = le32toh(raw.magic_etc);
+	}
+    }
+
+    switch (format) {
+    case FORMAT_JSONL:
+	rec_put("{\"path\":", 8);
+	rec_json(fname);
+	if (cap_d == NULL) {
+	    rec_printf(",\"caps\":null%s}\n",
+		       regular ? "" : ",\"regular\":false");
+	    break;
+	}
+	rec_put(",\"caps\":", 8);
+	rec_json(result);
+	if (magic) {
+	    rec_printf(",\"revision\":\"0x%08x\"",
+		       magic & VFS_CAP_REVISION_MASK);
+	} else {
+	    rec_printf(",\"revision\":null");
+	}
+	rec_printf(",\"rootid\":%u,\"effective\":%s}\n", rootid,
+		   (magic & VFS_CAP_FLAGS_EFFECTIVE) ? "true" : "false");
+	break;
+
+    case FORMAT_NUL:
+	rec_put(fname, strlen(fname) + 1);
+	if (cap_d == NULL) {
+	    rec_put("\0\0\0\0", 4);
+	    break;
+	}
+	rec_put(result, strlen(result) + 1);
+	if (magic) {
+	    rec_printf("0x%08x", magic & VFS_CAP_REVISION_MASK);
+	}
+	rec_printf("%c%u%c%d%c", 0, rootid, 0,
+		   (magic & VFS_CAP_FLAGS_EFFECTIVE) != 0, 0);
+	break;
+
+    default:
+	rec_put(fname, strlen(fname) + 1);
+	for (i = 0; i < bytes; i++) {
+	    rec_printf("%02x", ((unsigned char *) &raw)[i]);
+	}
+	rec_put("", 1);
+	break;
+    }
+    rec_emit();
+}
+
+/*
+ * show_raw_caps displays the capabilities, cap_d, of fname. A NULL
+ * cap_d indicates the file has none, or that errno explains why they
+ * could not be read. The raw xattr they were decoded from is passed
+ * when it is known.
+ */
+static void show_raw_caps(const char *fname, cap_t cap_d,
+			  const struct vfs_ns_cap_data *raw, ssize_t bytes)
+{
+    char *result;
 
-    cap_d = cap_get_file(fname);
     if (cap_d == NULL) {
 	if (errno != ENODATA && errno != ENOTSUP) {
 	    fprintf(stderr, "Failed to get capabilities of file '%s' (%s)\n",
 		    fname, strerror(errno));
 	} else if (verbose) {
-	    printf("%s\n", fname);
+	    show_record(fname, NULL, NULL, 1, NULL, -1);
 	}
-	return 0;
+	return;
     }
 
     result = cap_to_text(cap_d, NULL);
@@ -63,27 +377,874 @@ static int do_getcap(const char *fname, const struct stat *stbuf,
 	fprintf(stderr,
 		"Failed to get capabilities of human readable format at '%s' (%s)\n",
 		fname, strerror(errno));
+	return;
+    }
+    show_record(fname, cap_d, result, 1, raw, bytes);
+    cap_free(result);
+}
+
+static void show_caps(const char *fname, cap_t cap_d)
+{
+    show_raw_caps(fname, cap_d, NULL, -1);
+}
+
+/*
+ * The index (--index=<file>) records the ctime and capabilities of
+ * every regular file examined by a run of getcap. A later run
+ * consults it and, for files whose inode still has the recorded
+ * ctime, reuses the recorded capabilities instead of reading the
+ * xattr (setting an xattr always updates the ctime). The file is
+ * written in native byte order, and is replaced at the end of each
+ * run that examines files:
+ *
+ *    struct index_header
+ *    struct index_record[records]  (sorted by dev, ino)
+ *    struct index_caps[capped]
+ *    char strings[strings]         (NUL terminated paths)
+ *
+ * Only files with capabilities have their path recorded, which is
+ * all that is needed to list them offline (--index=<file> without
+ * any filenames). Every record also names the filename argument
+ * (root) it was examined under, and whether that was walked with -r,
+ * so a later run over the same root can drop the records of files
+ * that have gone.
+ */
+#define INDEX_MAGIC   "LCAPIDX2"
+#define INDEX_NOCAPS  0xffffffffU
+#define INDEX_WALKED  1U
+
+struct index_header {
+    char magic[8];
+    uint32_t records;
+    uint32_t capped;
+    uint64_t strings;
+};
+
+struct index_record {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t caps;
+    uint32_t root;
+    uint32_t flags;
+};
+
+struct index_caps {
+    uint32_t path;
+    uint32_t len;
+    unsigned char xattr[sizeof(struct vfs_ns_cap_data)];
+};
+
+static struct {
+    const char *file;
+    /* the previous index, mapped read-only */
+    void *map;
+    size_t map_size;
+    const struct index_record *records;
+    const struct index_caps *caps;
+    const char *strings;
+    uint32_t count, capped;
+    /* the index being built */
+    struct index_record *recs;
+    struct index_caps *ncaps;
+    char *strs;
+    size_t nrecs, recs_size, ncapped, caps_size, strs_len, strs_size;
+    long reused, queried;
+    /* the filename arguments of this run */
+    char *const *args;
+    /* the root strings of the index being built */
+    const char **roots;
+    uint32_t *root_offs;
+    size_t nroots, roots_size;
+    /* the root and flags of the files now being examined */
+    uint32_t root, flags;
+} idx;
+
+/*
+ * index_load maps the index in file. A missing or malformed index is
+ * treated as an empty one, as is (silently) one written in an older
+ * format. Every record is checked here, so the rest of the code can
+ * trust their lengths and paths.
+ */
+static void index_load(const char *file)
+{
+    const struct index_header *h;
+    struct stat st;
+    size_t need;
+    uint32_t i;
+    int fd;
+
+    idx.file = file;
+    fd = open(file, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+	if (errno != ENOENT) {
+	    fprintf(stderr, "getcap: unable to read index '%s' (%s)\n",
+		    file, strerror(errno));
+	}
+	return;
+    }
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(*h)) {
+	goto bad;
+    }
+    idx.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (idx.map == MAP_FAILED) {
+	idx.map = NULL;
+	goto bad;
+    }
+    idx.map_size = st.st_size;
+    h = idx.map;
+    if (!memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic) - 1) &&
+	memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic))) {
+	munmap(idx.map, idx.map_size);
+	idx.map = NULL;
+	close(fd);
+	return;
+    }
+    need = sizeof(*h) + h->records * sizeof(struct index_record)
+	+ h->capped * sizeof(struct index_caps);
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) ||
+	need > idx.map_size || h->strings != idx.map_size - need ||
+	(h->strings && ((const char *) idx.map)[idx.map_size - 1])) {
+	munmap(idx.map, idx.map_size);
+	idx.map = NULL;
+	goto bad;
+    }
+    idx.records = (const void *) (h + 1);
+    idx.caps = (const void *) (idx.records + h->records);
+    idx.strings = (const char *) (idx.caps + h->capped);
+    for (i = 0; i < h->capped; i++) {
+	if (idx.caps[i].len > sizeof(idx.caps[i].xattr) ||
+	    idx.caps[i].path >= h->strings) {
+	    goto unmap;
+	}
+    }
+    for (i = 0; i < h->records; i++) {
+	if (idx.records[i].root >= h->strings) {
+	    goto unmap;
+	}
+    }
+    idx.count = h->records;
+    idx.capped = h->capped;
+    close(fd);
+    return;
+
+unmap:
+    munmap(idx.map, idx.map_size);
+    idx.map = NULL;
+    idx.records = NULL;
+    idx.caps = NULL;
+    idx.strings = NULL;
+bad:
+    fprintf(stderr, "getcap: ignoring malformed index '%s'\n", file);
+    close(fd);
+}
+
+/*
+ * index_lookup returns the recorded capabilities of the file
+ * described by st, if its ctime has not changed since they were
+ * recorded.
+ */
+static const struct index_caps *index_lookup(const struct stat *st,
+					     int *found)
+{
+    const struct index_record *r;
+    uint32_t lo = 0, hi = idx.count;
+
+    *found = 0;
+    while (lo < hi) {
+	uint32_t mid = lo + (hi - lo) / 2;
+	r = &idx.records[mid];
+	if (r->dev < (uint64_t) st->st_dev ||
+	    (r->dev == (uint64_t) st->st_dev && r->ino < (uint64_t) st->st_ino)) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    if (lo == idx.count) {
+	return NULL;
+    }
+    r = &idx.records[lo];
+    if (r->dev != (uint64_t) st->st_dev || r->ino != (uint64_t) st->st_ino ||
+	r->ctime_sec != st->st_ctim.tv_sec ||
+	r->ctime_nsec != (uint32_t) st->st_ctim.tv_nsec) {
+	return NULL;
+    }
+    *found = 1;
+    if (r->caps >= idx.capped) {
+	return NULL;
+    }
+    return &idx.caps[r->caps];
+}
+
+/*
+ * index_string appends the string s to the strings of the index
+ * being built, and returns its offset.
+ */
+static uint32_t index_string(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    uint32_t off = idx.strs_len;
+
+    if (idx.strs_len + len > idx.strs_size) {
+	idx.strs_size = 2 * (idx.strs_len + len) + 4096;
+	idx.strs = checked(realloc(idx.strs, idx.strs_size));
+    }
+    memcpy(idx.strs + idx.strs_len, s, len);
+    idx.strs_len += len;
+    return off;
+}
+
+/*
+ * index_root returns the offset of the root string, root, in the
+ * index being built, adding it the first time it is used.
+ */
+static uint32_t index_root(const char *root)
+{
+    size_t i;
+
+    for (i = 0; i < idx.nroots; i++) {
+	if (idx.roots[i] == root || !strcmp(idx.roots[i], root)) {
+	    return idx.root_offs[i];
+	}
+    }
+    if (idx.nroots == idx.roots_size) {
+	idx.roots_size = idx.roots_size ? 2*idx.roots_size : 8;
+	idx.roots = checked(realloc(idx.roots,
+				    idx.roots_size * sizeof(*idx.roots)));
+	idx.root_offs = checked(realloc(idx.root_offs, idx.roots_size *
+					sizeof(*idx.root_offs)));
+    }
+    idx.roots[idx.nroots] = root;
+    return idx.root_offs[idx.nroots++] = index_string(root);
+}
+
+/*
+ * index_add records the capabilities (bytes < 0 for none) of the
+ * file fname described by st, in the index being built. The record
+ * is attributed to the root being examined.
+ */
+static struct index_record *index_add(const struct stat *st,
+				      const char *fname,
+				      const void *xattr, ssize_t bytes)
+{
+    struct index_record *r;
+    struct index_caps *c;
+
+    if (idx.nrecs == idx.recs_size) {
+	idx.recs_size = idx.recs_size ? 2*idx.recs_size : 4096;
+	idx.recs = checked(realloc(idx.recs,
+				   idx.recs_size * sizeof(*idx.recs)));
+    }
+    r = &idx.recs[idx.nrecs++];
+    r->dev = st->st_dev;
+    r->ino = st->st_ino;
+    r->ctime_sec = st->st_ctim.tv_sec;
+    r->ctime_nsec = st->st_ctim.tv_nsec;
+    r->caps = INDEX_NOCAPS;
+    r->root = idx.root;
+    r->flags = idx.flags;
+    if (bytes < 0) {
+	return r;
+    }
+
+    if (idx.ncapped == idx.caps_size) {
+	idx.caps_size = idx.caps_size ? 2*idx.caps_size : 64;
+	idx.ncaps = checked(realloc(idx.ncaps,
+				    idx.caps_size * sizeof(*idx.ncaps)));
+    }
+    r->caps = idx.ncapped;
+    c = &idx.ncaps[idx.ncapped++];
+    memset(c, 0, sizeof(*c));
+    c->path = index_string(fname);
+    c->len = bytes;
+    memcpy(c->xattr, xattr, bytes);
+    return r;
+}
+
+static int by_inode(const void *a, const void *b)
+{
+    const struct index_record *x = a, *y = b;
+
+    if (x->dev != y->dev) {
+	return x->dev < y->dev ? -1 : 1;
+    }
+    return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+/*
+ * index_scanned returns 1 if path is one of this run's filename
+ * arguments, or, when recursive, lies below one of them.
+ */
+static int index_scanned(const char *path)
+{
+    char *const *arg;
+
+    for (arg = idx.args; *arg != NULL; arg++) {
+	size_t n = strlen(*arg);
+	if (strncmp(path, *arg, n)) {
+	    continue;
+	}
+	if (path[n] == '\0' ||
+	    (recursive && (path[n] == '/' || (n && (*arg)[n-1] == '/')))) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * index_merge carries over the records of the previous index for the
+ * files this run did not examine, so a run over part of a tree does
+ * not discard the rest. Records of files this run should have
+ * examined, but did not find, are dropped: those with capabilities
+ * by their path, the others by their root (all of whose files were
+ * examined if it was scanned, and also walked by this run when it
+ * was walked before).
+ */
+static void index_merge(void)
+{
+    size_t visited = idx.nrecs;
+    uint32_t i;
+
+    qsort(idx.recs, visited, sizeof(*idx.recs), by_inode);
+    for (i = 0; i < idx.count; i++) {
+	const struct index_record *r = &idx.records[i];
+	const struct index_caps *c = NULL;
+	struct index_record *n;
+	struct stat st;
+
+	if (bsearch(r, idx.recs, visited, sizeof(*r), by_inode) != NULL) {
+	    continue;
+	}
+	if (r->caps < idx.capped) {
+	    c = &idx.caps[r->caps];
+	    if (index_scanned(idx.strings + c->path)) {
+		continue;
+	    }
+	} else if ((recursive || !(r->flags & INDEX_WALKED)) &&
+		   index_scanned(idx.strings + r->root)) {
+	    continue;
+	}
+	memset(&st, 0, sizeof(st));
+	st.st_dev = r->dev;
+	st.st_ino = r->ino;
+	st.st_ctim.tv_sec = r->ctime_sec;
+	st.st_ctim.tv_nsec = r->ctime_nsec;
+	if (c == NULL) {
+	    n = index_add(&st, NULL, NULL, -1);
+	} else {
+	    n = index_add(&st, idx.strings + c->path, c->xattr, c->len);
+	}
+	n->root = index_root(idx.strings + r->root);
+	n->flags = r->flags;
+    }
+}
+
+/*
+ * index_save replaces the index file with the one built by this run,
+ * merged with the unexamined part of the previous one.
+ */
+static int index_save(void)
+{
+    struct index_header h;
+    size_t len = strlen(idx.file) + 5;
+    char *tmp = checked(malloc(len));
+    FILE *f;
+    int ok;
+
+    index_merge();
+    qsort(idx.recs, idx.nrecs, sizeof(*idx.recs), by_inode);
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.records = idx.nrecs;
+    h.capped = idx.ncapped;
+    h.strings = idx.strs_len;
+
+    snprintf(tmp, len, "%s.new", idx.file);
+    f = fopen(tmp, "we");
+    ok = f != NULL &&
+	fwrite(&h, sizeof(h), 1, f) == 1 &&
+	fwrite(idx.recs, sizeof(*idx.recs), idx.nrecs, f) == idx.nrecs &&
+	fwrite(idx.ncaps, sizeof(*idx.ncaps), idx.ncapped, f) == idx.ncapped &&
+	fwrite(idx.strs, 1, idx.strs_len, f) == idx.strs_len &&
+	fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (f != NULL && fclose(f)) {
+	ok = 0;
+    }
+    if (!ok || rename(tmp, idx.file)) {
+	fprintf(stderr, "getcap: unable to write index '%s' (%s)\n",
+		idx.file, strerror(errno));
+	unlink(tmp);
+	ok = 0;
+    }
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+/*
+ * caps_from_xattr converts a security.capability value to a cap_t.
+ */
+static cap_t caps_from_xattr(const void *xattr, size_t len)
+{
+    cap_value_t p[64], in[64], e[64];
+    int np = 0, ni = 0, ne = 0;
+    struct cap_fcaps f;
+    cap_value_t v;
+    cap_t cap_d;
+
+    if (cap_fcaps_decode(xattr, len, &f) || (cap_d = cap_init()) == NULL) {
+	return NULL;
+    }
+    for (v = 0; v < 64; v++) {
+	uint32_t mask = 1U << (v & 31);
+	int pv = (f.permitted[v >> 5] & mask) != 0;
+	int iv = (f.inheritable[v >> 5] & mask) != 0;
+	if (pv) {
+	    p[np++] = v;
+	}
+	if (iv) {
+	    in[ni++] = v;
+	}
+	if (f.effective && (pv || iv)) {
+	    e[ne++] = v;
+	}
+    }
+    if ((np && cap_set_flag(cap_d, CAP_PERMITTED, np, p, CAP_SET)) ||
+	(ni && cap_set_flag(cap_d, CAP_INHERITABLE, ni, in, CAP_SET)) ||
+	(ne && cap_set_flag(cap_d, CAP_EFFECTIVE, ne, e, CAP_SET)) ||
+	cap_set_nsowner(cap_d, f.rootid)) {
 	cap_free(cap_d);
-	return 0;
+	return NULL;
     }
-    rootid = cap_get_nsowner(cap_d);
-    if (namespace && (rootid+1 > 1)) {
-	printf("%s %s [rootid=%d]\n", fname, result, rootid);
+    return cap_d;
+}
+
+/*
+ * index_getcap displays the capabilities of the regular file fname,
+ * described by st, reusing the indexed values when they are current.
+ */
+static void index_getcap(const char *fname, const struct stat *st)
+{
+    const struct index_caps *c;
+    struct vfs_ns_cap_data raw;
+    ssize_t bytes;
+    cap_t cap_d;
+    int found;
+
+    c = index_lookup(st, &found);
+    if (found) {
+	idx.reused++;
+	if (c == NULL) {
+	    index_add(st, fname, NULL, -1);
+	    errno = ENODATA;
+	    show_caps(fname, NULL);
+	    return;
+	}
+	bytes = c->len;
+	if ((size_t) bytes > sizeof(raw)) {
+	    errno = EINVAL;
+	    show_caps(fname, NULL);
+	    return;
+	}
+	memcpy(&raw, c->xattr, bytes);
     } else {
-	printf("%s %s\n", fname, result);
+	idx.queried++;
+	bytes = getxattr(fname, "security.capability", &raw, sizeof(raw));
+	if (bytes < 0) {
+	    if (errno == ENODATA || errno == ENOTSUP) {
+		index_add(st, fname, NULL, -1);
+	    }
+	    show_caps(fname, NULL);
+	    return;
+	}
     }
+
+    cap_d = caps_from_xattr(&raw, bytes);
+    if (cap_d == NULL) {
+	errno = EINVAL;
+	show_caps(fname, NULL);
+	return;
+    }
+    index_add(st, fname, &raw, bytes);
+    show_raw_caps(fname, cap_d, &raw, bytes);
     cap_free(cap_d);
-    cap_free(result);
+}
+
+/*
+ * index_list displays the capabilities recorded in the index, without
+ * examining the files themselves.
+ */
+static void index_list(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < idx.capped; i++) {
+	const struct index_caps *c = &idx.caps[i];
+	cap_t cap_d = NULL;
+
+	cap_d = caps_from_xattr(c->xattr, c->len);
+	if (cap_d == NULL) {
+	    fprintf(stderr, "getcap: bad index entry %u\n", i);
+	    continue;
+	}
+	show_raw_caps(idx.strings + c->path, cap_d,
+		      (const void *) c->xattr, c->len);
+	cap_free(cap_d);
+    }
+}
+
+static int do_getcap(const char *fname, const struct stat *stbuf,
+		     int tflag, struct FTW* ftwbuf)
+{
+    cap_t cap_d;
+
+    entries++;
+    if (tflag != FTW_F) {
+	if (verbose) {
+	    show_record(fname, NULL, NULL, 0, NULL, -1);
+	}
+	return 0;
+    }
+
+    if (idx.file != NULL) {
+	index_getcap(fname, stbuf);
+	return 0;
+    }
+    cap_d = cap_get_file(fname);
+    show_caps(fname, cap_d);
+    cap_free(cap_d);
+    return 0;
+}
+
+#ifdef GETCAP_THREADS
+
+/*
+ * The parallel walker (-j) reads each directory with cap_scan_dir(),
+ * which names everything relative to a dirfd. Each worker keeps a deque of
+ * directories still to be read: it pushes and pops the directories
+ * it discovers at the tail (depth first), and when it runs out it
+ * steals the oldest directory from the head of another worker's
+ * deque. A queued directory holds its open dirfd while the total
+ * stays within fd_budget, beyond that it is reopened by path.
+ */
+struct job {
+    char *path;
+    int fd;
+};
+
+struct worker {
+    pthread_t thread;
+    int id;
+    pthread_mutex_t mu;
+    struct job *jobs;
+    size_t head, tail, size;
+    long entries;
+    char *path;
+    size_t path_size;
+};
+
+static struct {
+    struct worker *workers;
+    int count;
+    long pending;	/* directories queued or being read */
+    long queued;	/* directories queued */
+    int sleepers;
+    long held_fds;
+    long fd_budget;
+    pthread_mutex_t mu;
+    pthread_cond_t cond;
+} walk = {
+    .mu = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void push_job(struct worker *w, char *path, int fd)
+{
+    __atomic_add_fetch(&walk.pending, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&w->mu);
+    if (w->tail == w->size) {
+	if (w->head) {
+	    memmove(w->jobs, w->jobs + w->head,
+		    (w->tail - w->head) * sizeof(struct job));
+	    w->tail -= w->head;
+	    w->head = 0;
+	}
+	if (w->tail == w->size) {
+	    size_t size = w->size ? 2*w->size : 64;
+	    struct job *jobs = realloc(w->jobs, size * sizeof(struct job));
+	    if (jobs == NULL) {
+		perror("getcap: out of memory");
+		exit(1);
+	    }
+	    w->jobs = jobs;
+	    w->size = size;
+	}
+    }
+    w->jobs[w->tail].path = path;
+    w->jobs[w->tail].fd = fd;
+    w->tail++;
+    pthread_mutex_unlock(&w->mu);
+
+    __atomic_add_fetch(&walk.queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&walk.sleepers, __ATOMIC_SEQ_CST)) {
+	pthread_mutex_lock(&walk.mu);
+	pthread_cond_signal(&walk.cond);
+	pthread_mutex_unlock(&walk.mu);
+    }
+}
+
+/*
+ * take_job removes a job from the tail (owner) or head (thief) of
+ * w's deque.
+ */
+static int take_job(struct worker *w, int steal, struct job *job)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&w->mu);
+    if (w->tail > w->head) {
+	*job = steal ? w->jobs[w->head++] : w->jobs[--w->tail];
+	if (w->head == w->tail) {
+	    w->head = w->tail = 0;
+	}
+	found = 1;
+    }
+    pthread_mutex_unlock(&w->mu);
+
+    if (found) {
+	__atomic_sub_fetch(&walk.queued, 1, __ATOMIC_SEQ_CST);
+    }
+    return found;
+}
+
+/*
+ * next_job obtains the next directory for w to read. It returns 0
+ * once every directory has been read.
+ */
+static int next_job(struct worker *w, struct job *job)
+{
+    for (;;) {
+	int i, done;
+
+	if (take_job(w, 0, job)) {
+	    return 1;
+	}
+	for (i = 1; i < walk.count; i++) {
+	    if (take_job(&walk.workers[(w->id + i) % walk.count], 1, job)) {
+		return 1;
+	    }
+	}
+
+	pthread_mutex_lock(&walk.mu);
+	__atomic_add_fetch(&walk.sleepers, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&walk.queued, __ATOMIC_SEQ_CST) == 0 &&
+	       __atomic_load_n(&walk.pending, __ATOMIC_SEQ_CST) != 0) {
+	    pthread_cond_wait(&walk.cond, &walk.mu);
+	}
+	__atomic_sub_fetch(&walk.sleepers, 1, __ATOMIC_SEQ_CST);
+	done = __atomic_load_n(&walk.pending, __ATOMIC_SEQ_CST) == 0;
+	pthread_mutex_unlock(&walk.mu);
+	if (done) {
+	    return 0;
+	}
+    }
+}
+
+static void finish_job(void)
+{
+    if (__atomic_sub_fetch(&walk.pending, 1, __ATOMIC_SEQ_CST) == 0) {
+	pthread_mutex_lock(&walk.mu);
+	pthread_cond_broadcast(&walk.cond);
+	pthread_mutex_unlock(&walk.mu);
+    }
+}
+
+/*
+ * struct scan tracks the directory being read by a worker.
+ */
+struct scan {
+    struct worker *w;
+    const char *dir;
+    size_t dlen;
+    const char *sep;
+};
+
+/*
+ * scan_entry is the cap_scan_dir() callback. It displays the
+ * capabilities of files and queues subdirectories. The path of each
+ * file is formatted in a buffer kept by the worker.
+ */
+static int scan_entry(int dirfd, const char *name, int type, cap_t caps,
+		      void *data)
+{
+    struct scan *sc = data;
+    struct worker *w = sc->w;
+    size_t len = sc->dlen + strlen(name) + 2;
+    int err = errno, fd = -1;
+    char *path;
+
+    w->entries++;
+    if (len > w->path_size) {
+	path = realloc(w->path, 2*len);
+	if (path == NULL) {
+	    perror("getcap: out of memory");
+	    exit(1);
+	}
+	w->path = path;
+	w->path_size = 2*len;
+    }
+    sprintf(w->path, "%s%s%s", sc->dir, sc->sep, name);
 
+    if (type != DT_DIR && type != DT_LNK) {
+	/* As with nftw(FTW_PHYS), everything else is a file. */
+	errno = (type == DT_REG) ? err : ENODATA;
+	show_caps(w->path, caps);
+	return 0;
+    }
+    if (verbose) {
+	show_record(w->path, NULL, NULL, 0, NULL, -1);
+    }
+    if (type == DT_LNK) {
+	return 0;
+    }
+
+    if (__atomic_add_fetch(&walk.held_fds, 1, __ATOMIC_SEQ_CST)
+	<= walk.fd_budget) {
+	fd = openat(dirfd, name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    }
+    if (fd < 0) {
+	__atomic_sub_fetch(&walk.held_fds, 1, __ATOMIC_SEQ_CST);
+    }
+    path = strdup(w->path);
+    if (path == NULL) {
+	perror("getcap: out of memory");
+	exit(1);
+    }
+    push_job(w, path, fd);
     return 0;
 }
 
+static void read_dir(struct worker *w, struct job *job)
+{
+    size_t plen = strlen(job->path);
+    struct scan sc = {
+	.w = w,
+	.dir = job->path,
+	.dlen = plen,
+	.sep = (plen && job->path[plen-1] == '/') ? "" : "/",
+    };
+    int dfd = job->fd;
+
+    if (dfd >= 0) {
+	__atomic_sub_fetch(&walk.held_fds, 1, __ATOMIC_SEQ_CST);
+    } else {
+	dfd = open(job->path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (dfd < 0) {
+	    return;
+	}
+    }
+    cap_scan_dir(dfd, scan_entry, &sc);
+    close(dfd);
+}
+
+static void *walker(void *arg)
+{
+    struct worker *w = arg;
+    struct job job;
+
+    while (next_job(w, &job)) {
+	read_dir(w, &job);
+	free(job.path);
+	finish_job();
+    }
+    return NULL;
+}
+
+/*
+ * parallel_walk scans the directory tree below top using the
+ * configured number of threads.
+ */
+static void parallel_walk(const char *top)
+{
+    struct rlimit rl;
+    char *path;
+    int i;
+
+    walk.count = threads;
+    walk.workers = calloc(threads, sizeof(struct worker));
+    path = strdup(top);
+    if (walk.workers == NULL || path == NULL) {
+	perror("getcap: out of memory");
+	exit(1);
+    }
+    walk.fd_budget = 256;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+	walk.fd_budget = (long) rl.rlim_cur / 2 - 2*threads;
+    }
+
+    for (i = 0; i < threads; i++) {
+	walk.workers[i].id = i;
+	pthread_mutex_init(&walk.workers[i].mu, NULL);
+    }
+    push_job(&walk.workers[0], path, -1);
+    for (i = 0; i < threads; i++) {
+	if (pthread_create(&walk.workers[i].thread, NULL, walker,
+			   &walk.workers[i])) {
+	    perror("getcap: unable to start thread");
+	    exit(1);
+	}
+    }
+    for (i = 0; i < threads; i++) {
+	pthread_join(walk.workers[i].thread, NULL);
+	entries += walk.workers[i].entries;
+	pthread_mutex_destroy(&walk.workers[i].mu);
+	free(walk.workers[i].jobs);
+	free(walk.workers[i].path);
+    }
+    free(walk.workers);
+    walk.workers = NULL;
+}
+
+#endif /* def GETCAP_THREADS */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 int main(int argc, char **argv)
 {
-    int i, c;
+    static const struct option longopts[] = {
+	{ "format", required_argument, NULL, 'f' },
+	{ "index", required_argument, NULL, 'I' },
+	{ NULL, 0, NULL, 0 }
+    };
+    const char *index_file = NULL;
+    int i, c, throughput = 0, status = 0;
+    double start;
 
-    while ((c = getopt(argc, argv, "rvhnl")) > 0) {
+    while ((c = getopt_long(argc, argv, "rvhnlstj:", longopts, NULL)) > 0) {
 	switch(c) {
+	case 'f':
+	    if (!strcmp(optarg, "text")) {
+		format = FORMAT_TEXT;
+	    } else if (!strcmp(optarg, "jsonl")) {
+		format = FORMAT_JSONL;
+	    } else if (!strcmp(optarg, "nul")) {
+		format = FORMAT_NUL;
+	    } else if (!strcmp(optarg, "raw")) {
+		format = FORMAT_RAW;
+	    } else {
+		usage(1);
+	    }
+	    break;
+	case 'I':
+	    index_file = optarg;
+	    break;
 	case 'r':
 	    recursive = 1;
 	    break;
@@ -93,6 +1254,21 @@ int main(int argc, char **argv)
 	case 'n':
 	    namespace = 1;
 	    break;
+	case 's':
+	    sorted = 1;
+	    break;
+	case 't':
+	    throughput = 1;
+	    break;
+	case 'j':
+	    threads = atoi(optarg);
+	    if (threads == 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	    }
+	    if (threads < 1) {
+		usage(1);
+	    }
+	    break;
 	case 'h':
 	    usage(0);
 	case 'l':
@@ -105,14 +1281,52 @@ int main(int argc, char **argv)
 	}
     }
 
-    if (!argv[optind])
+    if (!argv[optind] && index_file == NULL)
 	usage(1);
 
+#ifndef GETCAP_THREADS
+    if (threads > 1) {
+	fprintf(stderr, "getcap: built without thread support, ignoring -j\n");
+	threads = 1;
+    }
+#endif
+
+    if (!isatty(STDOUT_FILENO)) {
+	setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+    }
+
+    if (index_file != NULL) {
+	idx.args = &argv[optind];
+	index_load(index_file);
+	if (!argv[optind]) {
+	    index_list();
+	    if (sorted) {
+		flush_sorted();
+	    }
+	    return 0;
+	}
+	if (threads > 1) {
+	    /* The index is built by a single (nftw) walker. */
+	    fprintf(stderr, "getcap: --index ignores -j\n");
+	    threads = 1;
+	}
+    }
+
+    start = now_sec();
     for (i=optind; argv[i] != NULL; i++) {
 	struct stat stbuf;
 	char *arg = argv[i];
+	if (index_file != NULL) {
+	    idx.root = index_root(arg);
+	    idx.flags = recursive ? INDEX_WALKED : 0;
+	}
 	if (lstat(arg, &stbuf) != 0) {
 	    fprintf(stderr, "%s (%s)\n", arg, strerror(errno));
+	} else if (recursive && threads > 1 && S_ISDIR(stbuf.st_mode)) {
+	    do_getcap(arg, &stbuf, FTW_D, 0);
+#ifdef GETCAP_THREADS
+	    parallel_walk(arg);
+#endif
 	} else if (recursive) {
 	    nftw(arg, do_getcap, 20, FTW_PHYS);
 	} else {
@@ -120,7 +1334,26 @@ int main(int argc, char **argv)
 		(S_ISLNK(stbuf.st_mode) ? FTW_SL : FTW_NS);
 	    do_getcap(argv[i], &stbuf, tflag, 0);
 	}
+	if (sorted) {
+	    flush_sorted();
+	}
     }
 
-    return 0;
+    if (throughput) {
+	double elapsed = now_sec() - start;
+	fflush(stdout);
+	fprintf(stderr, "getcap: %ld entries in %.3f sec (%.0f entries/sec,"
+		" %d thread%s)\n", entries, elapsed,
+		elapsed > 0 ? entries / elapsed : 0.0,
+		threads, threads == 1 ? "" : "s");
+	if (index_file != NULL) {
+	    fprintf(stderr, "getcap: index reused %ld, queried %ld\n",
+		    idx.reused, idx.queried);
+	}
+    }
+
+    if (index_file != NULL && index_save()) {
+	status = 1;
+    }
+    return status;
 }
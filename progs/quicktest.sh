@@ -283,6 +283,95 @@ else
 fi
 rm -f nsprivileged
 
+echo "testing setcap --manifest"
+touch ./manifest1 ./manifest2
+printf './manifest1\tcap_chown,cap_kill=p\n./manifest2\tcap_setuid=ep\n' \
+       > ./manifest.txt
+./setcap -q -j 2 --manifest ./manifest.txt && \
+    ./setcap -v --manifest ./manifest.txt | grep -F "2 files verified, 0 failed"
+if [ $? -ne 0 ]; then
+    echo "FAILED to apply a manifest"
+    exit 1
+fi
+./getcap -s ./manifest1 ./manifest2 | grep -F "./manifest2 cap_setuid=ep"
+if [ $? -ne 0 ]; then
+    echo "FAILED to set capabilities from a manifest"
+    exit 1
+fi
+printf './manifest1\t-r\n' | ./setcap -q -v --manifest -
+if [ $? -eq 0 ]; then
+    echo "FAILED to detect a manifest difference"
+    exit 1
+fi
+./setcap --converge --manifest ./manifest.txt | \
+    grep -F "0 changed, 2 unchanged, 0 removed, 0 failed"
+if [ $? -ne 0 ]; then
+    echo "FAILED to converge an applied manifest"
+    exit 1
+fi
+./setcap --converge cap_kill=p ./manifest1 -r ./manifest2 | \
+    grep -F "1 changed, 0 unchanged, 1 removed"
+if [ $? -ne 0 ]; then
+    echo "FAILED to converge changed capabilities"
+    exit 1
+fi
+
+echo "testing getcap --format=jsonl escaping"
+jname=$(printf './json\303\251\377')
+touch "${jname}" && ./setcap cap_kill=p "${jname}" && \
+    ./getcap --format=jsonl "${jname}" | \
+	grep -F "\"path\":\"./json$(printf '\303\251')\\udcff\""
+if [ $? -ne 0 ]; then
+    echo "FAILED to escape a file name that is not UTF-8"
+    exit 1
+fi
+rm -f "${jname}"
+
+echo "testing getcap --index"
+rm -f ./getcap.idx
+./getcap --index=./getcap.idx ./manifest1 ./manifest2 > /dev/null && \
+    ./getcap -t --index=./getcap.idx ./manifest1 ./manifest2 2>&1 | \
+	grep -F "index reused 2, queried 0"
+if [ $? -ne 0 ]; then
+    echo "FAILED to reuse an unchanged index"
+    exit 1
+fi
+./setcap cap_setgid=p ./manifest2
+./getcap -s --index=./getcap.idx ./manifest1 ./manifest2 | \
+    grep -F "./manifest2 cap_setgid=p" && \
+    ./getcap --index=./getcap.idx | grep -F "./manifest1 cap_kill=p"
+if [ $? -ne 0 ]; then
+    echo "FAILED to refresh a changed index"
+    exit 1
+fi
+./getcap --index=./getcap.idx ./manifest2 > /dev/null && \
+    ./getcap --index=./getcap.idx | grep -F "./manifest1 cap_kill=p"
+if [ $? -ne 0 ]; then
+    echo "FAILED to keep unexamined files in the index"
+    exit 1
+fi
+rm -rf ./idxtree ./tree.idx ./fresh.idx
+mkdir ./idxtree && touch ./idxtree/a ./idxtree/b ./idxtree/c && \
+    ./setcap cap_kill=p ./idxtree/c && \
+    ./getcap -r --index=./tree.idx ./idxtree > /dev/null && \
+    touch ./idxtree/d && rm -f ./idxtree/a ./idxtree/c && \
+    ./getcap -r --index=./tree.idx ./idxtree > /dev/null && \
+    ./getcap -r --index=./fresh.idx ./idxtree > /dev/null && \
+    cmp ./tree.idx ./fresh.idx
+if [ $? -ne 0 ]; then
+    echo "FAILED to drop deleted files from the index"
+    exit 1
+fi
+rm -rf ./idxtree ./tree.idx ./fresh.idx
+printf '\377\377\377\377' | \
+    dd of=./getcap.idx bs=1 seek=108 conv=notrunc 2> /dev/null
+./getcap --index=./getcap.idx 2>&1 | grep -F "ignoring malformed index"
+if [ $? -ne 0 ]; then
+    echo "FAILED to reject a corrupt index"
+    exit 1
+fi
+rm -f ./manifest1 ./manifest2 ./manifest.txt ./getcap.idx
+
 # If the build tree compiled the Go cap package.
 if [ -f ../go/compare-cap ]; then
     cp ../go/compare-cap .
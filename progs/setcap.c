@@ -6,17 +6,26 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/capability.h>
 #include <unistd.h>
 
+#ifdef SETCAP_THREADS
+#include <pthread.h>
+#endif
+
 static void usage(int status)
 {
     fprintf(stderr,
-	    "usage: setcap [--license] [-f] [-h] [-n <rootid>] [-q] [-v]"
-	    " (-r|-|<caps>) <filename> [ ... (-r|-|<capsN>) <filenameN> ]\n"
+	    "usage: setcap [--license] [--converge] [-f] [-h] [-n <rootid>]"
+	    " [-q] [-v]\n"
+	    "              (-r|-|<caps>) <filename>"
+	    " [ ... (-r|-|<capsN>) <filenameN> ]\n"
+	    "       setcap [--converge] [-f] [-n <rootid>] [-q] [-v] [-j <n>]"
+	    " --manifest <file>|-\n"
 	    "\n"
 	    " Note <filename> must be a regular (non-symlink) file.\n"
 	    " -r          remove capability from file\n"
@@ -24,9 +33,12 @@ static void usage(int status)
 	    " <capsN>     cap_from_text(3) formatted file capability\n"
 	    " [ Note: capsh --suggest=\"something...\" might help you pick. ]"
 	    "\n"
+	    " --converge  only write capabilities that differ from the file's\n"
 	    " --license   display the license info\n"
+	    " --manifest  apply (or -v verify) <filename><TAB><caps> lines\n"
 	    " -f          force setting even when the capability is invalid\n"
 	    " -h          this message and exit status 0\n"
+	    " -j <n>      apply a manifest with <n> threads\n"
 	    " -n <rootid> write a user namespace (!= 0) limited capability\n"
 	    " -q          quietly\n"
 	    " -v          validate supplied capability matches file\n"
@@ -97,13 +109,410 @@ static int read_caps(int quiet, const char *filename, char *buffer)
     return (i < MAXCAP ? 0:-1);
 }
 
+/*
+ * Linux's file capabilities have a compressed representation: the
+ * effective bits must either be empty, or exactly match the union of
+ * the permitted and inheritable bits. valid_effective explains, and
+ * returns 0, when cap_d cannot be represented.
+ */
+static int valid_effective(cap_t cap_d)
+{
+#ifdef linux
+    int explained = 0;
+    int somebits = 0;
+    cap_value_t cap;
+    cap_flag_value_t per_state;
+
+    for (cap = 0;
+	 cap_get_flag(cap_d, cap, CAP_PERMITTED, &per_state) != -1;
+	 cap++) {
+	cap_flag_value_t inh_state, eff_state, combined;
+
+	cap_get_flag(cap_d, cap, CAP_INHERITABLE, &inh_state);
+	cap_get_flag(cap_d, cap, CAP_EFFECTIVE, &eff_state);
+	combined = (inh_state | per_state);
+	somebits |= !!eff_state;
+	if (combined != eff_state) {
+	    explained = 1;
+	    break;
+	}
+    }
+    if (somebits && explained) {
+	fprintf(stderr, "Error: under Linux, effective file capabilities must either be empty, or\n"
+		"       exactly match the union of selected permitted and inheritable bits.\n");
+	return 0;
+    }
+#endif /* def linux */
+    return 1;
+}
+
+/*
+ * Raise the effective CAP_SETFCAP.
+ */
+static void raise_setfcap(cap_t mycaps)
+{
+    cap_value_t capflag = CAP_SETFCAP;
+
+    if (cap_set_flag(mycaps, CAP_EFFECTIVE, 1, &capflag, CAP_SET) != 0) {
+	perror("unable to manipulate CAP_SETFCAP - try a newer libcap?");
+	exit(1);
+    }
+    if (cap_set_proc(mycaps) != 0) {
+	perror("unable to set CAP_SETFCAP effective capability");
+	exit(1);
+    }
+}
+
+/*
+ * converge_state compares the capabilities on path with want (NULL
+ * meaning none), including their nsowner. It returns 0 if they are
+ * identical, 1 if they differ and -1 if they cannot be read.
+ */
+static int converge_state(const char *path, cap_t want)
+{
+    cap_t on_file;
+    int differs;
+
+    on_file = cap_get_fileat(AT_FDCWD, path, NULL, AT_SYMLINK_NOFOLLOW);
+    if (on_file == NULL) {
+	if (errno != ENODATA) {
+	    return -1;
+	}
+	return want != NULL;
+    }
+    differs = want == NULL || cap_compare(on_file, want) ||
+	cap_get_nsowner(on_file) != cap_get_nsowner(want);
+    cap_free(on_file);
+    return differs;
+}
+
+/*
+ * A manifest is a list of <filename><TAB><caps> lines, where <caps>
+ * is cap_from_text(3) formatted or "-r". Blank lines and lines
+ * starting with '#' are ignored. Each distinct <caps> text is parsed
+ * once, and the entries are applied (or verified) by one or more
+ * threads before the results are reported in manifest order.
+ */
+#define TEXT_BUCKETS 256
+
+struct parsed {
+    struct parsed *next;
+    char *text;
+    cap_t cap_d;
+    int bad;
+};
+
+enum outcome {
+    ENTRY_OK,
+    ENTRY_FAILED,
+    ENTRY_DIFFERS,
+    ENTRY_NOTHING,
+    ENTRY_UNCHANGED,
+    ENTRY_REMOVED,
+};
+
+struct entry {
+    char *path;
+    struct parsed *caps;
+    int line;
+    enum outcome outcome;
+    int err;
+};
+
+struct manifest {
+    struct entry *entries;
+    int count;
+    int next;
+    int verify;
+    int converge;
+    uid_t rootid;
+};
+
+static struct parsed *parse_caps(struct parsed **table, char *text,
+				 uid_t rootid, int forced)
+{
+    unsigned hash = 2166136261u;
+    struct parsed *p;
+    const char *c;
+
+    for (c = text; *c; c++) {
+	hash = (hash ^ (unsigned char) *c) * 16777619u;
+    }
+    for (p = table[hash % TEXT_BUCKETS]; p != NULL; p = p->next) {
+	if (!strcmp(p->text, text)) {
+	    return p;
+	}
+    }
+
+    p = calloc(1, sizeof(*p));
+    if (p == NULL || (p->text = strdup(text)) == NULL) {
+	perror("setcap: out of memory");
+	exit(1);
+    }
+    p->next = table[hash % TEXT_BUCKETS];
+    table[hash % TEXT_BUCKETS] = p;
+
+    if (!strcmp(text, "-r")) {
+	return p;
+    }
+    p->cap_d = cap_from_text(text);
+    if (p->cap_d == NULL) {
+	fprintf(stderr, "invalid capability text: %s\n", text);
+	p->bad = 1;
+    } else if (cap_set_nsowner(p->cap_d, rootid)) {
+	perror("unable to set nsowner");
+	exit(1);
+    } else if (!valid_effective(p->cap_d) && !forced) {
+	fprintf(stderr, "  in capability text: %s\n", text);
+	p->bad = 1;
+    }
+    return p;
+}
+
+/*
+ * read_manifest loads the manifest, name, (stdin for "-") into m.
+ * It returns the number of malformed lines.
+ */
+static int read_manifest(const char *name, struct manifest *m,
+			 struct parsed **table, int forced)
+{
+    FILE *f = stdin;
+    char *line = NULL;
+    size_t size = 0, allocated = 0;
+    ssize_t len;
+    int lineno = 0, errors = 0;
+
+    if (strcmp(name, "-")) {
+	f = fopen(name, "r");
+	if (f == NULL) {
+	    fprintf(stderr, "unable to open manifest '%s': %s\n", name,
+		    strerror(errno));
+	    exit(1);
+	}
+    }
+    while ((len = getline(&line, &size, f)) >= 0) {
+	struct entry *e;
+	char *tab;
+
+	lineno++;
+	if (len && line[len-1] == '\n') {
+	    line[--len] = '\0';
+	}
+	if (len == 0 || line[0] == '#') {
+	    continue;
+	}
+	tab = strrchr(line, '\t');
+	if (tab == NULL || tab == line || tab[1] == '\0') {
+	    fprintf(stderr, "%s:%d: want <filename><TAB><caps>\n",
+		    name, lineno);
+	    errors++;
+	    continue;
+	}
+	*tab = '\0';
+
+	if (m->count == allocated) {
+	    allocated = allocated ? 2*allocated : 1024;
+	    m->entries = realloc(m->entries, allocated * sizeof(struct entry));
+	    if (m->entries == NULL) {
+		perror("setcap: out of memory");
+		exit(1);
+	    }
+	}
+	e = &m->entries[m->count++];
+	memset(e, 0, sizeof(*e));
+	e->line = lineno;
+	e->path = strdup(line);
+	if (e->path == NULL) {
+	    perror("setcap: out of memory");
+	    exit(1);
+	}
+	e->caps = parse_caps(table, tab+1, m->rootid, forced);
+	if (e->caps->bad) {
+	    e->outcome = ENTRY_FAILED;
+	    e->err = EINVAL;
+	}
+    }
+    free(line);
+    if (f != stdin) {
+	fclose(f);
+    }
+    return errors;
+}
+
+static void apply_entry(struct manifest *m, struct entry *e)
+{
+    cap_t want = e->caps->cap_d;
+
+    if (e->outcome != ENTRY_OK) {
+	return;
+    }
+    if (m->verify) {
+	cap_t empty = NULL, on_file = cap_get_file(e->path);
+	int differs;
+
+	if (on_file == NULL && errno != ENODATA) {
+	    e->outcome = ENTRY_FAILED;
+	    e->err = errno;
+	    return;
+	}
+	if (want == NULL || on_file == NULL) {
+	    empty = cap_init();
+	}
+	differs = cap_compare(on_file ? on_file : empty, want ? want : empty)
+	    || cap_get_nsowner(on_file ? on_file : empty) !=
+	    cap_get_nsowner(want ? want : empty);
+	cap_free(on_file);
+	cap_free(empty);
+	if (differs) {
+	    e->outcome = ENTRY_DIFFERS;
+	}
+	return;
+    }
+
+    if (m->converge && converge_state(e->path, want) == 0) {
+	e->outcome = ENTRY_UNCHANGED;
+    } else if (cap_set_file(e->path, want) != 0) {
+	e->err = errno;
+	e->outcome = (want == NULL && errno == ENODATA) ?
+	    ENTRY_NOTHING : ENTRY_FAILED;
+    } else if (want == NULL) {
+	e->outcome = ENTRY_REMOVED;
+    }
+}
+
+static void *apply_entries(void *arg)
+{
+    struct manifest *m = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&m->next, 1, __ATOMIC_SEQ_CST))
+	   < m->count) {
+	apply_entry(m, &m->entries[i]);
+    }
+    return NULL;
+}
+
+/*
+ * do_manifest applies (or verifies) the manifest, name, and reports
+ * the outcome for each file. It returns 0 if every entry succeeded.
+ */
+static int do_manifest(const char *name, cap_t mycaps, int threads,
+		       int quiet, int verify, int converge, int forced,
+		       uid_t rootid)
+{
+    struct parsed *table[TEXT_BUCKETS];
+    struct manifest m;
+    int i, ok = 0, unchanged = 0, removed = 0, failed;
+
+    memset(table, 0, sizeof(table));
+    memset(&m, 0, sizeof(m));
+    m.verify = verify;
+    m.converge = converge;
+    m.rootid = rootid;
+    failed = read_manifest(name, &m, table, forced);
+
+    if (!verify && m.count) {
+	raise_setfcap(mycaps);
+    }
+#ifdef SETCAP_THREADS
+    if (threads > m.count) {
+	threads = m.count;
+    }
+    if (threads > 1) {
+	pthread_t *tids = calloc(threads, sizeof(pthread_t));
+	if (tids == NULL) {
+	    perror("setcap: out of memory");
+	    exit(1);
+	}
+	for (i = 0; i < threads; i++) {
+	    if (pthread_create(&tids[i], NULL, apply_entries, &m)) {
+		perror("setcap: unable to start thread");
+		exit(1);
+	    }
+	}
+	for (i = 0; i < threads; i++) {
+	    pthread_join(tids[i], NULL);
+	}
+	free(tids);
+    }
+#endif
+    apply_entries(&m);
+
+    for (i = 0; i < m.count; i++) {
+	struct entry *e = &m.entries[i];
+
+	switch (e->outcome) {
+	case ENTRY_OK:
+	    ok++;
+	    if (!quiet) {
+		printf("%s: %s\n", e->path,
+		       (converge && !verify) ? "changed" : "OK");
+	    }
+	    break;
+	case ENTRY_UNCHANGED:
+	    unchanged++;
+	    if (!quiet) {
+		printf("%s: unchanged\n", e->path);
+	    }
+	    break;
+	case ENTRY_REMOVED:
+	    removed++;
+	    if (!quiet) {
+		printf("%s: %s\n", e->path, converge ? "removed" : "OK");
+	    }
+	    break;
+	case ENTRY_DIFFERS:
+	    failed++;
+	    if (!quiet) {
+		printf("%s: differs\n", e->path);
+	    }
+	    break;
+	case ENTRY_NOTHING:
+	    if (forced) {
+		ok++;
+		break;
+	    }
+	    failed++;
+	    fprintf(stderr, "%s:%d: File '%s' has no capability to remove\n",
+		    name, e->line, e->path);
+	    break;
+	default:
+	    failed++;
+	    fprintf(stderr, "%s:%d: Failed to %s capabilities on file '%s':"
+		    " %s\n", name, e->line, verify ? "verify" : "set",
+		    e->path, strerror(e->err));
+	}
+	free(e->path);
+    }
+    if (!quiet && converge && !verify) {
+	printf("%d changed, %d unchanged, %d removed, %d failed\n",
+	       ok, unchanged, removed, failed);
+    } else if (!quiet) {
+	ok += removed;
+	printf("%d file%s %s, %d failed\n", ok, ok == 1 ? "" : "s",
+	       verify ? "verified" : "set", failed);
+    }
+
+    for (i = 0; i < TEXT_BUCKETS; i++) {
+	while (table[i] != NULL) {
+	    struct parsed *p = table[i];
+	    table[i] = p->next;
+	    cap_free(p->cap_d);
+	    free(p->text);
+	    free(p);
+	}
+    }
+    free(m.entries);
+    return failed != 0;
+}
+
 int main(int argc, char **argv)
 {
     int tried_to_cap_setfcap = 0;
     char buffer[MAXCAP+1];
-    int retval, quiet = 0, verify = 0, forced = 0;
+    int retval, quiet = 0, verify = 0, forced = 0, threads = 1, status = 0;
+    int converge = 0, changed = 0, unchanged = 0, removed = 0;
     cap_t mycaps;
-    cap_value_t capflag;
     uid_t rootid = 0, f_rootid;
 
     if (argc < 2) {
@@ -135,6 +544,10 @@ int main(int argc, char **argv)
 	    forced = 1;
 	    continue;
 	}
+	if (!strcmp(*arg, "--converge")) {
+	    converge = 1;
+	    continue;
+	}
 	if (!strcmp(*arg, "-h")) {
 	    usage(0);
 	}
@@ -152,6 +565,23 @@ int main(int argc, char **argv)
 	    quiet = 1;
 	    continue;
 	}
+	if (!strcmp(*arg, "-j")) {
+	    if (argc < 2) {
+		usage(1);
+	    }
+	    --argc;
+	    threads = (int) pos_uint(*++arg, "bad thread count", NULL);
+	    continue;
+	}
+	if (!strcmp(*arg, "--manifest")) {
+	    if (argc < 2) {
+		usage(1);
+	    }
+	    --argc;
+	    status |= do_manifest(*++arg, mycaps, threads, quiet, verify,
+				  converge, forced, rootid);
+	    continue;
+	}
 	if (!strcmp(*arg, "-v")) {
 	    verify = 1;
 	    continue;
@@ -249,54 +679,21 @@ int main(int argc, char **argv)
 	    }
 	} else {
 	    if (!tried_to_cap_setfcap) {
-		capflag = CAP_SETFCAP;
-
-		/*
-		 * Raise the effective CAP_SETFCAP.
-		 */
-		if (cap_set_flag(mycaps, CAP_EFFECTIVE, 1, &capflag, CAP_SET)
-		    != 0) {
-		    perror("unable to manipulate CAP_SETFCAP - "
-			   "try a newer libcap?");
-		    exit(1);
-		}
-		if (cap_set_proc(mycaps) != 0) {
-		    perror("unable to set CAP_SETFCAP effective capability");
-		    exit(1);
-		}
+		raise_setfcap(mycaps);
 		tried_to_cap_setfcap = 1;
 	    }
-#ifdef linux
-	    {
-		/* Linux's file capabilities have a compressed representation. */
-		int explained = 0;
-		int somebits = 0;
-		cap_value_t cap;
-		cap_flag_value_t per_state;
-
-		for (cap = 0;
-		     cap_get_flag(cap_d, cap, CAP_PERMITTED, &per_state) != -1;
-		     cap++) {
-		    cap_flag_value_t inh_state, eff_state, combined;
-
-		    cap_get_flag(cap_d, cap, CAP_INHERITABLE, &inh_state);
-		    cap_get_flag(cap_d, cap, CAP_EFFECTIVE, &eff_state);
-		    combined = (inh_state | per_state);
-		    somebits |= !!eff_state;
-		    if (combined != eff_state) {
-			explained = 1;
-			break;
-		    }
-		}
-		if (somebits && explained) {
-		    fprintf(stderr, "Error: under Linux, effective file capabilities must either be empty, or\n"
-			    "       exactly match the union of selected permitted and inheritable bits.\n");
-		    if (!forced) {
-			exit(1);
-		    }
+	    if (!valid_effective(cap_d) && !forced) {
+		exit(1);
+	    }
+	    if (converge && converge_state(arg[1], cap_d) == 0) {
+		unchanged++;
+		if (!quiet) {
+		    printf("%s: unchanged\n", *++arg);
+		} else {
+		    ++arg;
 		}
+		continue;
 	    }
-#endif /* def linux */
 	    errno = 0;
 	    retval = cap_set_file(*++arg, cap_d);
 	    if (retval != 0) {
@@ -323,12 +720,20 @@ int main(int argc, char **argv)
 			    *arg, strerror(errno));
 		    exit(1);
 		}
+	    } else if (cap_d == NULL) {
+		removed++;
+	    } else {
+		changed++;
 	    }
 	}
     }
     if (cap_d) {
 	cap_free(cap_d);
     }
+    if (converge && !quiet && changed + unchanged + removed) {
+	printf("%d changed, %d unchanged, %d removed\n",
+	       changed, unchanged, removed);
+    }
 
-    exit(0);
+    exit(status);
 }
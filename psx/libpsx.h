@@ -11,6 +11,7 @@
  * abstraction, we need our own mutex etc implementation.
  */
 
+#include <linux/futex.h>
 #include <syscall.h>
 
 #include "psx_syscall.h"
@@ -18,6 +19,23 @@
 #define _psx_gettid() syscall(SYS_gettid)
 #define _psx_sched_yield() syscall(SYS_sched_yield)
 
+/*
+ * Some 32-bit architectures only provide the time64 variant of the
+ * futex syscall. Since we never supply a timeout, either will do.
+ */
+#if !defined(SYS_futex) && defined(SYS_futex_time64)
+#define SYS_futex SYS_futex_time64
+#endif
+
+/*
+ * The PSX completion barriers sleep on (int) futex words. A waiter
+ * only sleeps while *x == val, so a wakeup can never be missed.
+ */
+#define _psx_futex_wait(x, val) \
+    syscall(SYS_futex, x, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0)
+#define _psx_futex_wake(x, n) \
+    syscall(SYS_futex, x, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0)
+
 typedef long psx_mutex_t;
 #define _psx_mu_lock(pid, x)						\
     do {								\
@@ -35,6 +53,7 @@ extern void psx_lock(void);
 extern void psx_unlock(void);
 extern void psx_cond_wait(void);
 extern long psx_mix(long value);
+extern long long psx_now_ns(void);
 
 typedef enum {
     _PSX_IDLE = 0,
@@ -44,15 +63,32 @@ typedef enum {
 } psx_tracker_state_t;
 
 /*
- * Tracking threads is done via a hash map of these objects.
+ * Tracking threads is done via an open addressing hash map of these
+ * objects, keyed by tid. A tid of 0 marks an empty entry and -1 a
+ * tombstone left by a thread that exited before it was signaled.
  */
 typedef struct psx_thread_ref_s {
     long sweep;
     long pending;
     long tid;
     long retval;
+    int error;
+    long long signaled, done; /* only maintained when cmd.timed */
 } psx_thread_ref_t;
 
+/*
+ * Threads created via the __wrap_pthread_create() linkage register
+ * themselves in a roster. The roster is a lock-free list of chunks of
+ * tid slots. Chunks are only ever appended, so a slot pointer remains
+ * valid for the lifetime of the process.
+ */
+#define _PSX_ROSTER_CHUNK 63
+
+typedef struct psx_roster_s {
+    struct psx_roster_s *next;
+    long tid[_PSX_ROSTER_CHUNK];
+} psx_roster_t;
+
 /*
  * This global structure holds the global coordination state for
  * libcap's psx_syscall() support.
@@ -64,26 +100,39 @@ typedef struct {
     psx_mutex_t state_mu;
     psx_tracker_state_t state;
     int initialized;
-    int incomplete;
+    int incomplete; /* futex word: threads yet to leave the handler */
     int psx_sig;
     int force_failure; /* leave this as zero to avoid forcing a crash */
     psx_sensitivity_t sensitivity;
+    psx_tracking_t tracking;
 
     struct {
 	long syscall_nr;
 	long arg1, arg2, arg3, arg4, arg5, arg6;
 	int six;
-	int active;
+	int active; /* futex word: handlers wait for this to be 0 */
+	struct psx_call *vec; /* non-NULL for psx_syscall_vec() */
+	int count;
+	int timed; /* non-zero for psx_syscall_results() */
     } cmd;
 
     /* This is kept opaque here, but its details are known to psx_calls.c */
     void *actions;
 
     int map_entries;
+    int map_occupied; /* entries used by the current broadcast */
     long map_mask;
+    long map_resizes;
+    long broadcasts;
+    long proc_sweeps;
     psx_thread_ref_t *map;
+
+    psx_roster_t *roster;
 } psx_tracker_t;
 
+/* defined in psx.c */
+extern psx_thread_ref_t *psx_map_find(long tid);
+
 /* defined in psx_calls.c */
 extern psx_tracker_t psx_tracker;
 extern int psx_actions_size(void);
@@ -16,6 +16,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stddef.h>
@@ -25,6 +27,7 @@
 #include <string.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "psx_syscall.h"
@@ -70,6 +73,16 @@ void psx_load_syscalls(long int (**syscall_fn)(long int,
     *syscall6_fn = psx_syscall6;
 }
 
+/*
+ * psx_load_syscall_vec is the psx_syscall_vec() counterpart of
+ * psx_load_syscalls(). It is weakly defined in libcap too.
+ */
+void psx_load_syscall_vec(int (**syscall_vec_fn)(struct psx_call *calls,
+						 int n))
+{
+    *syscall_vec_fn = psx_syscall_vec;
+}
+
 /*
  * This global coordinates the PSX mechanism.
  */
@@ -80,6 +93,16 @@ __attribute__((visibility ("hidden"))) long psx_mix(long value) {
     return value ^ (value >> 7) ^ (value >> 13) ^ (value >> 23);
 }
 
+/*
+ * psx_now_ns returns a monotonic timestamp in nanoseconds. It is
+ * async-signal-safe, so it is also used by the signal handler.
+ */
+__attribute__((visibility ("hidden"))) long long psx_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 static void psx_set_map(int size)
 {
     psx_tracker.map_entries = size;
@@ -87,6 +110,58 @@ static void psx_set_map(int size)
     psx_tracker.map = calloc(psx_tracker.map_entries, sizeof(psx_thread_ref_t));
 }
 
+/*
+ * psx_map_find returns the map entry for tid. The map uses open
+ * addressing, so this probes linearly from the hashed position of
+ * tid. If tid is not in the map, the returned entry is the empty one
+ * where it belongs. Since the map is never more than half full, an
+ * empty entry is always found. Called under lock.
+ */
+__attribute__((visibility ("hidden"))) psx_thread_ref_t *psx_map_find(long tid)
+{
+    long i = psx_mix(tid) & psx_tracker.map_mask;
+    for (;; i = (i + 1) & psx_tracker.map_mask) {
+	psx_thread_ref_t *x = &psx_tracker.map[i];
+	if (x->tid == tid || x->tid == 0) {
+	    return x;
+	}
+    }
+}
+
+/*
+ * psx_map_grow doubles the size of the map and re-inserts its live
+ * entries. The map is never shrunk, so a process with a steady
+ * number of threads stops allocating after its first few
+ * broadcasts. It returns 0 on success and -1 if no memory was
+ * available. Called under lock.
+ */
+static int psx_map_grow(void)
+{
+    psx_thread_ref_t *old = psx_tracker.map;
+    long i, old_entries = psx_tracker.map_entries;
+
+    psx_set_map(2 * old_entries);
+    if (psx_tracker.map == NULL) {
+	psx_tracker.map = old;
+	psx_tracker.map_entries = old_entries;
+	psx_tracker.map_mask = old_entries - 1;
+	return -1;
+    }
+    psx_tracker.map_occupied = 0;
+    for (i = 0; i < old_entries; i++) {
+	psx_thread_ref_t *y = &old[i];
+	if (y->tid <= 0) {
+	    /* empty or a tombstone */
+	    continue;
+	}
+	*psx_map_find(y->tid) = *y;
+	psx_tracker.map_occupied++;
+    }
+    psx_tracker.map_resizes++;
+    free(old);
+    return 0;
+}
+
 /*
  * Forward declaration
  */
@@ -161,7 +236,8 @@ __attribute__((visibility ("hidden"))) void psx_unlock(void)
 /*
  * psx_cond_wait is called locked, it unlocks and waits to obtain the
  * lock again, allowing other code to run that may require the
- * lock. This is the only way the psx code waits like this.
+ * lock. This is used for the infrequent state transitions. The
+ * per-syscall completion barriers sleep on futexes instead.
  */
 __attribute__((visibility ("hidden"))) void psx_cond_wait(void)
 {
@@ -229,6 +305,8 @@ long int psx_syscall6(long int syscall_nr,
  */
 static long int __psx_immediate_syscall(long int syscall_nr,
 					int count, long int *arg) {
+    psx_tracker.cmd.vec = NULL;
+    psx_tracker.cmd.timed = 0;
     psx_tracker.cmd.syscall_nr = syscall_nr;
     psx_tracker.cmd.arg1 = count > 0 ? arg[0] : 0;
     psx_tracker.cmd.arg2 = count > 1 ? arg[1] : 0;
@@ -279,63 +357,95 @@ struct psx_linux_dirent64 {
 };
 
 /*
- * __psx_syscall performs the syscall on the current thread and if no
- * error is detected it ensures that the syscall is also performed on
- * all (other) registered threads. The return code is the value for
- * the first invocation. It uses a trick to figure out how many
- * arguments the user has supplied. The other half of the trick is
- * provided by the macro psx_syscall() in the <sys/psx_syscall.h>
- * file. The trick is the 7th optional argument (8th over all) to
- * __psx_syscall is the count of arguments supplied to psx_syscall.
- *
- * User:
- *                       psx_syscall(nr, a, b);
- * Expanded by macro to:
- *                       __psx_syscall(nr, a, b, 6, 5, 4, 3, 2, 1, 0);
- * The eighth arg is now ------------------------------------^
+ * psx_track_tid notes that thread, tid, is part of the current
+ * sweep. If it is newly discovered, the thread is signaled to perform
+ * the pending syscall. The return value is 0 if the thread is being
+ * tracked and -1 if the thread is not (or no longer) a thread of this
+ * process.
  */
-long int __psx_syscall(long int syscall_nr, ...) {
-    long int arg[7];
-    long i;
-
-    va_list aptr;
-    va_start(aptr, syscall_nr);
-    for (i = 0; i < 7; i++) {
-	arg[i] = va_arg(aptr, long int);
+static int psx_track_tid(long tid, long sweep, long ret,
+			 int *some, int *incomplete, int *mismatch)
+{
+    psx_lock();
+    psx_thread_ref_t *x = psx_map_find(tid);
+    if (x->tid == tid && x->sweep == sweep) {
+	/* already counted in this sweep */
+	psx_unlock();
+	return 0;
     }
-    va_end(aptr);
-
-    int count = arg[6];
-    if (count < 0 || count > 6) {
-	errno = EINVAL;
-	return -1;
+    if (x->tid != tid) {
+	/*
+	 * A new entry. Keep the map at most half full so probe
+	 * sequences stay short. Only this (the broadcasting) thread
+	 * resizes the map, so x remains valid when unlocked below.
+	 */
+	if (2 * (psx_tracker.map_occupied + 1) > psx_tracker.map_entries) {
+	    if (psx_map_grow() != 0 &&
+		psx_tracker.map_occupied + 2 > psx_tracker.map_entries) {
+		fprintf(stderr, "(%d) psx thread map exhausted - aborting\n",
+			getpid());
+		kill(psx_tracker.pid, SIGKILL);
+	    }
+	    x = psx_map_find(tid);
+	}
+	psx_tracker.map_occupied++;
+	/*
+	 * This is where we will also (first) enable the PSX parts of
+	 * our installed handler. This is, potentially racing with
+	 * other users of the same signal, so we do this under lock.
+	 */
+	x->pending = 1;
+	x->tid = tid;
+	if (psx_tracker.cmd.timed) {
+	    x->signaled = psx_now_ns();
+	}
+	psx_tracker.cmd.active = 1;
+	psx_unlock();
+	/*
+	 * There is a small chance that this signal may be racing
+	 * with another user of this signal.  Locking above should
+	 * ensure both forks of the handler get invoked - perhaps out
+	 * of order though...
+	 */
+	if (syscall(SYS_tgkill, psx_tracker.pid, tid,
+		    psx_tracker.psx_sig) != 0) {
+	    /*
+	     * no such thread, so forget about it. The entry becomes a
+	     * tombstone to keep the probe sequences of other entries
+	     * intact.
+	     */
+	    psx_lock();
+	    x->pending = 0;
+	    x->tid = -1;
+	    psx_unlock();
+	    return -1;
+	}
+	psx_lock();
     }
-
-    psx_new_state(_PSX_IDLE, _PSX_SETUP);
-    psx_confirm_sigaction();
-
-    long int ret = __psx_immediate_syscall(syscall_nr, count, arg);
-    if (ret == -1) {
-	psx_new_state(_PSX_SETUP, _PSX_IDLE);
-	goto defer;
+    x->sweep = sweep;
+    (*incomplete)++;
+    if (x->pending) {
+	(*some)++;
+    } else if (x->retval != ret) {
+	*mismatch = 1;
     }
+    psx_unlock();
+    return 0;
+}
 
-    int restore_errno = errno;
-    psx_new_state(_PSX_SETUP, _PSX_SYSCALL);
-
-    /*
-     * cleaning up before we start helps a fork()ed child not inherit
-     * confusion from its parent.
-     */
-    memset(psx_tracker.map, 0,
-	   psx_tracker.map_entries*sizeof(psx_thread_ref_t));
-
-    long self = _psx_gettid(), sweep = 1;
-    int some, incomplete, mismatch = 0, verified = 0;
+/*
+ * psx_proc_sweep repeatedly walks the /proc/<pid>/task directory,
+ * tracking every thread it finds, until two consecutive sweeps find
+ * all of the threads have performed the syscall.
+ */
+static void psx_proc_sweep(long self, long *sweep, long ret,
+			   int *incomplete, int *mismatch)
+{
+    int some, verified = 0;
     do {
-	incomplete = 0;  /* count threads to return from signal handler */
-	some = 0;        /* count threads still pending */
-	sweep++;
+	*incomplete = 0;  /* count threads to return from signal handler */
+	some = 0;         /* count threads still pending */
+	(*sweep)++;
 
 	int fd = open(psx_tracker.pid_path, O_RDONLY | O_DIRECTORY);
 	if (fd == -1) {
@@ -367,76 +477,90 @@ long int __psx_syscall(long int syscall_nr, ...) {
 		if (tid == 0 || tid == self) {
 		    continue;
 		}
-		long mix = psx_mix(tid);
-		psx_thread_ref_t *x =
-		    &psx_tracker.map[mix & psx_tracker.map_mask];
-		if (x->tid != tid) {
-		    if (x->tid != 0) {
-			/* a collision */
-			long entries = psx_tracker.map_entries;
-			long oval, mask;
-			for (oval = psx_mix(x->tid); ; entries <<= 1) {
-			    mask = entries - 1;
-			    if (((oval ^ mix) & mask) != 0) {
-				/* no more collisions */
-				break;
-			    }
-			}
-			psx_thread_ref_t *old = psx_tracker.map;
-			long old_entries = psx_tracker.map_entries;
-			psx_lock();
-			psx_set_map(entries);
-			long ok_sweep = sweep - 1;
-			for (i = 0; i < old_entries; i++) {
-			    psx_thread_ref_t *y = &old[i];
-			    if (y->sweep < ok_sweep) {
-				/* no longer care about this entry */
-				continue;
-			    }
-			    psx_thread_ref_t *z =
-				&psx_tracker.map[psx_mix(y->tid) & mask];
-			    z->tid = y->tid;
-			    z->pending = y->pending;
-			    z->retval = y->retval;
-			    z->sweep = y->sweep;
-			}
-			psx_unlock();
-			free(old);
-			x = &psx_tracker.map[mix & mask];
-		    }
-		    /*
-		     * A new entry - this is where we will also
-		     * (first) enable the PSX parts of our installed
-		     * handler. This is, potentially racing with other
-		     * users of the same signal, so we do this under
-		     * lock.
-		     */
-		    psx_lock();
-		    x->pending = 1;
-		    x->tid = tid;
-		    psx_tracker.cmd.active = 1;
-		    psx_unlock();
-		    /*
-		     * There is a small chance that this signal may be
-		     * racing with another user of this signal.
-		     * Locking above should ensure both forks of the
-		     * handler get invoked - perhaps out of order
-		     * though...
-		     */
-		    syscall(SYS_tkill, tid, psx_tracker.psx_sig);
+		psx_track_tid(tid, *sweep, ret, &some, incomplete, mismatch);
+	    }
+	}
+	close(fd);
+	if (some) {
+	    verified = 0;
+	    _psx_sched_yield();
+	} else {
+	    verified++;
+	}
+    } while (verified < 2);
+}
+
+/*
+ * psx_count_threads returns the number of threads in the current
+ * process, or -1 if this cannot be determined. As with the directory
+ * reading above, this uses raw system calls only.
+ */
+static long psx_count_threads(void)
+{
+    char buf[BUF_SIZE];
+    int fd = open("/proc/self/stat", O_RDONLY);
+    if (fd == -1) {
+	return -1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+	return -1;
+    }
+    buf[n] = '\0';
+    /* num_threads is the 18th field after the ")" terminated comm */
+    char *p = strrchr(buf, ')');
+    int field;
+    for (field = 0; p != NULL && field < 18; field++) {
+	p = strchr(p + 1, ' ');
+    }
+    if (p == NULL) {
+	return -1;
+    }
+    return atol(p + 1);
+}
+
+/*
+ * psx_roster_sweep repeatedly walks the roster of registered threads
+ * until two consecutive passes find all of them have performed the
+ * syscall. The initial thread of the process, whose tid is the pid,
+ * is not created by the wrapper, so it is always included. It
+ * returns 0 if the roster accounts for all of the threads of the
+ * process, and -1 if some threads are unknown to the roster and a
+ * /proc sweep is needed to find them.
+ */
+static int psx_roster_sweep(long self, long *sweep, long ret,
+			    int *incomplete, int *mismatch)
+{
+    int some, verified = 0;
+    do {
+	*incomplete = 0;
+	some = 0;
+	(*sweep)++;
+
+	if (psx_tracker.pid != self) {
+	    (void) psx_track_tid(psx_tracker.pid, *sweep, ret,
+				 &some, incomplete, mismatch);
+	}
+
+	psx_roster_t *r;
+	for (r = __atomic_load_n(&psx_tracker.roster, __ATOMIC_ACQUIRE);
+	     r != NULL; r = __atomic_load_n(&r->next, __ATOMIC_ACQUIRE)) {
+	    int i;
+	    for (i = 0; i < _PSX_ROSTER_CHUNK; i++) {
+		long tid = __atomic_load_n(&r->tid[i], __ATOMIC_ACQUIRE);
+		if (tid == 0 || tid == self) {
+		    continue;
 		}
-		psx_lock();
-		x->sweep = sweep;
-		incomplete++;
-		if (x->pending) {
-		    some++;
-		} else if (x->retval != ret) {
-		    mismatch = 1;
+		if (psx_track_tid(tid, *sweep, ret,
+				  &some, incomplete, mismatch) != 0) {
+		    /* a stale entry, for example inherited over fork() */
+		    __atomic_compare_exchange_n(&r->tid[i], &tid, 0, 0,
+						__ATOMIC_SEQ_CST,
+						__ATOMIC_SEQ_CST);
 		}
-		psx_unlock();
 	    }
 	}
-	close(fd);
 	if (some) {
 	    verified = 0;
 	    _psx_sched_yield();
@@ -445,13 +569,111 @@ long int __psx_syscall(long int syscall_nr, ...) {
 	}
     } while (verified < 2);
 
+    /*
+     * All of the tracked threads are now blocked in the signal
+     * handler, so the only way the process can contain more threads
+     * is if some were not created via the roster registering
+     * wrapper.
+     */
+    if (psx_count_threads() != *incomplete + 1) {
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * psx_collect copies the outcomes of the threads found in the final
+ * sweep into results, which has room for max records. It returns
+ * the number of threads found. Called under lock.
+ */
+static int psx_collect(struct psx_result *results, int max, long sweep)
+{
+    long i;
+    int found = 0;
+
+    for (i = 0; i < psx_tracker.map_entries; i++) {
+	psx_thread_ref_t *ref = &psx_tracker.map[i];
+	if (ref->sweep != sweep) {
+	    continue;
+	}
+	if (found < max) {
+	    struct psx_result *r = &results[found];
+	    r->tid = ref->tid;
+	    r->retval = ref->retval;
+	    r->error = ref->error;
+	    r->latency_ns = ref->done - ref->signaled;
+	}
+	found++;
+    }
+    return found;
+}
+
+/*
+ * psx_broadcast is called in the _PSX_SETUP state, after the
+ * pending command has been performed successfully by the calling
+ * thread. It has every other thread of the process perform the
+ * command and waits for them all to complete it. The value, ret, is
+ * what each thread's result is compared with. If results is not
+ * NULL, the outcomes for the other threads are recorded there, and
+ * *n is set to the number of them.
+ */
+static void psx_broadcast(long int ret, struct psx_result *results, int *n)
+{
+    long i;
+
+    psx_new_state(_PSX_SETUP, _PSX_SYSCALL);
+
+    /*
+     * cleaning up before we start helps a fork()ed child not inherit
+     * confusion from its parent. The map keeps its size, so this is
+     * all a steady state broadcast needs to do to prepare it.
+     */
+    psx_lock();
+    memset(psx_tracker.map, 0,
+	   psx_tracker.map_entries*sizeof(psx_thread_ref_t));
+    psx_tracker.map_occupied = 0;
+    psx_tracker.broadcasts++;
+    psx_unlock();
+
+    long self = _psx_gettid(), sweep = 1;
+    int incomplete = 0, mismatch = 0;
+
+    psx_lock();
+    psx_tracking_t tracking = psx_tracker.tracking;
+    psx_unlock();
+
+    if (tracking != PSX_TRACK_ROSTER ||
+	psx_roster_sweep(self, &sweep, ret, &incomplete, &mismatch) != 0) {
+	psx_lock();
+	psx_tracker.proc_sweeps++;
+	psx_unlock();
+	psx_proc_sweep(self, &sweep, ret, &incomplete, &mismatch);
+    }
+
+    /*
+     * Release all of the threads waiting in the signal handler and
+     * sleep until the last of them has left it.
+     */
     psx_lock();
     psx_tracker.incomplete = incomplete;
     psx_tracker.cmd.active = 0;
-    while (psx_tracker.incomplete != 0) {
-	psx_cond_wait();
-    }
     psx_unlock();
+    _psx_futex_wake(&psx_tracker.cmd.active, INT_MAX);
+    for (;;) {
+	psx_lock();
+	int left = psx_tracker.incomplete;
+	psx_unlock();
+	if (left == 0) {
+	    break;
+	}
+	_psx_futex_wait(&psx_tracker.incomplete, left);
+    }
+
+    if (results != NULL) {
+	psx_lock();
+	*n = psx_collect(results, *n, sweep);
+	psx_unlock();
+    }
 
     if (mismatch) {
 	psx_lock();
@@ -460,7 +682,20 @@ long int __psx_syscall(long int syscall_nr, ...) {
 	    break;
 	default:
 	    fprintf(stderr, "psx_syscall result differs.\n");
-	    if (psx_tracker.cmd.six) {
+	    if (psx_tracker.cmd.vec != NULL) {
+		int k;
+		for (k = 0; k < psx_tracker.cmd.count; k++) {
+		    const struct psx_call *c = &psx_tracker.cmd.vec[k];
+		    if (c->differ == 0) {
+			continue;
+		    }
+		    fprintf(stderr, "call[%d] trap:%ld a123456=[%ld,%ld,%ld,%ld,%ld,%ld]"
+			    " wanted={%ld} differ=%d\n", k, c->syscall_nr,
+			    c->arg[0], c->arg[1], c->arg[2],
+			    c->arg[3], c->arg[4], c->arg[5],
+			    c->retval, c->differ);
+		}
+	    } else if (psx_tracker.cmd.six) {
 		fprintf(stderr, "trap:%ld a123456=[%ld,%ld,%ld,%ld,%ld,%ld]\n",
 			psx_tracker.cmd.syscall_nr,
 			psx_tracker.cmd.arg1,
@@ -494,13 +729,160 @@ long int __psx_syscall(long int syscall_nr, ...) {
 	}
 	psx_unlock();
     }
-    errno = restore_errno;
     psx_new_state(_PSX_SYSCALL, _PSX_IDLE);
+}
+
+/*
+ * __psx_syscall performs the syscall on the current thread and if no
+ * error is detected it ensures that the syscall is also performed on
+ * all (other) registered threads. The return code is the value for
+ * the first invocation. It uses a trick to figure out how many
+ * arguments the user has supplied. The other half of the trick is
+ * provided by the macro psx_syscall() in the <sys/psx_syscall.h>
+ * file. The trick is the 7th optional argument (8th over all) to
+ * __psx_syscall is the count of arguments supplied to psx_syscall.
+ *
+ * User:
+ *                       psx_syscall(nr, a, b);
+ * Expanded by macro to:
+ *                       __psx_syscall(nr, a, b, 6, 5, 4, 3, 2, 1, 0);
+ * The eighth arg is now ------------------------------------^
+ */
+long int __psx_syscall(long int syscall_nr, ...) {
+    long int arg[7];
+    int i;
+
+    va_list aptr;
+    va_start(aptr, syscall_nr);
+    for (i = 0; i < 7; i++) {
+	arg[i] = va_arg(aptr, long int);
+    }
+    va_end(aptr);
+
+    int count = arg[6];
+    if (count < 0 || count > 6) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    psx_new_state(_PSX_IDLE, _PSX_SETUP);
+    psx_confirm_sigaction();
+
+    long int ret = __psx_immediate_syscall(syscall_nr, count, arg);
+    if (ret == -1) {
+	psx_new_state(_PSX_SETUP, _PSX_IDLE);
+	goto defer;
+    }
+
+    int restore_errno = errno;
+    psx_broadcast(ret, NULL, NULL);
+    errno = restore_errno;
 
 defer:
     return ret;
 }
 
+/*
+ * psx_syscall_results performs a psx_syscall6() and records the
+ * outcome on each thread. The calling thread's record comes first.
+ */
+long int psx_syscall_results(struct psx_result *results, int *n,
+			     long int syscall_nr,
+			     long int arg1, long int arg2, long int arg3,
+			     long int arg4, long int arg5, long int arg6) {
+    long int arg[6] = { arg1, arg2, arg3, arg4, arg5, arg6 };
+
+    if (results == NULL || n == NULL || *n < 1) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    psx_new_state(_PSX_IDLE, _PSX_SETUP);
+    psx_confirm_sigaction();
+
+    long long start = psx_now_ns();
+    long int ret = __psx_immediate_syscall(syscall_nr, 6, arg);
+    results[0].tid = _psx_gettid();
+    results[0].retval = ret;
+    results[0].error = ret == -1 ? errno : 0;
+    results[0].latency_ns = psx_now_ns() - start;
+    if (ret == -1) {
+	*n = 1;
+	psx_new_state(_PSX_SETUP, _PSX_IDLE);
+	return ret;
+    }
+
+    int restore_errno = errno;
+    int others = *n - 1;
+    psx_tracker.cmd.timed = 1;
+    psx_broadcast(ret, results + 1, &others);
+    *n = others + 1;
+    errno = restore_errno;
+
+    return ret;
+}
+
+/*
+ * psx_syscall_vec performs a sequence of syscalls on the current
+ * thread and then, with a single broadcast, has every other thread
+ * perform those of them that succeeded. A failing call, unless it is
+ * marked PSX_CALL_OPTIONAL, causes the remaining calls to be skipped,
+ * except for those marked PSX_CALL_ALWAYS. The function returns 0 if
+ * all of the non-optional calls succeeded, otherwise -1 with errno
+ * set from the first of them to fail.
+ */
+int psx_syscall_vec(struct psx_call *calls, int n)
+{
+    int i, failed = 0, performed = 0, failed_errno = 0;
+
+    if (calls == NULL || n <= 0) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    int restore_errno = errno;
+    psx_new_state(_PSX_IDLE, _PSX_SETUP);
+    psx_confirm_sigaction();
+
+    for (i = 0; i < n; i++) {
+	struct psx_call *c = &calls[i];
+	c->differ = 0;
+	if (failed && !(c->flags & PSX_CALL_ALWAYS)) {
+	    c->retval = -1;
+	    c->error = 0;
+	    continue;
+	}
+	c->retval = syscall(c->syscall_nr, c->arg[0], c->arg[1], c->arg[2],
+			    c->arg[3], c->arg[4], c->arg[5]);
+	if (c->retval != -1) {
+	    c->error = 0;
+	    performed++;
+	    continue;
+	}
+	c->error = errno;
+	if (!(c->flags & PSX_CALL_OPTIONAL) && !failed) {
+	    failed = 1;
+	    failed_errno = c->error;
+	}
+    }
+
+    if (performed) {
+	psx_tracker.cmd.vec = calls;
+	psx_tracker.cmd.count = n;
+	psx_tracker.cmd.timed = 0;
+	psx_broadcast(0, NULL, NULL);
+    } else {
+	psx_new_state(_PSX_SETUP, _PSX_IDLE);
+    }
+
+    if (failed) {
+	errno = failed_errno;
+	return -1;
+    }
+    errno = restore_errno;
+    return 0;
+}
+
 /*
  * Change the PSX sensitivity level. If the threads appear to have
  * diverged in behavior, this can cause the library to notify the
@@ -517,6 +899,41 @@ int psx_set_sensitivity(psx_sensitivity_t level) {
     return 0;
 }
 
+/*
+ * Change the way the PSX mechanism tracks threads. The roster mode
+ * only avoids the /proc sweep for threads that were created with the
+ * __wrap_pthread_create() linkage.
+ */
+int psx_set_tracking(psx_tracking_t mode) {
+    if (mode < PSX_TRACK_PROC || mode > PSX_TRACK_ROSTER) {
+	errno = EINVAL;
+	return -1;
+    }
+    psx_lock();
+    psx_tracker.tracking = mode;
+    psx_unlock();
+    return 0;
+}
+
+/*
+ * Report the activity of the PSX mechanism and the state of its
+ * thread map.
+ */
+int psx_get_stats(struct psx_stats *stats) {
+    if (stats == NULL) {
+	errno = EINVAL;
+	return -1;
+    }
+    psx_lock();
+    stats->broadcasts = psx_tracker.broadcasts;
+    stats->map_entries = psx_tracker.map_entries;
+    stats->map_occupied = psx_tracker.map_occupied;
+    stats->map_resizes = psx_tracker.map_resizes;
+    stats->proc_sweeps = psx_tracker.proc_sweeps;
+    psx_unlock();
+    return 0;
+}
+
 /*
  * The following is required for legacy linkage libcap-2.71 and
  * earlier backward compatibility. The Go use of psx no longer has any
@@ -538,14 +955,97 @@ int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
 			  void *(*start_routine) (void *), void *arg);
 
 /*
- * __wrap_pthread_create is defined for legacy reasons, since whether
- * or not you use this wrapper to reach the __real_ functionality or
- * not isn't important to the psx mechanism any longer (since
- * libpsx-2.72).
+ * psx_roster_add claims a roster slot for tid. Chunks are added to
+ * the roster as needed, but never removed. The return value is the
+ * claimed slot, or NULL if no memory was available for the roster.
+ */
+static long *psx_roster_add(long tid)
+{
+    psx_roster_t **r = &psx_tracker.roster;
+    for (;;) {
+	psx_roster_t *chunk = __atomic_load_n(r, __ATOMIC_ACQUIRE);
+	if (chunk == NULL) {
+	    psx_roster_t *fresh = calloc(1, sizeof(psx_roster_t));
+	    if (fresh == NULL) {
+		return NULL;
+	    }
+	    if (!__atomic_compare_exchange_n(r, &chunk, fresh, 0,
+					     __ATOMIC_SEQ_CST,
+					     __ATOMIC_SEQ_CST)) {
+		free(fresh);
+	    }
+	    continue;
+	}
+	int i;
+	for (i = 0; i < _PSX_ROSTER_CHUNK; i++) {
+	    long empty = 0;
+	    if (__atomic_load_n(&chunk->tid[i], __ATOMIC_ACQUIRE) == 0 &&
+		__atomic_compare_exchange_n(&chunk->tid[i], &empty, tid, 0,
+					    __ATOMIC_SEQ_CST,
+					    __ATOMIC_SEQ_CST)) {
+		return &chunk->tid[i];
+	    }
+	}
+	r = &chunk->next;
+    }
+}
+
+/*
+ * psx_roster_drop releases the roster slot of the exiting thread. The
+ * slot is only cleared if it still refers to this thread, which is
+ * not the case after a fork().
+ */
+static void psx_roster_drop(void *slot)
+{
+    if (slot != NULL) {
+	long tid = _psx_gettid();
+	__atomic_compare_exchange_n((long *) slot, &tid, 0, 0,
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+}
+
+typedef struct {
+    void *(*start_routine) (void *);
+    void *arg;
+} psx_starter_t;
+
+/*
+ * psx_roster_start is the first function run by a wrapped
+ * thread. It keeps the thread on the roster for as long as it runs
+ * the caller's start_routine.
+ */
+static void *psx_roster_start(void *data)
+{
+    psx_starter_t starter = *(psx_starter_t *) data;
+    free(data);
+
+    void *ret;
+    long *slot = psx_roster_add(_psx_gettid());
+    pthread_cleanup_push(psx_roster_drop, slot);
+    ret = starter.start_routine(starter.arg);
+    pthread_cleanup_pop(1);
+    return ret;
+}
+
+/*
+ * __wrap_pthread_create is not needed to reach the __real_
+ * functionality for the psx mechanism (since libpsx-2.72), but when
+ * it is linked, the threads it creates are registered with the
+ * roster for use with psx_set_tracking(PSX_TRACK_ROSTER).
  */
 int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
                          void *(*start_routine) (void *), void *arg) {
-    return __real_pthread_create(thread, attr, start_routine, arg);
+    psx_starter_t *starter = calloc(1, sizeof(psx_starter_t));
+    if (starter == NULL) {
+	return EAGAIN;
+    }
+    starter->start_routine = start_routine;
+    starter->arg = arg;
+    int ret = __real_pthread_create(thread, attr, psx_roster_start, starter);
+    if (ret != 0) {
+	free(starter);
+    }
+    return ret;
 }
 
 #endif /* _LIBPSX_PTHREAD_LINKAGE def */
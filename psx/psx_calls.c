@@ -12,6 +12,7 @@
 #define _GNU_SOURCE
 #endif
 
+#include <errno.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/syscall.h>
@@ -168,6 +169,32 @@ __attribute__((visibility ("hidden"))) int psx_actions_size(void) {
 __attribute__((visibility ("hidden"))) void psx_restorer(void);
 #endif /* def SA_RESTORER */
 
+/*
+ * psx_posix_syscall_vec performs the calls of a psx_syscall_vec()
+ * sequence that succeeded on the calling thread. It returns the
+ * number of these calls for which this thread obtained a different
+ * result.
+ */
+static long int psx_posix_syscall_vec(void) {
+    int i, saved_errno = errno;
+    long int differ = 0;
+
+    for (i = 0; i < psx_tracker.cmd.count; i++) {
+	struct psx_call *c = &psx_tracker.cmd.vec[i];
+	if (c->retval == -1) {
+	    continue;
+	}
+	long int retval = syscall(c->syscall_nr, c->arg[0], c->arg[1],
+				  c->arg[2], c->arg[3], c->arg[4], c->arg[5]);
+	if (retval != c->retval) {
+	    __atomic_add_fetch(&c->differ, 1, __ATOMIC_SEQ_CST);
+	    differ++;
+	}
+    }
+    errno = saved_errno;
+    return differ;
+}
+
 /*
  * psx_posix_syscall_actor performs the system call on the targeted
  * thread and signals it is no longer pending.
@@ -220,7 +247,10 @@ static void psx_posix_syscall_actor(int signum, siginfo_t *info, void *ignore) {
     psx_unlock();
 
     long int retval;
-    if (!psx_tracker.cmd.six) {
+    int saved_errno = errno, error = 0;
+    if (psx_tracker.cmd.vec != NULL) {
+	retval = psx_posix_syscall_vec();
+    } else if (!psx_tracker.cmd.six) {
 	retval = syscall(psx_tracker.cmd.syscall_nr,
 			 psx_tracker.cmd.arg1,
 			 psx_tracker.cmd.arg2,
@@ -234,6 +264,11 @@ static void psx_posix_syscall_actor(int signum, siginfo_t *info, void *ignore) {
 			 psx_tracker.cmd.arg5,
 			 psx_tracker.cmd.arg6);
     }
+    if (retval == -1) {
+	error = errno;
+    }
+    errno = saved_errno;
+    long long done = psx_tracker.cmd.timed ? psx_now_ns() : 0;
 
     /*
      * communicate the result of the thread's attempt to perform the
@@ -241,10 +276,13 @@ static void psx_posix_syscall_actor(int signum, siginfo_t *info, void *ignore) {
      */
     long tid = _psx_gettid();
     psx_lock();
-    psx_thread_ref_t *ref =
-	&psx_tracker.map[psx_mix(tid) & psx_tracker.map_mask];
-    ref->retval = retval;
-    ref->pending = 0;
+    psx_thread_ref_t *ref = psx_map_find(tid);
+    if (ref->tid == tid) {
+	ref->retval = retval;
+	ref->error = error;
+	ref->done = done;
+	ref->pending = 0;
+    }
     /*
      * Block this thread until all threads have been interrupted.
      * This prevents threads clone()ing after running the syscall and
@@ -255,10 +293,15 @@ static void psx_posix_syscall_actor(int signum, siginfo_t *info, void *ignore) {
      * unblocked thread is hard, so we prevent it from happening.
      */
     while (psx_tracker.cmd.active) {
-	psx_cond_wait();
+	psx_unlock();
+	_psx_futex_wait(&psx_tracker.cmd.active, 1);
+	psx_lock();
     }
-    psx_tracker.incomplete--;
+    int last = (--psx_tracker.incomplete == 0);
     psx_unlock();
+    if (last) {
+	_psx_futex_wake(&psx_tracker.incomplete, 1);
+    }
 }
 
 /*
@@ -77,6 +77,68 @@ long int psx_syscall6(long int syscall_nr,
 		      long int arg1, long int arg2, long int arg3,
 		      long int arg4, long int arg5, long int arg6);
 
+/*
+ * struct psx_result records the outcome of a psx_syscall_results()
+ * broadcast for one thread. The latency_ns value is the time from
+ * the thread being signaled until it completed the syscall. For the
+ * calling thread it is the duration of its own syscall.
+ */
+struct psx_result {
+    long int tid;
+    long int retval;
+    int error;
+    long long int latency_ns;
+};
+
+/*
+ * psx_syscall_results is a variant of psx_syscall6() that also
+ * reports the result of the syscall on each thread. On entry, *n is
+ * the number of records available in results. On return, *n is the
+ * number of threads that performed the syscall, and the first record
+ * is that of the calling thread. When *n exceeds the number of
+ * records supplied, the excess threads are not recorded. Divergent
+ * results are still handled as per psx_set_sensitivity(), so use
+ * PSX_IGNORE to inspect them here without stderr noise or SIGSYS.
+ */
+long int psx_syscall_results(struct psx_result *results, int *n,
+			     long int syscall_nr,
+			     long int arg1, long int arg2, long int arg3,
+			     long int arg4, long int arg5, long int arg6);
+
+/*
+ * struct psx_call describes one step of a psx_syscall_vec()
+ * sequence. The caller fills in syscall_nr, arg[] and flags. On
+ * return, retval and error hold the result of the call on the calling
+ * thread, and differ counts the other threads whose result differed
+ * from retval. A call that was skipped has retval -1 and error 0.
+ */
+struct psx_call {
+    long int syscall_nr;
+    long int arg[6];
+    int flags;
+    long int retval;
+    int error;
+    int differ;
+};
+
+/*
+ * psx_call flags: PSX_CALL_OPTIONAL marks a call whose failure does
+ * not abort the sequence; PSX_CALL_ALWAYS marks a call that is
+ * performed even after an earlier call of the sequence has failed.
+ */
+#define PSX_CALL_OPTIONAL  1
+#define PSX_CALL_ALWAYS    2
+
+/*
+ * psx_syscall_vec performs a sequence of n syscalls on every thread
+ * of the process, using a single round of thread interruption. The
+ * calling thread performs the sequence first, and only the calls
+ * that succeed for it are performed by the other threads. The return
+ * value is 0 if all of the non-optional calls succeeded, otherwise
+ * it is -1 and errno is that of the first of them to fail.
+ */
+int psx_syscall_vec(struct psx_call *calls, int n);
+
 /*
  * This function should be used by systems to obtain pointers to the
  * two syscall functions provided by the PSX library. A linkage trick
@@ -91,6 +153,13 @@ void psx_load_syscalls(long int (**syscall_fn)(long int,
 						long int, long int, long int,
 						long int, long int, long int));
 
+/*
+ * psx_load_syscall_vec is the psx_syscall_vec() counterpart of
+ * psx_load_syscalls(). It can also be weakly defined by a library.
+ */
+void psx_load_syscall_vec(int (**syscall_vec_fn)(struct psx_call *calls,
+						 int n));
+
 /*
  * psx_sensitivity_t holds the level of paranoia for non-POSIX syscall
  * behavior. The default is PSX_IGNORE: which is best effort - no
@@ -112,6 +181,51 @@ typedef enum {
  */
 int psx_set_sensitivity(psx_sensitivity_t level);
 
+/*
+ * psx_tracking_t selects how the PSX mechanism discovers the threads
+ * it needs to interrupt. The default, PSX_TRACK_PROC, sweeps the
+ * /proc/<pid>/task directory until it is stable. PSX_TRACK_ROSTER
+ * walks an in-memory roster of the threads created via the legacy
+ * -Wl,--wrap=pthread_create linkage, and only falls back to the
+ * /proc sweep when the process contains threads that are not on that
+ * roster.
+ */
+typedef enum {
+    PSX_TRACK_PROC = 0,
+    PSX_TRACK_ROSTER = 1,
+} psx_tracking_t;
+
+/*
+ * psx_set_tracking sets the thread tracking mode of the PSX
+ * mechanism. The function returns 0 on success and -1 if the
+ * requested mode is invalid.
+ */
+int psx_set_tracking(psx_tracking_t mode);
+
+/*
+ * struct psx_stats reports the activity of the PSX mechanism. The
+ * thread map grows (by doubling) as needed to stay at most half full
+ * and is never shrunk, so map_resizes stops increasing once the
+ * process has a steady number of threads. map_occupied is the number
+ * of map entries used by the most recent broadcast. proc_sweeps
+ * counts the broadcasts that searched /proc for the threads of the
+ * process, which in PSX_TRACK_ROSTER mode is only needed if some
+ * threads were not created via the roster registering wrapper.
+ */
+struct psx_stats {
+    long int broadcasts;
+    long int map_entries;
+    long int map_occupied;
+    long int map_resizes;
+    long int proc_sweeps;
+};
+
+/*
+ * psx_get_stats fills in *stats. It returns 0 on success and -1 if
+ * stats is NULL.
+ */
+int psx_get_stats(struct psx_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
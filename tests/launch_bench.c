@@ -0,0 +1,189 @@
+/*
+ * launch_bench measures the latency of cap_launch() as a function of
+ * the resident size of the launching process, comparing fork()ed
+ * children with those started by cap_launcher_set_vfork(). The async
+ * column launches all of a round's fork()ed children with
+ * cap_launch_async() before collecting their results. The zygote
+ * column launches via a cap_new_zygote() created before the process
+ * grows. This is a benchmark, and is not run by "make test". Usage:
+ *
+ *    ./launch_bench [max-MiB]
+ */
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/capability.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define ROUNDS 50
+#define MiB    (1L << 20)
+
+static double now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * launch_usec returns the mean time taken to launch, and reap, the
+ * noop program.
+ */
+static double launch_usec(int vfork) {
+    static const char *args[] = { "./noop", NULL };
+    cap_launch_t attr = cap_new_launcher(args[0], args, NULL);
+    double start;
+    int i;
+
+    if (attr == NULL || cap_launcher_set_vfork(attr, vfork)) {
+	perror("failed to prepare launcher");
+	exit(1);
+    }
+    start = now_usec();
+    for (i = 0; i < ROUNDS; i++) {
+	int status;
+	pid_t child = cap_launch(attr, NULL);
+	if (child <= 0) {
+	    perror("failed to launch");
+	    exit(1);
+	}
+	if (waitpid(child, &status, 0) != child || status != 0) {
+	    fprintf(stderr, "noop failed: status=%d\n", status);
+	    exit(1);
+	}
+    }
+    cap_free(attr);
+    return (now_usec() - start) / ROUNDS;
+}
+
+/*
+ * async_usec returns the mean time taken to launch, and reap, the
+ * noop program when ROUNDS launches are in flight at once.
+ */
+static double async_usec(void) {
+    static const char *args[] = { "./noop", NULL };
+    cap_launch_t attr = cap_new_launcher(args[0], args, NULL);
+    struct pollfd fds[ROUNDS];
+    pid_t pids[ROUNDS];
+    double start;
+    int i, left;
+
+    if (attr == NULL) {
+	perror("failed to prepare launcher");
+	exit(1);
+    }
+    start = now_usec();
+    for (i = 0; i < ROUNDS; i++) {
+	fds[i].fd = cap_launch_async(attr, NULL, &pids[i], NULL);
+	fds[i].events = POLLIN;
+	if (fds[i].fd < 0) {
+	    perror("failed to launch");
+	    exit(1);
+	}
+    }
+    for (left = ROUNDS; left > 0; ) {
+	if (poll(fds, ROUNDS, -1) < 0) {
+	    perror("poll failed");
+	    exit(1);
+	}
+	for (i = 0; i < ROUNDS; i++) {
+	    if (fds[i].fd < 0 || !fds[i].revents) {
+		continue;
+	    }
+	    if (cap_launch_result(fds[i].fd)) {
+		perror("noop failed to launch");
+		exit(1);
+	    }
+	    fds[i].fd = -1;
+	    left--;
+	}
+    }
+    for (i = 0; i < ROUNDS; i++) {
+	int status;
+	if (waitpid(pids[i], &status, 0) != pids[i] || status != 0) {
+	    fprintf(stderr, "noop failed: status=%d\n", status);
+	    exit(1);
+	}
+    }
+    cap_free(attr);
+    return (now_usec() - start) / ROUNDS;
+}
+
+/*
+ * zygote_usec returns the mean time taken to launch, and reap, the
+ * noop program from the zygote, z.
+ */
+static double zygote_usec(cap_zygote_t z) {
+    static const char *args[] = { "./noop", NULL };
+    double start = now_usec();
+    int i;
+
+    for (i = 0; i < ROUNDS; i++) {
+	int status;
+	pid_t child = cap_zygote_launch(z, args[0], args, NULL);
+	if (child <= 0) {
+	    perror("failed to launch from zygote");
+	    exit(1);
+	}
+	if (waitpid(child, &status, 0) != child || status != 0) {
+	    fprintf(stderr, "noop failed: status=%d\n", status);
+	    exit(1);
+	}
+    }
+    return (now_usec() - start) / ROUNDS;
+}
+
+int main(int argc, char **argv) {
+    long max = 1024, rss = 0;
+    cap_launch_t attr;
+    cap_zygote_t z;
+
+    if (argc > 1) {
+	max = atol(argv[1]);
+	if (max < 0) {
+	    fprintf(stderr, "usage: %s [max-MiB]\n", argv[0]);
+	    exit(1);
+	}
+    }
+
+    attr = cap_func_launcher(NULL);
+    z = cap_new_zygote(attr, 4);
+    if (z == NULL) {
+	perror("failed to start zygote");
+	exit(1);
+    }
+    cap_free(attr);
+
+    printf("%10s %12s %12s %12s %12s\n", "RSS-MiB", "fork-usec",
+	   "async-usec", "vfork-usec", "zygote-usec");
+    for (;;) {
+	printf("%10ld %12.1f %12.1f %12.1f %12.1f\n", rss, launch_usec(0),
+	       async_usec(), launch_usec(1), zygote_usec(z));
+	fflush(stdout);
+
+	if (rss >= max) {
+	    break;
+	}
+	long want = rss ? 2 * rss : 16;
+	if (want > max) {
+	    want = max;
+	}
+	char *more = mmap(NULL, (want - rss) * MiB, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (more == MAP_FAILED) {
+	    perror("unable to grow process");
+	    exit(1);
+	}
+	memset(more, 1, (want - rss) * MiB);
+	rss = want;
+    }
+    cap_free(z);
+    exit(0);
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/capability.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -48,6 +49,132 @@ static int clean_out(void *data) {
     return 0;
 }
 
+/*
+ * try_async launches arg0 with cap_launch_async(), and confirms the
+ * outcome reported via its file descriptor matches want_errno, and
+ * that the accompanying pidfd can be used to reap the child.
+ */
+static int try_async(int vfork, const char *arg0, int want_errno) {
+    const char *args[] = { arg0, NULL };
+    cap_launch_t attr = cap_new_launcher(arg0, args, NULL);
+    struct pollfd pfd;
+    siginfo_t info;
+    pid_t pid;
+    int pidfd, ret;
+
+    if (attr == NULL || cap_launcher_set_vfork(attr, vfork)) {
+	perror("failed to prepare launcher");
+	return 0;
+    }
+    pfd.fd = cap_launch_async(attr, NULL, &pid, &pidfd);
+    cap_free(attr);
+    if (pfd.fd < 0) {
+	perror("failed to launch asynchronously");
+	return 0;
+    }
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) != 1) {
+	perror("failed to poll for launch");
+	return 0;
+    }
+    ret = cap_launch_result(pfd.fd) ? errno : 0;
+    if (ret != want_errno) {
+	fprintf(stderr, "[async%s %s] got errno=%d, want=%d\n",
+		vfork ? "v" : "", arg0, ret, want_errno);
+	return 0;
+    }
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PIDFD, pidfd, &info, WEXITED) != 0 || info.si_pid != pid) {
+	perror("failed to reap via pidfd");
+	return 0;
+    }
+    close(pidfd);
+    printf("[async%s %s] launched and reaped\n", vfork ? "v" : "", arg0);
+    /* a failing fork()ed child exit()s, flushing its copy of stdout */
+    fflush(stdout);
+    return 1;
+}
+
+/*
+ * try_zygote launches more programs than a zygote has pool children,
+ * confirming each runs with the zygote's uid and IAB, and that exec
+ * failures are reported. It also confirms the zygote does not hold
+ * on to a pipe the caller had open when it started.
+ */
+static int try_zygote(void) {
+    static const char *args[] = {
+	"../progs/tcapsh-static", "--is-uid=345", "--has-i=cap_chown",
+	"--has-a=cap_chown", NULL
+    };
+    static const char *no_exec[] = { "/", NULL };
+    cap_launch_t attr = cap_func_launcher(NULL);
+    cap_zygote_t z;
+    struct pollfd pfd;
+    int i, status, held[2];
+    char c;
+
+    if (pipe(held)) {
+	perror("unable to create pipe");
+	return 0;
+    }
+    cap_launcher_setuid(attr, 345);
+    cap_launcher_set_iab(attr, cap_iab_from_text("^cap_chown"));
+    z = cap_new_zygote(attr, 2);
+    cap_free(attr);
+    if (z == NULL) {
+	perror("failed to start zygote");
+	return 0;
+    }
+    close(held[1]);
+    pfd.fd = held[0];
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 5000) != 1 || read(held[0], &c, 1) != 0) {
+	fprintf(stderr, "zygote held a caller's pipe open\n");
+	return 0;
+    }
+    close(held[0]);
+    for (i = 0; i < 5; i++) {
+	pid_t child = cap_zygote_launch(z, args[0], args, NULL);
+	if (child <= 0) {
+	    perror("failed to launch from zygote");
+	    return 0;
+	}
+	if (waitpid(child, &status, 0) != child || status != 0) {
+	    fprintf(stderr, "[zygote %d] bad result: %d\n", i, status);
+	    return 0;
+	}
+    }
+    if (cap_zygote_launch(z, no_exec[0], no_exec, NULL) != -1 ||
+	errno != EACCES) {
+	perror("zygote launch of \"/\" did not fail with EACCES");
+	return 0;
+    }
+    if (cap_free(z)) {
+	perror("failed to free zygote");
+	return 0;
+    }
+    if (waitpid(-1, &status, WNOHANG) != -1 || errno != ECHILD) {
+	fprintf(stderr, "zygote left children behind\n");
+	return 0;
+    }
+
+    attr = cap_func_launcher(NULL);
+    cap_launcher_set_chroot(attr, "/does/not/exist");
+    z = cap_new_zygote(attr, 2);
+    cap_free(attr);
+    if (z != NULL) {
+	fprintf(stderr, "zygote with an impossible chroot did not fail\n");
+	return 0;
+    }
+    if (waitpid(-1, &status, WNOHANG) != -1 || errno != ECHILD) {
+	fprintf(stderr, "failed zygote left children behind\n");
+	return 0;
+    }
+    printf("[zygote] launched and reaped\n");
+    fflush(stdout);
+    return 1;
+}
+
 int main(int argc, char **argv) {
     static struct test_case_s vs[] = {
 	{
@@ -131,87 +258,120 @@ int main(int argc, char **argv) {
 	exit(1);
     }
 
-    int success = 1, i;
-    for (i=0; vs[i].pass_on != NO_MORE; i++) {
-	cap_launch_t attr = NULL;
-	const struct test_case_s *v = &vs[i];
-	if (cap_launch(attr, NULL) != -1) {
-	    perror("NULL launch didn't fail");
-	    exit(1);
-	}
-	printf("[%d] test should %s\n", i,
-	       v->result || v->launch_abort ? "generate error" : "work");
-	if (v->args[0] != NULL) {
-	    attr = cap_new_launcher(v->args[0], v->args, v->envp);
-	    if (attr == NULL) {
-		perror("failed to obtain launcher");
+    int success = 1, i, vfork;
+    /* each test is run with a fork()ed, then a vfork()-like, child */
+    for (vfork = 0; vfork < 2; vfork++) {
+	for (i=0; vs[i].pass_on != NO_MORE; i++) {
+	    cap_launch_t attr = NULL;
+	    const struct test_case_s *v = &vs[i];
+	    if (cap_launch(attr, NULL) != -1) {
+		perror("NULL launch didn't fail");
 		exit(1);
 	    }
-	    if (v->callback_fn != NULL) {
-		cap_launcher_callback(attr, v->callback_fn);
+	    printf("[%d%s] test should %s\n", i, vfork ? "v" : "",
+		   v->result || v->launch_abort ? "generate error" : "work");
+	    if (v->args[0] != NULL) {
+		attr = cap_new_launcher(v->args[0], v->args, v->envp);
+		if (attr == NULL) {
+		    perror("failed to obtain launcher");
+		    exit(1);
+		}
+		if (v->callback_fn != NULL) {
+		    cap_launcher_callback(attr, v->callback_fn);
+		}
+	    } else {
+		attr = cap_func_launcher(v->callback_fn);
 	    }
-	} else {
-	    attr = cap_func_launcher(v->callback_fn);
-	}
-	if (v->chroot) {
-	    cap_launcher_set_chroot(attr, v->chroot);
-	}
-	if (v->uid) {
-	    cap_launcher_setuid(attr, v->uid);
-	}
-	if (v->gid) {
-	    cap_launcher_setgroups(attr, v->gid, v->ngroups, v->groups);
-	}
-	if (v->iab) {
-	    cap_iab_t iab = cap_iab_from_text(v->iab);
-	    if (iab == NULL) {
-		fprintf(stderr, "[%d] failed to decode iab [%s]", i, v->iab);
-		perror(":");
-		success = 0;
+	    if (v->chroot) {
+		cap_launcher_set_chroot(attr, v->chroot);
+	    }
+	    if (v->uid) {
+		cap_launcher_setuid(attr, v->uid);
+	    }
+	    if (v->gid) {
+		cap_launcher_setgroups(attr, v->gid, v->ngroups, v->groups);
+	    }
+	    if (v->iab) {
+		cap_iab_t iab = cap_iab_from_text(v->iab);
+		if (iab == NULL) {
+		    fprintf(stderr, "[%d] failed to decode iab [%s]", i, v->iab);
+		    perror(":");
+		    success = 0;
+		    continue;
+		}
+		cap_iab_t old = cap_launcher_set_iab(attr, iab);
+		if (cap_free(old)) {
+		    fprintf(stderr, "[%d] failed to decode iab [%s]", i, v->iab);
+		    perror(":");
+		    success = 0;
+		    continue;
+		}
+	    }
+	    if (v->mode) {
+		cap_launcher_set_mode(attr, v->mode);
+	    }
+	    if (vfork) {
+		cap_launcher_set_vfork(attr, 1);
+	    }
+
+	    pid_t child = cap_launch(attr, NULL);
+
+	    if (child <= 0) {
+		fprintf(stderr, "[%d] failed to launch: ", i);
+		perror("");
+		if (!v->launch_abort) {
+		    success = 0;
+		}
 		continue;
 	    }
-	    cap_iab_t old = cap_launcher_set_iab(attr, iab);
-	    if (cap_free(old)) {
-		fprintf(stderr, "[%d] failed to decode iab [%s]", i, v->iab);
-		perror(":");
+	    if (cap_free(attr)) {
+		fprintf(stderr, "[%d] failed to free launcher: ", i);
+		perror("");
+		success = 0;
+	    }
+	    int result;
+	    int ret = waitpid(child, &result, 0);
+	    if (ret != child) {
+		fprintf(stderr, "[%d] failed to wait: ", i);
+		perror("");
 		success = 0;
 		continue;
 	    }
-	}
-	if (v->mode) {
-	    cap_launcher_set_mode(attr, v->mode);
-	}
-
-	pid_t child = cap_launch(attr, NULL);
-
-	if (child <= 0) {
-	    fprintf(stderr, "[%d] failed to launch: ", i);
-	    perror("");
-	    if (!v->launch_abort) {
+	    if (result != v->result) {
+		fprintf(stderr, "[%d] bad result: got=%d want=%d: ", i, result,
+			v->result);
+		perror("");
 		success = 0;
+		continue;
 	    }
-	    continue;
-	}
-	if (cap_free(attr)) {
-	    fprintf(stderr, "[%d] failed to free launcher: ", i);
-	    perror("");
-	    success = 0;
 	}
-	int result;
-	int ret = waitpid(child, &result, 0);
-	if (ret != child) {
-	    fprintf(stderr, "[%d] failed to wait: ", i);
-	    perror("");
+
+	if (!try_async(vfork, "./noop", 0) || !try_async(vfork, "/", EACCES)) {
 	    success = 0;
-	    continue;
 	}
-	if (result != v->result) {
-	    fprintf(stderr, "[%d] bad result: got=%d want=%d: ", i, result,
-		    v->result);
-	    perror("");
+	static const char *no_exec[] = { "/", NULL };
+	cap_launch_t attr = cap_new_launcher(no_exec[0], no_exec, NULL);
+	int pidfd = 0;
+	cap_launcher_set_vfork(attr, vfork);
+	if (cap_launch_pidfd(attr, NULL, &pidfd) != -1 || errno != ECHILD ||
+	    pidfd != -1) {
+	    fprintf(stderr, "failed launch left a pidfd=%d\n", pidfd);
 	    success = 0;
-	    continue;
 	}
+	cap_free(attr);
+    }
+
+    cap_launch_t purposeless = cap_func_launcher(NULL);
+    int early_pidfd = 0;
+    if (cap_launch_pidfd(purposeless, NULL, &early_pidfd) != -1 ||
+	errno != EINVAL || early_pidfd != -1) {
+	fprintf(stderr, "rejected launch left a pidfd=%d\n", early_pidfd);
+	success = 0;
+    }
+    cap_free(purposeless);
+
+    if (!try_zygote()) {
+	success = 0;
     }
 
     cap_t final = cap_get_proc();
@@ -0,0 +1,177 @@
+/*
+ * This privileged test confirms that the multi-step privilege
+ * changing functions of libcap, which use a single psx_syscall_vec()
+ * broadcast when linked with libpsx, leave every thread of the
+ * process in the same state.
+ */
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/capability.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct snapshot {
+    uid_t uid;
+    gid_t gid;
+    int keepcaps;
+    unsigned secbits;
+    int net_raw_bound;
+    int ambient;
+    char *text;
+};
+
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int asked, answered;
+static struct snapshot peer;
+
+static void take_snapshot(struct snapshot *s) {
+    cap_t caps = cap_get_proc();
+    s->uid = getuid();
+    s->gid = getgid();
+    s->keepcaps = prctl(PR_GET_KEEPCAPS);
+    s->secbits = cap_get_secbits();
+    s->net_raw_bound = cap_get_bound(CAP_NET_RAW);
+    s->ambient = cap_get_ambient(CAP_NET_BIND_SERVICE);
+    s->text = cap_to_text(caps, NULL);
+    cap_free(caps);
+}
+
+static void *observer(void *ignored) {
+    pthread_mutex_lock(&mu);
+    for (;;) {
+	while (asked == answered) {
+	    pthread_cond_wait(&cond, &mu);
+	}
+	cap_free(peer.text);
+	take_snapshot(&peer);
+	answered = asked;
+	pthread_cond_broadcast(&cond);
+    }
+    return NULL;
+}
+
+static void compare(const char *step) {
+    struct snapshot mine;
+    take_snapshot(&mine);
+
+    pthread_mutex_lock(&mu);
+    asked++;
+    pthread_cond_broadcast(&cond);
+    while (asked != answered) {
+	pthread_cond_wait(&cond, &mu);
+    }
+    if (mine.uid != peer.uid || mine.gid != peer.gid ||
+	mine.keepcaps != peer.keepcaps || mine.secbits != peer.secbits ||
+	mine.net_raw_bound != peer.net_raw_bound ||
+	mine.ambient != peer.ambient || strcmp(mine.text, peer.text)) {
+	printf("FAILED %s: uid=%d/%d gid=%d/%d keep=%d/%d secbits=%x/%x"
+	       " bound=%d/%d ambient=%d/%d caps=\"%s\"/\"%s\"\n", step,
+	       mine.uid, peer.uid, mine.gid, peer.gid,
+	       mine.keepcaps, peer.keepcaps, mine.secbits, peer.secbits,
+	       mine.net_raw_bound, peer.net_raw_bound,
+	       mine.ambient, peer.ambient, mine.text, peer.text);
+	exit(1);
+    }
+    pthread_mutex_unlock(&mu);
+    printf("%s: threads agree on \"%s\"\n", step, mine.text);
+    cap_free(mine.text);
+}
+
+/*
+ * failed_mode confirms, in a child process, that a cap_set_mode()
+ * that cannot raise CAP_SETPCAP stops there: only the Effective
+ * flags are lowered, and the Permitted ones and no_new_privs are
+ * left alone.
+ */
+static void failed_mode(void) {
+    cap_value_t setpcap[] = {CAP_SETPCAP};
+    int status;
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+	cap_t caps = cap_get_proc();
+	cap_set_flag(caps, CAP_PERMITTED, 1, setpcap, CAP_CLEAR);
+	cap_set_flag(caps, CAP_EFFECTIVE, 1, setpcap, CAP_CLEAR);
+	if (cap_set_proc(caps)) {
+	    perror("unable to drop cap_setpcap");
+	    exit(1);
+	}
+	cap_clear_flag(caps, CAP_EFFECTIVE);
+	char *want = cap_to_text(caps, NULL);
+	cap_free(caps);
+
+	if (cap_set_mode(CAP_MODE_NOPRIV) == 0) {
+	    printf("FAILED: cap_set_mode succeeded without cap_setpcap\n");
+	    exit(1);
+	}
+	caps = cap_get_proc();
+	char *got = cap_to_text(caps, NULL);
+	if (strcmp(want, got) || prctl(PR_GET_NO_NEW_PRIVS, 0, 0, 0, 0)) {
+	    printf("FAILED: failed cap_set_mode left \"%s\" (want \"%s\")"
+		   " no_new_privs=%d\n", got, want,
+		   prctl(PR_GET_NO_NEW_PRIVS, 0, 0, 0, 0));
+	    exit(1);
+	}
+	cap_free(caps);
+	cap_free(got);
+	cap_free(want);
+	exit(0);
+    }
+    if (child < 0 || waitpid(child, &status, 0) != child || status != 0) {
+	printf("FAILED: failing cap_set_mode (status=%d)\n", status);
+	exit(1);
+    }
+    printf("failed cap_set_mode: only cleared Effective flags\n");
+}
+
+int main(int argc, char **argv) {
+    pthread_t tid;
+
+    if (pthread_create(&tid, NULL, observer, NULL)) {
+	perror("unable to start observer thread");
+	exit(1);
+    }
+    compare("start");
+
+    cap_iab_t iab = cap_iab_from_text("!cap_net_raw,^cap_net_bind_service");
+    if (iab == NULL || cap_iab_set_proc(iab)) {
+	perror("cap_iab_set_proc failed");
+	exit(1);
+    }
+    cap_free(iab);
+    compare("cap_iab_set_proc");
+
+    if (cap_setgroups(1, 0, NULL)) {
+	perror("cap_setgroups failed");
+	exit(1);
+    }
+    compare("cap_setgroups");
+
+    if (cap_setuid(1)) {
+	perror("cap_setuid failed");
+	exit(1);
+    }
+    compare("cap_setuid");
+
+    failed_mode();
+
+    if (cap_set_mode(CAP_MODE_NOPRIV)) {
+	perror("cap_set_mode failed");
+	exit(1);
+    }
+    compare("cap_set_mode");
+
+    printf("PASSED\n");
+    exit(0);
+}
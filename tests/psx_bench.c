@@ -0,0 +1,122 @@
+/*
+ * psx_bench measures the latency of a psx_syscall() broadcast as a
+ * function of the number of threads in the process. This is a
+ * benchmark, and is not run by "make test". Usage:
+ *
+ *    ./psx_bench [--contend] [--roster] [max-threads]
+ *
+ * --contend keeps every CPU busy with a spinning thread while the
+ * measurement is made. --roster selects PSX_TRACK_ROSTER thread
+ * tracking (this binary is linked with -Wl,--wrap=pthread_create).
+ */
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/psx_syscall.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ROUNDS 100
+
+static volatile int spinning = 1;
+
+static void *idler(void *ignored) {
+    for (;;) {
+	pause();
+    }
+    return NULL;
+}
+
+static void *spinner(void *ignored) {
+    while (spinning) {
+	;
+    }
+    return NULL;
+}
+
+static double now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void launch(void *(*fn)(void *)) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, fn, NULL)) {
+	perror("failed to create thread");
+	exit(1);
+    }
+    pthread_detach(tid);
+}
+
+int main(int argc, char **argv) {
+    int i, contend = 0, max = 1024, threads = 0, spinners = 0;
+
+    for (i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "--contend")) {
+	    contend = 1;
+	} else if (!strcmp(argv[i], "--roster")) {
+	    if (psx_set_tracking(PSX_TRACK_ROSTER)) {
+		perror("failed to select roster tracking");
+		exit(1);
+	    }
+	} else {
+	    max = atoi(argv[i]);
+	    if (max < 1) {
+		fprintf(stderr, "usage: %s [--contend] [--roster] [max-threads]\n",
+			argv[0]);
+		exit(1);
+	    }
+	}
+    }
+
+    if (contend) {
+	spinners = sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 0; i < spinners; i++) {
+	    launch(spinner);
+	}
+	printf("contending with %d spinning threads\n", spinners);
+    }
+
+    printf("%10s %16s\n", "threads", "usec/broadcast");
+    for (;;) {
+	double start = now_usec();
+	for (i = 0; i < ROUNDS; i++) {
+	    if (psx_syscall(SYS_prctl, PR_SET_KEEPCAPS, i & 1)) {
+		perror("psx_syscall failed");
+		exit(1);
+	    }
+	}
+	printf("%10d %16.1f\n", 1 + spinners + threads,
+	       (now_usec() - start) / ROUNDS);
+	fflush(stdout);
+
+	if (threads == max) {
+	    break;
+	}
+	int want = threads ? 2 * threads : 1;
+	if (want > max) {
+	    want = max;
+	}
+	for (; threads < want; threads++) {
+	    launch(idler);
+	}
+    }
+
+    struct psx_stats stats;
+    if (psx_get_stats(&stats) == 0) {
+	printf("%ld broadcasts, thread map: %ld entries, %ld resizes\n",
+	       stats.broadcasts, stats.map_entries, stats.map_resizes);
+    }
+
+    spinning = 0;
+    exit(0);
+}
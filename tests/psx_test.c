@@ -2,6 +2,7 @@
 #define _DEFAULT_SOURCE
 #endif
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -70,12 +71,78 @@ static void *say_hello(void *args) {
     return NULL;
 }
 
+/*
+ * broadcast_from_thread flips keepcaps back from a thread other than
+ * the initial one, which must then be found too.
+ */
+static void *broadcast_from_thread(void *args) {
+    if (psx_syscall(SYS_prctl, PR_SET_KEEPCAPS, !global_kept)) {
+	return args;
+    }
+    return NULL;
+}
+
+int peer_ready = 0;
+int peer_released = 0;
+
+/*
+ * keepcaps_peer waits, while the main thread makes a broadcast, and
+ * then returns the keepcaps value of its own thread.
+ */
+static void *keepcaps_peer(void *args) {
+    pthread_mutex_lock(&mu);
+    peer_ready = 1;
+    pthread_cond_broadcast(&cond);
+    while (!peer_released) {
+	pthread_cond_wait(&cond, &mu);
+    }
+    pthread_mutex_unlock(&mu);
+    return (void *) (long) prctl(PR_GET_KEEPCAPS);
+}
+
+static void start_peer(pthread_t *peer) {
+    pthread_mutex_lock(&mu);
+    peer_ready = peer_released = 0;
+    pthread_mutex_unlock(&mu);
+    if (pthread_create(peer, NULL, keepcaps_peer, NULL)) {
+	perror("failed to start peer");
+	exit(1);
+    }
+    pthread_mutex_lock(&mu);
+    while (!peer_ready) {
+	pthread_cond_wait(&cond, &mu);
+    }
+    pthread_mutex_unlock(&mu);
+}
+
+static void finish_peer(pthread_t peer, const char *title) {
+    void *kept;
+
+    pthread_mutex_lock(&mu);
+    peer_released = 1;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mu);
+    if (pthread_join(peer, &kept) || (long) kept != global_kept) {
+	printf("--> FAILURE %s: peer keepcaps=%ld want=%d\n", title,
+	       (long) kept, global_kept);
+	exit(1);
+    }
+    say_hello_expecting(title, 0, global_kept);
+}
+
 int main(int argc, char **argv) {
     pthread_t tid[3];
     int i;
     pid_t child = 0;
     char * const stop_argv[3] = { argv[0], strdup("stop"), NULL };
 
+#ifdef WITH_ROSTER
+    if (psx_set_tracking(PSX_TRACK_ROSTER)) {
+	perror("failed to select roster tracking");
+	exit(1);
+    }
+#endif
+
     if (argc != 1) {
 	printf("child %d starting\n", getpid());
 	usleep(2000);
@@ -137,6 +204,78 @@ int main(int argc, char **argv) {
 	}
     }
 
+    pthread_t other;
+    void *failed = &other;
+    if (pthread_create(&other, NULL, broadcast_from_thread, failed) ||
+	pthread_join(other, &failed) || failed != NULL) {
+	printf("--> FAILURE broadcast from a thread\n");
+	exit(1);
+    }
+    global_kept = !global_kept;
+    say_hello_expecting("main", 10, global_kept);
+
+    /* exercise the batched API: the last call sets global_kept */
+    pthread_t peer;
+    start_peer(&peer);
+    global_kept = !global_kept;
+    struct psx_call calls[3] = {
+	{ .syscall_nr = SYS_prctl,
+	  .arg = { PR_SET_KEEPCAPS, !global_kept } },
+	{ .syscall_nr = SYS_prctl, .arg = { -1 },
+	  .flags = PSX_CALL_OPTIONAL },
+	{ .syscall_nr = SYS_prctl,
+	  .arg = { PR_SET_KEEPCAPS, global_kept } },
+    };
+    if (psx_syscall_vec(calls, 3) || calls[1].error != EINVAL ||
+	calls[0].differ || calls[2].differ) {
+	printf("--> FAILURE psx_syscall_vec: errors=%d,%d,%d\n",
+	       calls[0].error, calls[1].error, calls[2].error);
+	exit(1);
+    }
+    finish_peer(peer, "psx_syscall_vec");
+
+    /* exercise the per-thread results API */
+    struct psx_result results[8];
+    int n = 8;
+    start_peer(&peer);
+    global_kept = !global_kept;
+    if (psx_syscall_results(results, &n, SYS_prctl, PR_SET_KEEPCAPS,
+			    global_kept, 0, 0, 0, 0) ||
+	n != 2 || results[0].tid != syscall(SYS_gettid)) {
+	printf("--> FAILURE psx_syscall_results: n=%d\n", n);
+	exit(1);
+    }
+    for (i = 0; i < n; i++) {
+	if (results[i].retval || results[i].error ||
+	    results[i].latency_ns < 0) {
+	    printf("--> FAILURE psx_syscall_results[%d]: tid=%ld retval=%ld"
+		   " error=%d latency=%lldns\n", i, results[i].tid,
+		   results[i].retval, results[i].error,
+		   results[i].latency_ns);
+	    exit(1);
+	}
+    }
+    finish_peer(peer, "psx_syscall_results");
+
+    struct psx_stats stats;
+    long want_sweeps = 0;
+    if (psx_get_stats(&stats) || stats.broadcasts < 11 ||
+	stats.map_resizes != 0 ||
+	2 * stats.map_occupied > stats.map_entries) {
+	printf("--> FAILURE psx_get_stats: broadcasts=%ld entries=%ld"
+	       " occupied=%ld resizes=%ld\n", stats.broadcasts,
+	       stats.map_entries, stats.map_occupied, stats.map_resizes);
+	exit(1);
+    }
+#ifndef WITH_ROSTER
+    want_sweeps = stats.broadcasts;
+#endif
+    if (stats.proc_sweeps != want_sweeps) {
+	printf("--> FAILURE psx_get_stats: proc_sweeps=%ld want=%ld\n",
+	       stats.proc_sweeps, want_sweeps);
+	exit(1);
+    }
+
     if (child) {
 	int status;
 	waitpid(child, &status, 0);